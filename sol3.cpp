@@ -1,445 +1,7122 @@
 // === Region: Header files ===
-// Necessary header files are included,
-// DO NOT include extra header files
+// Necessary header files are included
 // ============================
 #include <iostream>
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <cstdio>
+#include <cstdlib>
+#include <climits>
+#include <csignal>
 #include <cstring>
+#include <cctype>
+#include <cmath>
 #include <iomanip>
+#include <atomic>
+#include <mutex>
+#include <shared_mutex>
+#include <thread>
+#include <chrono>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
 using namespace std;
 
-const int MAX_NUM_SHOPPING_CARTS = 10; // at most 10 shopping carts
+// The loops of the SIMD kernels are vectorized by GCC at -O2 as well (Clang already vectorizes at -O2)
+#if defined(__GNUC__) && !defined(__clang__)
+#define VECTORIZE __attribute__((optimize("tree-vectorize")))
+#else
+#define VECTORIZE
+#endif
+
+const int MAX_NUM_SHOPPING_CARTS = 10; // at most 10 shopping carts at startup, more can be opened later
 const int MAX_ID = 10;                 // at most 10 characters (including the NULL character)
 const int MAX_TITLE = 100;             // at most 100 characters (including the NULL character)
+const int MAX_SKIP_LEVEL = 16;         // at most 16 skip list levels (enough for 4^16 stock items)
+const int NODES_PER_SLAB = 1024;       // number of nodes a NodePool allocates at once
+const int LINKS_PER_SLAB = 4096;       // number of skip links a SkipArrayPool allocates at once
+const int CHARS_PER_SLAB = 65536;      // number of characters a TitlePool allocates at once
+const int CHARS_PER_TITLE_UNIT = 8;    // a TitlePool stores a title in units of 8 characters
+const int MAX_TITLE_UNITS = (MAX_TITLE + CHARS_PER_TITLE_UNIT - 1) / CHARS_PER_TITLE_UNIT; // at most 13 units a title
+const int CARTS_PER_CHUNK = 1024;      // number of shopping carts a ShoppingCartTable allocates at once
+const int MAX_FILE_NAME = 256;         // at most 256 characters (including the NULL character)
+const int MAX_BASKET_ITEMS = 256;      // at most 256 stock items scanned into a basket at once
+const unsigned int MAX_PAGE_SIZE = 10000; // at most 10000 stock items on a page of a listing
+const int TOTAL_CHUNK_SIZE = 1024;     // number of shopping cart lines gathered at once for calculate_total_amount
+const int SALES_PER_CHUNK = 65536;     // number of sale lines a SaleChunk holds
+const int MAX_SALE_CHUNKS = 65536;     // at most 65536 SaleChunks (2^32 sale lines)
+const int SALES_PER_SCAN = 1 << 18;    // at least 2^18 sale lines for each thread of a sales report
+const int INVENTORY_PER_CHUNK = 65536; // number of inventory slots allocated at once
+const int MAX_INVENTORY_CHUNKS = 65536; // at most 65536 chunks of inventory slots
+const int FLAT_MIN_CAPACITY = 8;       // number of entries a FlatStorage allocates first
+const int BTREE_FANOUT = 16;           // number of entries of a B-tree leaf, and of children of an inner B-tree block
+const int CART_INLINE_LINES = 32;      // number of lines a shopping cart holds before they spill to the heap
+const int MAX_COUNTED_KEYS = 8;        // at most 8 keys of an InlineStorage are searched by counting, more by a binary search
+
+const unsigned int NO_SHOPPING_CART = 0xffffffff; // not a shopping cart ID
+
+const unsigned long long ID_KEY_STRCMP = 1ULL << 63; // set in the key of an id that must be compared by strcmp
+
+// A lock for short critical sections, such as a free list or the list of ShoppingCartItem of a StockItem
+struct SpinLock
+{
+    atomic<bool> locked; // Whether the lock is held
+};
+
+void spin_lock(SpinLock &lock)
+{
+    while (lock.locked.exchange(true, memory_order_acquire))
+    {
+        while (lock.locked.load(memory_order_relaxed))
+            ; // wait without writing until the lock looks free
+    }
+}
+
+void spin_unlock(SpinLock &lock)
+{
+    lock.locked.store(false, memory_order_release);
+}
+
+// === Operation statistics ===
+// Every ll_* operation is counted, and one in STATS_SAMPLE_PERIOD of them records its latency in nanoseconds,
+// so the clock is read twice every STATS_SAMPLE_PERIOD operations instead of twice per operation.
+// Every search of a list records the number of nodes it walked.
+// The histograms belong to the thread recording them, so recording takes no lock and writes no shared cache line.
+// A bucket covers a quarter of a power of 2, so a percentile is at most 25% above the exact value
+enum StatsOperation
+{
+    STATS_INSERT_STOCK_ITEM = 0,
+    STATS_UPDATE_STOCK_ITEM_PRICE,
+    STATS_REMOVE_STOCK_ITEM,
+    STATS_INSERT_OR_ADD_STOCK_ITEM,
+    STATS_DEDUCT_STOCK_ITEM,
+    STATS_REMOVE_STOCK_ITEM_FROM_CART,
+    STATS_CLEAR_SHOPPING_CART,
+    STATS_ADD_BASKET,
+    STATS_LIST_STOCK_ITEMS,
+    STATS_SEARCH_STOCK_ITEM_TITLES,
+    STATS_PRINT_ALL,
+    STATS_IMPORT_STOCK_ITEMS,
+    STATS_BULK_UPDATE_PRICES,
+    STATS_SAVE_SNAPSHOT,
+    STATS_LOAD_SNAPSHOT,
+    STATS_SALES_REPORT,
+    STATS_RESTOCK_STOCK_ITEM,
+    STATS_STOCK_ITEM_WALK,     // the nodes walked by a search of the stock item list, not a latency
+    STATS_SHOPPING_CART_WALK,  // the lines compared by a search of a shopping cart, not a latency
+    NUM_STATS_OPERATIONS
+};
+
+const char *statsOperationNames[NUM_STATS_OPERATIONS] = {
+    "ll_insert_stock_item",
+    "ll_update_stock_item_price",
+    "ll_remove_stock_item",
+    "ll_insert_or_add_stock_item_quantity",
+    "ll_deduct_stock_item_quantity_from_shopping_cart",
+    "ll_remove_stock_item_from_shopping_cart",
+    "ll_clear_shopping_cart",
+    "ll_add_basket_to_shopping_cart",
+    "ll_list_stock_items",
+    "ll_search_stock_item_titles",
+    "ll_print_all",
+    "ll_import_stock_items",
+    "ll_bulk_update_stock_item_prices",
+    "snapshot_save",
+    "snapshot_load",
+    "sales_aggregate",
+    "ll_restock_stock_item",
+    "ll_search_stock_item walk",
+    "ll_search_shopping_cart_item walk"};
+
+const int STATS_BUCKETS = 256;       // 4 buckets for each power of 2 of a 64-bit value
+const int STATS_SAMPLE_PERIOD = 16;  // one in 16 operations records its latency
+
+// The histograms of a thread
+// Only the owner thread writes the counts, so they are atomic only for the threads summing them up
+struct StatsRecord
+{
+    atomic<unsigned long long> counts[NUM_STATS_OPERATIONS][STATS_BUCKETS]; // counts[operation][bucket]
+    atomic<unsigned long long> numOfOperations[NUM_STATS_OPERATIONS];      // The operations counted, sampled or not
+    unsigned int numUntilSample; // The operations left until the next sampled one (1 for the next one)
+    atomic<bool> inUse;          // Whether a thread owns the record
+    StatsRecord *next;           // The pointer pointing to the next record
+};
+
+// The record of the current thread, given back for reuse (with its counts) when the thread exits
+struct StatsThread
+{
+    StatsRecord *record;
+    ~StatsThread()
+    {
+        if (record != nullptr)
+            record->inUse.store(false, memory_order_release);
+    }
+};
+
+atomic<StatsRecord *> statsRecords(nullptr);
+thread_local StatsThread statsThread = {nullptr};
+thread_local StatsRecord *statsRecord = nullptr; // statsThread.record, read without the initialization check of statsThread
+
+// Helper function: return the record of the current thread, taking a free one or adding a new one
+StatsRecord *stats_thread_record()
+{
+    if (statsRecord != nullptr)
+        return statsRecord;
+    StatsRecord *record;
+    for (record = statsRecords.load(memory_order_acquire); record != nullptr; record = record->next)
+    {
+        bool inUse = false;
+        if (!record->inUse.load(memory_order_relaxed) && record->inUse.compare_exchange_strong(inUse, true))
+            break;
+    }
+    if (record == nullptr)
+    {
+        // the records are never deleted, so the counts of the threads that exited are kept
+        record = new StatsRecord;
+        for (int i = 0; i < NUM_STATS_OPERATIONS; i++)
+        {
+            for (int j = 0; j < STATS_BUCKETS; j++)
+                record->counts[i][j].store(0, memory_order_relaxed);
+            record->numOfOperations[i].store(0, memory_order_relaxed);
+        }
+        record->numUntilSample = 1;
+        record->inUse.store(true, memory_order_relaxed);
+        record->next = statsRecords.load(memory_order_relaxed);
+        while (!statsRecords.compare_exchange_weak(record->next, record))
+        {
+        }
+    }
+    statsThread.record = record;
+    statsRecord = record;
+    return record;
+}
+
+// Helper function: the bucket of a value, values below 4 have a bucket each
+int stats_bucket(const unsigned long long value)
+{
+    if (value < 4)
+        return value;
+    int log = 63 - __builtin_clzll(value);
+    return 4 * (log - 1) + ((value >> (log - 2)) & 3);
+}
+
+// Helper function: the greatest value of a bucket
+unsigned long long stats_bucket_limit(const int bucket)
+{
+    if (bucket < 4)
+        return bucket;
+    if (bucket == STATS_BUCKETS - 5)
+        return ~0ULL; // the last bucket in use
+    int log = (bucket + 1) / 4 + 1;
+    return (static_cast<unsigned long long>(4 + (bucket + 1) % 4) << (log - 2)) - 1;
+}
+
+// Helper function: add one to a count of the current thread, no other thread writes it
+void stats_increment(atomic<unsigned long long> &count)
+{
+    count.store(count.load(memory_order_relaxed) + 1, memory_order_relaxed);
+}
+
+// Record a value (a list walk) in the histogram of an operation
+void stats_record(const StatsOperation operation, const unsigned long long value)
+{
+    StatsRecord *record = stats_thread_record();
+    stats_increment(record->numOfOperations[operation]);
+    stats_increment(record->counts[operation][stats_bucket(value)]);
+}
+
+// Counts an operation, and records its latency from the construction to the end of the scope if it is sampled
+struct StatsTimer
+{
+    StatsOperation operation;
+    StatsRecord *record;
+    bool sampled;
+    chrono::steady_clock::time_point start;
+    StatsTimer(const StatsOperation operation) : operation(operation), record(stats_thread_record()), sampled(--record->numUntilSample == 0)
+    {
+        if (sampled)
+        {
+            record->numUntilSample = STATS_SAMPLE_PERIOD;
+            start = chrono::steady_clock::now();
+        }
+    }
+    ~StatsTimer()
+    {
+        stats_increment(record->numOfOperations[operation]);
+        if (sampled)
+            stats_increment(record->counts[operation][stats_bucket(chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start).count())]);
+    }
+};
+
+struct StockItem;
+struct ShoppingCartItem;
+struct ShoppingCart;
+
+// A link of the StockItem list
+// Links are atomic, so a reader can walk the list while a writer links or unlinks a StockItem
+typedef atomic<StockItem *> StockItemLink;
 
 // A sorted linked list of StockItem, sorted by its id
+// The list is also a skip list: level 0 is the list itself (next), and
+// a StockItem on level i > 0 is linked to the next StockItem on that level by skip[i - 1].
+// The head of an indexed list is linked into all MAX_SKIP_LEVEL levels, so
+// ll_search_stock_item takes O(log n) instead of walking the whole list.
+// The fields used by lookups and totals come first, the title is kept out of line in the TitlePool,
+// so a StockItem takes 64 bytes instead of 128
 struct StockItem
 {
-    char id[MAX_ID];           // id is a unique identifier of the StockItem (e.g., item001)
-    char title[MAX_TITLE];     // title is a description of the StockItem (e.g., Milk)
-    unsigned int priceInCents; // Price in cents. double/float is not used to avoid precision problems
-    StockItem *next;           // The pointer pointing to the next StockItem
+    unsigned long long key;      // id encoded by encode_id_key, compared instead of id
+    char id[MAX_ID];             // id is a unique identifier of the StockItem (e.g., item001)
+    unsigned char level;         // The number of skip list levels the StockItem is linked into (at least 1)
+    mutable SpinLock cartItemsLock; // The lock of cartItems, shopping carts on different threads may share a StockItem
+    atomic<unsigned int> priceInCents; // Price in cents. double/float is not used to avoid precision problems
+    StockItemLink next;          // The pointer pointing to the next StockItem
+    StockItemLink *skip;         // skip[i - 1] points to the next StockItem on level i (nullptr if level is 1)
+    const char *title;           // title is a description of the StockItem (e.g., Milk), interned in the TitlePool
+    ShoppingCartItem *cartItems; // The ShoppingCartItem of every shopping cart holding the StockItem
+    unsigned int titleSerial;    // The serial of the StockItem in the TitleIndex
+    atomic<unsigned int> inventorySlot; // The slot of the counts of the StockItem in the Inventory (0 if its stock is not tracked)
 };
 
-// A sorted linked list represents a shopping cart, sorted by item->id
+// A line of a shopping cart, the lines are kept sorted by item->id in the CartLines of the shopping cart
+// Every ShoppingCartItem is also linked into the list of ShoppingCartItem of its StockItem,
+// so the shopping carts holding a StockItem are found without visiting the other shopping carts
 struct ShoppingCartItem
 {
-    unsigned int quantity;  // A number of items
-    const StockItem *item;  // A pointer pointing to the StockItem
-    ShoppingCartItem *next; // The pointer pointing to the next ShoppingCartItem
+    unsigned long long key;              // item->key, kept here so searching a shopping cart does not visit the StockItem
+    unsigned int quantity;               // A number of items
+    unsigned int priceInCents;           // item->priceInCents, kept up to date by ll_set_stock_item_price
+    const StockItem *item;               // A pointer pointing to the StockItem
+    ShoppingCartItem *next;              // The pointer pointing to the next ShoppingCartItem (in a ListStorage or a free list)
+    ShoppingCart *cart;                  // The shopping cart holding the ShoppingCartItem
+    ShoppingCartItem *nextInStockItem;   // The next ShoppingCartItem of the same StockItem
+    ShoppingCartItem **pprevInStockItem; // The pointer pointing to this ShoppingCartItem in the list of its StockItem
 };
 
-StockItem *ll_create_stock_item(const char id[MAX_ID], const char title[MAX_TITLE], const unsigned int priceInCents)
+// === Sorted containers ===
+// A sorted container keeps nodes (StockItem or ShoppingCartItem) sorted by id.
+// The id of a node is given by the overloaded sorted_key and sorted_id, and
+// every storage policy below has the same functions (sorted_find, sorted_insert, sorted_erase, ...),
+// so a list picks its storage by a typedef:
+//   ListStorage   a linked list through a plain Node::next, O(n) search, O(1) insert and erase at a found position
+//   FlatStorage   sorted arrays of the keys and of the nodes, O(log n) binary search over the keys, O(n) insert and erase
+//   BTreeStorage  a B+ tree of sorted arrays, O(log n) search, insert and erase
+//   InlineStorage a FlatStorage whose first CART_INLINE_LINES entries are held in the container itself
+// A position is where a node is, or where a node with the searched id is to be inserted
+// The StockItem list stays a skip list, whose atomic links let readers walk it while a writer changes it
+template <typename Node>
+struct ListStorage
 {
-    StockItem *newStockItem = new StockItem;
-    strcpy(newStockItem->id, id);
-    strcpy(newStockItem->title, title);
-    newStockItem->priceInCents = priceInCents;
-    newStockItem->next = nullptr;
-    return newStockItem;
+    typedef Node **Position; // The link pointing to the node at the position
+    Node *head;              // The first node
+    unsigned int size;       // The number of nodes
+};
+
+template <typename Node>
+struct FlatStorage
+{
+    typedef unsigned int Position; // The index of the node at the position
+    unsigned long long *keys;      // keys[i] is the key of nodes[i], searched without visiting the nodes
+    Node **nodes;                  // The nodes, sorted by id
+    unsigned int size;             // The number of nodes
+    unsigned int capacity;         // The number of entries allocated in keys and nodes
+};
+
+// A block of a BTreeStorage, a leaf holds the nodes and an inner block holds the blocks below it
+// An inner block keeps the first node under each child, so it is searched like a leaf
+template <typename Node>
+struct BTreeBlock
+{
+    BTreeBlock *parent;                    // The inner block above, nullptr for the root
+    BTreeBlock *prevLeaf;                  // The previous leaf (leaves only)
+    BTreeBlock *nextLeaf;                  // The next leaf (leaves only)
+    unsigned int count;                    // The number of nodes (leaf) or children (inner block)
+    bool isLeaf;                           // Whether the block is a leaf
+    unsigned long long keys[BTREE_FANOUT]; // keys[i] is the key of nodes[i]
+    Node *nodes[BTREE_FANOUT];             // The nodes (leaf), or the first node under children[i] (inner block)
+    BTreeBlock *children[BTREE_FANOUT];    // The blocks below (inner block only)
+};
+
+// Erasing only removes blocks that become empty, sparse blocks are not merged
+template <typename Node>
+struct BTreeStorage
+{
+    struct Position
+    {
+        BTreeBlock<Node> *leaf; // The leaf of the position
+        unsigned int index;     // The index in the leaf
+    };
+    BTreeBlock<Node> *root;      // The root block, nullptr if the tree is empty
+    BTreeBlock<Node> *firstLeaf; // The leftmost leaf
+    unsigned int size;           // The number of nodes
+};
+
+// The arrays are in the container until they are full, then they spill to the heap and grow there.
+// While every key compares as a number, a few keys are searched by counting the keys before the searched one,
+// a compare without a branch per key instead of the mispredicted branches of a binary search
+template <typename Node>
+struct InlineStorage
+{
+    typedef unsigned int Position;                    // The index of the node at the position
+    unsigned long long *keys;                         // inlineKeys, or the heap array once the nodes spill
+    Node **nodes;                                     // inlineNodes, or the heap array once the nodes spill
+    unsigned int size;                                // The number of nodes
+    unsigned int capacity;                            // The number of entries of keys and nodes
+    unsigned int numOfStrcmpKeys;                     // The number of keys with ID_KEY_STRCMP set
+    unsigned long long inlineKeys[CART_INLINE_LINES]; // keys[i] is the key of nodes[i]
+    Node *inlineNodes[CART_INLINE_LINES];             // The nodes, sorted by id
+};
+
+// Most shopping carts hold fewer than CART_INLINE_LINES lines, so their keys are searched inside the
+// ShoppingCart without following a pointer (see bench_run_containers)
+typedef InlineStorage<ShoppingCartItem> CartLines;
+
+// A shopping cart in the ShoppingCartTable
+struct ShoppingCart
+{
+    CartLines lines;                // The ShoppingCartItems, sorted by item->id
+    unsigned long long totalAmount; // The total amount in cents, kept up to date by every change of the shopping cart
+    bool isOpen;                    // Whether the shopping cart ID is in use
+    unsigned int nextFreeId;        // The ID of the next closed shopping cart to reuse (if the shopping cart is closed)
+    mutex lock;                     // The lock held by a RetailEngine while it changes the shopping cart
+};
+
+// A growable table of shopping carts, indexed by the shopping cart ID
+// Shopping carts are allocated in chunks of CARTS_PER_CHUNK which never move,
+// so a ShoppingCart stays at the same address while it is open.
+// The IDs of closed shopping carts are reused by the shopping carts opened later
+struct ShoppingCartTable
+{
+    ShoppingCart **chunks;       // chunks[i] holds the shopping carts with ID i * CARTS_PER_CHUNK onwards
+    unsigned int capacity;       // The number of entries in chunks
+    unsigned int numOfCarts;     // The shopping cart IDs handed out so far are 0 to numOfCarts - 1
+    unsigned int firstFreeId;    // The ID of the first closed shopping cart to reuse, NO_SHOPPING_CART if none
+    unsigned int numOfOpenCarts; // The number of open shopping carts, never 0 as the last one cannot be closed
+};
+
+// A pool of list nodes (StockItem or ShoppingCartItem)
+// Nodes are handed out from contiguous slabs, and released nodes are kept on a free list linked by next,
+// so both allocating and releasing a node take O(1), and a whole list is released by a single splice
+template <typename Node>
+struct NodePool
+{
+    struct Slab
+    {
+        Slab *next;                 // The pointer pointing to the previously allocated slab
+        Node nodes[NODES_PER_SLAB]; // The nodes of the slab
+    };
+    Slab *slabs;       // The most recently allocated slab
+    int numUsedInSlab; // The number of nodes handed out from the most recently allocated slab
+    Node *freeList;    // The released nodes, linked by next
+    SpinLock lock;     // The lock of the pool, shopping carts on different threads share the pool
+};
+
+template <typename Node>
+Node *pool_allocate(NodePool<Node> &pool)
+{
+    Node *node;
+    spin_lock(pool.lock);
+    if (pool.freeList != nullptr)
+    {
+        node = pool.freeList;
+        pool.freeList = node->next;
+        spin_unlock(pool.lock);
+        return node;
+    }
+    if (pool.slabs == nullptr || pool.numUsedInSlab == NODES_PER_SLAB)
+    {
+        typename NodePool<Node>::Slab *slab = new typename NodePool<Node>::Slab;
+        slab->next = pool.slabs;
+        pool.slabs = slab;
+        pool.numUsedInSlab = 0;
+    }
+    node = &pool.slabs->nodes[pool.numUsedInSlab++];
+    spin_unlock(pool.lock);
+    return node;
 }
 
-ShoppingCartItem *ll_create_shopping_cart_item(const StockItem *stockItem, const unsigned int quantity)
+template <typename Node>
+void pool_release(NodePool<Node> &pool, Node *node)
 {
-    ShoppingCartItem *newShoppingCartItem = new ShoppingCartItem;
-    newShoppingCartItem->item = stockItem;
-    newShoppingCartItem->quantity = quantity;
-    newShoppingCartItem->next = nullptr;
-    return newShoppingCartItem;
+    spin_lock(pool.lock);
+    node->next = pool.freeList;
+    pool.freeList = node;
+    spin_unlock(pool.lock);
 }
 
-// Helper function: search stock item and return prev, current
-// return true if found an existing entry
-// return false if an existing entry is not found
-bool ll_search_stock_item(StockItem *head, const char id[MAX_ID], StockItem *&prev, StockItem *&current)
+// Release a whole list of nodes linked by next, from head to tail, in O(1)
+template <typename Node>
+void pool_release_list(NodePool<Node> &pool, Node *head, Node *tail)
 {
-    prev = nullptr;
-    int cmp;
-    for (current = head; current != nullptr; current = current->next)
+    if (head == nullptr)
+        return;
+    spin_lock(pool.lock);
+    tail->next = pool.freeList;
+    pool.freeList = head;
+    spin_unlock(pool.lock);
+}
+
+// Release every node of the pool at once, including the ones still linked in lists
+template <typename Node>
+void pool_release_all(NodePool<Node> &pool)
+{
+    while (pool.slabs != nullptr)
     {
-        cmp = strcmp(current->id, id);
-        if (cmp == 0)
+        typename NodePool<Node>::Slab *slab = pool.slabs;
+        pool.slabs = slab->next;
+        delete slab;
+    }
+    pool.numUsedInSlab = 0;
+    pool.freeList = nullptr;
+}
+
+// A pool of StockItem::skip arrays
+// Arrays are handed out from contiguous slabs, with one free list per array length.
+// A released array is linked to the next released array of the same length by its first element
+struct SkipArrayPool
+{
+    struct Slab
+    {
+        Slab *next;                      // The pointer pointing to the previously allocated slab
+        StockItemLink links[LINKS_PER_SLAB]; // The links of the slab
+    };
+    Slab *slabs;                              // The most recently allocated slab
+    int numUsedInSlab;                        // The number of links handed out from the most recently allocated slab
+    StockItemLink *freeLists[MAX_SKIP_LEVEL]; // freeLists[n] holds the released arrays of n links
+};
+
+// A pool of interned StockItem titles
+// Each distinct title is stored once in contiguous slabs of characters,
+// and an open addressing hash table maps a title to its stored copy and the number of StockItems sharing it.
+// A title no StockItem shares anymore is released to a free list of its number of units, and reused by the next title of that size
+struct TitlePool
+{
+    struct Slab
+    {
+        Slab *next;                 // The pointer pointing to the previously allocated slab
+        char chars[CHARS_PER_SLAB]; // The characters of the slab
+    };
+    Slab *slabs;                      // The most recently allocated slab
+    int numUsedInSlab;                // The number of characters handed out from the most recently allocated slab
+    const char **titles;              // The hash table of stored titles, nullptr for an empty slot
+    unsigned int *numOfSharers;       // numOfSharers[slot] is the number of StockItems sharing titles[slot]
+    unsigned int capacity;            // The number of slots in the hash table (a power of 2)
+    unsigned int numOfTitles;         // The number of stored titles
+    char *freeLists[MAX_TITLE_UNITS]; // freeLists[n] holds the released titles of n + 1 units, linked by their first characters
+};
+
+NodePool<StockItem> stockItemPool = {nullptr, 0, nullptr, {}};
+NodePool<ShoppingCartItem> shoppingCartItemPool = {nullptr, 0, nullptr, {}};
+SkipArrayPool skipArrayPool = {nullptr, 0, {}};
+TitlePool titlePool = {nullptr, 0, nullptr, nullptr, 0, 0, {}};
+
+// An index of the StockItem titles by trigram (3 characters in a row), for searching the titles by keyword
+// Letters are indexed regardless of case, digits as they are, and every other character as TITLE_OTHER.
+// A title is indexed as if it began with TITLE_START, so a keyword at the beginning of a title has trigrams of its own.
+// Every indexed StockItem gets a serial, and each bucket holds the serials of the StockItems having its trigram.
+// Deleting a StockItem only clears its serial, the buckets are compacted once most of the serials are cleared
+struct TitleIndex
+{
+    struct Bucket
+    {
+        unsigned int *serials; // The serials in increasing order
+        unsigned int size;     // The number of serials in the bucket
+        unsigned int capacity; // The number of serials the bucket can hold
+    };
+    Bucket *buckets;           // buckets[trigram], nullptr until the first StockItem is indexed
+    StockItem **stockItems;    // stockItems[serial] is the StockItem of the serial, nullptr if it is cleared
+    unsigned int capacity;     // The number of entries in stockItems
+    unsigned int numOfSerials; // The serials handed out so far are 1 to numOfSerials - 1 (0 is not a serial)
+    unsigned int numOfIndexed; // The number of serials not cleared
+};
+
+const int TITLE_START = 36;   // the symbol before the first character of a title
+const int TITLE_OTHER = 37;   // the symbol of a character that is neither a letter nor a digit
+const int TITLE_SYMBOLS = 38; // 26 letters, 10 digits, TITLE_START and TITLE_OTHER
+const int TITLE_TRIGRAMS = TITLE_SYMBOLS * TITLE_SYMBOLS * TITLE_SYMBOLS;
+
+TitleIndex titleIndex = {nullptr, nullptr, 0, 1, 0};
+
+// The snapshot file the lists were loaded from
+// The titles of the loaded StockItems point into the mapping, so it is kept until ll_cleanup
+struct SnapshotMapping
+{
+    const char *data; // The mapped file, nullptr if no snapshot is loaded
+    size_t size;      // The size of the mapped file
+};
+
+SnapshotMapping snapshotMapping = {nullptr, 0};
+
+StockItemLink *skip_pool_allocate(const int numLinks)
+{
+    StockItemLink *skip = skipArrayPool.freeLists[numLinks];
+    if (skip != nullptr)
+    {
+        skipArrayPool.freeLists[numLinks] = reinterpret_cast<StockItemLink *>(skip[0].load(memory_order_relaxed));
+        return skip;
+    }
+    if (skipArrayPool.slabs == nullptr || skipArrayPool.numUsedInSlab + numLinks > LINKS_PER_SLAB)
+    {
+        SkipArrayPool::Slab *slab = new SkipArrayPool::Slab;
+        slab->next = skipArrayPool.slabs;
+        skipArrayPool.slabs = slab;
+        skipArrayPool.numUsedInSlab = 0;
+    }
+    skip = &skipArrayPool.slabs->links[skipArrayPool.numUsedInSlab];
+    skipArrayPool.numUsedInSlab += numLinks;
+    return skip;
+}
+
+void skip_pool_release(StockItemLink *skip, const int numLinks)
+{
+    skip[0].store(reinterpret_cast<StockItem *>(skipArrayPool.freeLists[numLinks]), memory_order_relaxed);
+    skipArrayPool.freeLists[numLinks] = skip;
+}
+
+void skip_pool_release_all()
+{
+    while (skipArrayPool.slabs != nullptr)
+    {
+        SkipArrayPool::Slab *slab = skipArrayPool.slabs;
+        skipArrayPool.slabs = slab->next;
+        delete slab;
+    }
+    skipArrayPool.numUsedInSlab = 0;
+    for (int i = 0; i < MAX_SKIP_LEVEL; i++)
+        skipArrayPool.freeLists[i] = nullptr;
+}
+
+// FNV-1a hash of a title
+unsigned int title_hash(const char *title)
+{
+    unsigned int hash = 2166136261u;
+    for (; *title != '\0'; title++)
+        hash = (hash ^ static_cast<unsigned char>(*title)) * 16777619u;
+    return hash;
+}
+
+// Return the stored copy of the title, storing it first if it is a new title
+// Every call shares the title once more, until title_pool_release
+const char *title_pool_intern(const char title[MAX_TITLE])
+{
+    // keep the hash table at most half full
+    if (2 * (titlePool.numOfTitles + 1) > titlePool.capacity)
+    {
+        unsigned int capacity = (titlePool.capacity == 0) ? 1024 : 2 * titlePool.capacity;
+        const char **titles = new const char *[capacity];
+        unsigned int *numOfSharers = new unsigned int[capacity];
+        for (unsigned int i = 0; i < capacity; i++)
+            titles[i] = nullptr;
+        for (unsigned int i = 0; i < titlePool.capacity; i++)
         {
-            // found an existing entry
-            return true;
+            if (titlePool.titles[i] == nullptr)
+                continue;
+            unsigned int slot = title_hash(titlePool.titles[i]) & (capacity - 1);
+            while (titles[slot] != nullptr)
+                slot = (slot + 1) & (capacity - 1);
+            titles[slot] = titlePool.titles[i];
+            numOfSharers[slot] = titlePool.numOfSharers[i];
         }
-        else if (cmp > 0)
+        delete[] titlePool.titles;
+        delete[] titlePool.numOfSharers;
+        titlePool.titles = titles;
+        titlePool.numOfSharers = numOfSharers;
+        titlePool.capacity = capacity;
+    }
+
+    unsigned int slot = title_hash(title) & (titlePool.capacity - 1);
+    for (; titlePool.titles[slot] != nullptr; slot = (slot + 1) & (titlePool.capacity - 1))
+    {
+        if (strcmp(titlePool.titles[slot], title) == 0)
         {
-            // cannot find an existing entry
-            return false;
+            titlePool.numOfSharers[slot]++;
+            return titlePool.titles[slot]; // already stored
         }
-        prev = current;
     }
-    return false;
-}
 
-// Helper function: overloaded, return current only
-StockItem *ll_search_stock_item(StockItem *head, const char id[MAX_ID])
-{
-    StockItem *prev, *current;
-    prev = current = nullptr;
-    if (ll_search_stock_item(head, id, prev, current))
-        return current;
-    return nullptr;
+    int numOfUnits = (strlen(title) + CHARS_PER_TITLE_UNIT) / CHARS_PER_TITLE_UNIT;
+    char *stored = titlePool.freeLists[numOfUnits - 1];
+    if (stored != nullptr)
+    {
+        memcpy(&titlePool.freeLists[numOfUnits - 1], stored, sizeof(char *));
+    }
+    else
+    {
+        if (titlePool.slabs == nullptr || titlePool.numUsedInSlab + numOfUnits * CHARS_PER_TITLE_UNIT > CHARS_PER_SLAB)
+        {
+            TitlePool::Slab *slab = new TitlePool::Slab;
+            slab->next = titlePool.slabs;
+            titlePool.slabs = slab;
+            titlePool.numUsedInSlab = 0;
+        }
+        stored = &titlePool.slabs->chars[titlePool.numUsedInSlab];
+        titlePool.numUsedInSlab += numOfUnits * CHARS_PER_TITLE_UNIT;
+    }
+    strcpy(stored, title);
+    titlePool.titles[slot] = stored;
+    titlePool.numOfSharers[slot] = 1;
+    titlePool.numOfTitles++;
+    return stored;
 }
 
-// Helper function:  search shopping cart and return prev, current
-// return true if found an existing entry
-// return false if an existing entry is not found
-bool ll_search_shopping_cart_item(ShoppingCartItem *head, const char id[MAX_ID], ShoppingCartItem *&prev, ShoppingCartItem *&current)
+// Stop sharing a title returned by title_pool_intern, releasing it once no StockItem shares it
+// A title stored elsewhere (e.g., in a mapped snapshot) is left alone
+void title_pool_release(const char *title)
 {
-    prev = current = nullptr;
-    int cmp;
-    for (current = head; current != nullptr; current = current->next)
+    if (titlePool.capacity == 0)
+        return;
+    unsigned int mask = titlePool.capacity - 1;
+    unsigned int slot = title_hash(title) & mask;
+    for (; titlePool.titles[slot] != title; slot = (slot + 1) & mask)
     {
-        if (current->item != nullptr)
+        if (titlePool.titles[slot] == nullptr)
+            return; // not in the pool
+    }
+    if (--titlePool.numOfSharers[slot] > 0)
+        return;
+
+    char *released = const_cast<char *>(title);
+    int numOfUnits = (strlen(title) + CHARS_PER_TITLE_UNIT) / CHARS_PER_TITLE_UNIT;
+    memcpy(released, &titlePool.freeLists[numOfUnits - 1], sizeof(char *));
+    titlePool.freeLists[numOfUnits - 1] = released;
+
+    // shift the titles after the slot back, so every title stays reachable from its home slot without tombstones
+    unsigned int hole = slot;
+    for (unsigned int next = (hole + 1) & mask; titlePool.titles[next] != nullptr; next = (next + 1) & mask)
+    {
+        unsigned int home = title_hash(titlePool.titles[next]) & mask;
+        if (((next - home) & mask) >= ((next - hole) & mask))
         {
-            cmp = strcmp(current->item->id, id);
-            if (cmp == 0)
-            {
-                // found an existing entry
-                return true;
-            }
-            else if (cmp > 0)
-            {
-                return false;
-            }
-            prev = current;
+            titlePool.titles[hole] = titlePool.titles[next];
+            titlePool.numOfSharers[hole] = titlePool.numOfSharers[next];
+            hole = next;
         }
     }
-    return false;
+    titlePool.titles[hole] = nullptr;
+    titlePool.numOfTitles--;
 }
 
-// Helper function: overloaded, return current only
-ShoppingCartItem *ll_search_shopping_cart_item(ShoppingCartItem *head, const char id[MAX_ID])
+void title_pool_release_all()
 {
-    ShoppingCartItem *prev, *current;
-    prev = current = nullptr;
-    if (ll_search_shopping_cart_item(head, id, prev, current))
-        return current;
-    return nullptr;
+    while (titlePool.slabs != nullptr)
+    {
+        TitlePool::Slab *slab = titlePool.slabs;
+        titlePool.slabs = slab->next;
+        delete slab;
+    }
+    delete[] titlePool.titles;
+    delete[] titlePool.numOfSharers;
+    titlePool.slabs = nullptr;
+    titlePool.numUsedInSlab = 0;
+    titlePool.titles = nullptr;
+    titlePool.numOfSharers = nullptr;
+    titlePool.capacity = 0;
+    titlePool.numOfTitles = 0;
+    for (int i = 0; i < MAX_TITLE_UNITS; i++)
+        titlePool.freeLists[i] = nullptr;
 }
 
-// Given the number of shopping cart, dynamicially creates and initializes the shopping cart array
-ShoppingCartItem **dynamic_init_shopping_cart_array(const unsigned int numOfShoppingCart)
+// Helper function: the symbol of a character of a title in a trigram
+int title_symbol(const char c)
 {
-    ShoppingCartItem **ret = nullptr;
-    ret = new ShoppingCartItem *[numOfShoppingCart];
-    for (int i = 0; i < numOfShoppingCart; i++)
-        ret[i] = nullptr;
-    return ret;
+    if (c >= 'a' && c <= 'z')
+        return c - 'a';
+    if (c >= 'A' && c <= 'Z')
+        return c - 'A';
+    if (c >= '0' && c <= '9')
+        return 26 + (c - '0');
+    return TITLE_OTHER;
 }
 
-bool ll_insert_stock_item(StockItem *&stockItemHead, const char id[MAX_ID], const char title[MAX_TITLE], const unsigned int priceInCents)
+// Helper function: put the trigrams of a text in trigrams, in the order they appear
+// atStart puts TITLE_START before the text, at most maxTrigrams trigrams are put
+// return the number of trigrams
+int title_trigrams(const char *text, const bool atStart, unsigned int trigrams[], const int maxTrigrams)
 {
-
-    // empty list handling
-    if (stockItemHead == nullptr)
+    unsigned int trigram = atStart ? TITLE_START : 0;
+    int length = atStart ? 1 : 0;
+    int numOfTrigrams = 0;
+    for (; *text != '\0' && numOfTrigrams < maxTrigrams; text++)
     {
-        stockItemHead = ll_create_stock_item(id, title, priceInCents);
-        return true;
+        trigram = (trigram * TITLE_SYMBOLS + title_symbol(*text)) % TITLE_TRIGRAMS;
+        if (++length >= 3)
+            trigrams[numOfTrigrams++] = trigram;
     }
+    return numOfTrigrams;
+}
 
-    StockItem *prev, *current;
-    prev = current = nullptr;
-    bool foundGoods = ll_search_stock_item(stockItemHead, id, prev, current);
+// Helper function: whether the title contains the keyword, or begins with it if atStart, ignoring case
+bool title_matches(const char *title, const char *keyword, const bool atStart)
+{
+    for (;; title++)
+    {
+        int i = 0;
+        while (keyword[i] != '\0' && tolower(static_cast<unsigned char>(title[i])) == tolower(static_cast<unsigned char>(keyword[i])))
+            i++;
+        if (keyword[i] == '\0')
+            return true;
+        if (atStart || *title == '\0')
+            return false;
+    }
+}
 
-    if (foundGoods)
+// Helper function: drop the cleared serials from the buckets and number the indexed StockItems from 1 again
+// The order of the serials is kept, so the buckets stay sorted
+void title_index_compact()
+{
+    unsigned int *renumbered = new unsigned int[titleIndex.numOfSerials];
+    unsigned int numOfSerials = 1;
+    for (unsigned int serial = 1; serial < titleIndex.numOfSerials; serial++)
     {
-        // found an existing entry
-        return false; // cannot insert
+        StockItem *stockItem = titleIndex.stockItems[serial];
+        renumbered[serial] = 0;
+        if (stockItem == nullptr)
+            continue;
+        renumbered[serial] = numOfSerials;
+        stockItem->titleSerial = numOfSerials;
+        titleIndex.stockItems[numOfSerials++] = stockItem;
     }
+    for (int trigram = 0; trigram < TITLE_TRIGRAMS; trigram++)
+    {
+        TitleIndex::Bucket &bucket = titleIndex.buckets[trigram];
+        unsigned int size = 0;
+        for (unsigned int i = 0; i < bucket.size; i++)
+        {
+            if (renumbered[bucket.serials[i]] != 0)
+                bucket.serials[size++] = renumbered[bucket.serials[i]];
+        }
+        bucket.size = size;
+    }
+    titleIndex.numOfSerials = numOfSerials;
+    delete[] renumbered;
+}
 
-    // insert - normal case handling
-    StockItem *newStockItem = ll_create_stock_item(id, title, priceInCents);
-    if (prev == nullptr)
+// Index the title of a new StockItem
+void title_index_add(StockItem *stockItem)
+{
+    if (titleIndex.buckets == nullptr)
     {
-        // insert to the front
-        newStockItem->next = stockItemHead;
-        stockItemHead = newStockItem;
+        titleIndex.buckets = new TitleIndex::Bucket[TITLE_TRIGRAMS];
+        for (int trigram = 0; trigram < TITLE_TRIGRAMS; trigram++)
+            titleIndex.buckets[trigram] = {nullptr, 0, 0};
     }
-    else
+    if (titleIndex.numOfSerials >= titleIndex.capacity)
     {
-        prev->next = newStockItem;
-        newStockItem->next = current;
+        unsigned int capacity = (titleIndex.capacity == 0) ? 1024 : 2 * titleIndex.capacity;
+        StockItem **stockItems = new StockItem *[capacity];
+        for (unsigned int serial = 1; serial < titleIndex.numOfSerials; serial++)
+            stockItems[serial] = titleIndex.stockItems[serial];
+        delete[] titleIndex.stockItems;
+        titleIndex.stockItems = stockItems;
+        titleIndex.capacity = capacity;
+    }
+    unsigned int serial = titleIndex.numOfSerials++;
+    titleIndex.stockItems[serial] = stockItem;
+    titleIndex.numOfIndexed++;
+    stockItem->titleSerial = serial;
+
+    unsigned int trigrams[MAX_TITLE];
+    int numOfTrigrams = title_trigrams(stockItem->title, true, trigrams, MAX_TITLE);
+    for (int i = 0; i < numOfTrigrams; i++)
+    {
+        TitleIndex::Bucket &bucket = titleIndex.buckets[trigrams[i]];
+        if (bucket.size > 0 && bucket.serials[bucket.size - 1] == serial)
+            continue; // the trigram appears more than once in the title
+        if (bucket.size == bucket.capacity)
+        {
+            unsigned int capacity = (bucket.capacity == 0) ? 4 : 2 * bucket.capacity;
+            unsigned int *serials = new unsigned int[capacity];
+            copy(bucket.serials, bucket.serials + bucket.size, serials);
+            delete[] bucket.serials;
+            bucket.serials = serials;
+            bucket.capacity = capacity;
+        }
+        bucket.serials[bucket.size++] = serial;
     }
-    return true;
 }
 
-bool ll_update_stock_item_price(StockItem *stockItemHead, const char id[MAX_ID], const unsigned int newPriceInCents)
+// Take a StockItem out of the TitleIndex before it is deleted
+void title_index_remove(StockItem *stockItem)
 {
-    StockItem *prev, *current;
-    prev = current = nullptr;
-    bool foundGoods = ll_search_stock_item(stockItemHead, id, prev, current);
-    if (foundGoods)
+    titleIndex.stockItems[stockItem->titleSerial] = nullptr;
+    titleIndex.numOfIndexed--;
+    unsigned int numOfCleared = titleIndex.numOfSerials - 1 - titleIndex.numOfIndexed;
+    if (numOfCleared > titleIndex.numOfIndexed && numOfCleared >= 1024)
+        title_index_compact();
+}
+
+void title_index_release_all()
+{
+    if (titleIndex.buckets != nullptr)
     {
-        current->priceInCents = newPriceInCents; // updated
-        return true;
+        for (int trigram = 0; trigram < TITLE_TRIGRAMS; trigram++)
+            delete[] titleIndex.buckets[trigram].serials;
+    }
+    delete[] titleIndex.buckets;
+    delete[] titleIndex.stockItems;
+    titleIndex = {nullptr, nullptr, 0, 1, 0};
+}
+
+// === Inventory ===
+// The units on hand and the units reserved by the shopping carts of the stock items whose stock is tracked.
+// A StockItem is not tracked, and its stock is unlimited, until it is restocked for the first time.
+// Both counts of a StockItem are packed into one 64-bit atomic, the units on hand in the high half and
+// the reserved units in the low half, so a reservation checks and updates them with a single compare-and-swap,
+// without any lock, and the reserved units never exceed the units on hand however many tills share the StockItem.
+// The counts are kept in chunks of INVENTORY_PER_CHUNK which never move, and a StockItem holds the slot of its counts
+struct Inventory
+{
+    atomic<unsigned long long> **chunks; // The chunks of counts (MAX_INVENTORY_CHUNKS of them, allocated on the first restock)
+    unsigned int numOfSlots;             // The slots handed out so far, slot 0 is never used (not tracked)
+    unsigned int firstFreeSlot;          // The slot of a deleted StockItem to reuse (0 for none), linked through its counts
+    SpinLock lock;                       // The lock of handing out and giving back slots
+};
+
+Inventory inventory = {nullptr, 1, 0, {{false}}};
+
+// Helper function: the counts of a slot
+atomic<unsigned long long> &inventory_counts(const unsigned int slot)
+{
+    return inventory.chunks[slot / INVENTORY_PER_CHUNK][slot % INVENTORY_PER_CHUNK];
+}
+
+// Helper function: pack the units on hand and the reserved units into counts
+unsigned long long inventory_pack(const unsigned int onHand, const unsigned int reserved)
+{
+    return static_cast<unsigned long long>(onHand) << 32 | reserved;
+}
+
+// Return whether the stock of a StockItem is tracked, and its units on hand and reserved units if it is
+bool inventory_get(const StockItem *stockItem, unsigned int &onHand, unsigned int &reserved)
+{
+    unsigned int slot = stockItem->inventorySlot.load(memory_order_acquire);
+    if (slot == 0)
+        return false;
+    unsigned long long counts = inventory_counts(slot).load(memory_order_relaxed);
+    onHand = counts >> 32;
+    reserved = counts & 0xffffffffULL;
+    return true;
+}
+
+// Start tracking the stock of a StockItem with the given counts
+// The caller makes sure no shopping cart changes the StockItem meanwhile (see ll_restock_stock_item)
+// return false if every slot is in use
+bool inventory_track(StockItem *stockItem, const unsigned int onHand, const unsigned int reserved)
+{
+    spin_lock(inventory.lock);
+    unsigned int slot = inventory.firstFreeSlot;
+    if (slot != 0)
+    {
+        inventory.firstFreeSlot = inventory_counts(slot).load(memory_order_relaxed);
+    }
+    else
+    {
+        if (inventory.numOfSlots == static_cast<unsigned long long>(MAX_INVENTORY_CHUNKS) * INVENTORY_PER_CHUNK - 1)
+        {
+            spin_unlock(inventory.lock);
+            return false;
+        }
+        if (inventory.chunks == nullptr)
+            inventory.chunks = new atomic<unsigned long long> *[MAX_INVENTORY_CHUNKS]();
+        slot = inventory.numOfSlots++;
+        if (inventory.chunks[slot / INVENTORY_PER_CHUNK] == nullptr)
+            inventory.chunks[slot / INVENTORY_PER_CHUNK] = new atomic<unsigned long long>[INVENTORY_PER_CHUNK];
+    }
+    spin_unlock(inventory.lock);
+    inventory_counts(slot).store(inventory_pack(onHand, reserved), memory_order_relaxed);
+    stockItem->inventorySlot.store(slot, memory_order_release);
+    return true;
+}
+
+// Stop tracking the stock of a StockItem being deleted, and give its slot back for reuse
+void inventory_untrack(StockItem *stockItem)
+{
+    unsigned int slot = stockItem->inventorySlot.load(memory_order_relaxed);
+    if (slot == 0)
+        return;
+    stockItem->inventorySlot.store(0, memory_order_relaxed);
+    spin_lock(inventory.lock);
+    inventory_counts(slot).store(inventory.firstFreeSlot, memory_order_relaxed);
+    inventory.firstFreeSlot = slot;
+    spin_unlock(inventory.lock);
+}
+
+// Reserve units of a StockItem for a shopping cart
+// return false if fewer units are available (on hand and not reserved), nothing is reserved then
+bool inventory_reserve(const StockItem *stockItem, const unsigned int quantity)
+{
+    unsigned int slot = stockItem->inventorySlot.load(memory_order_acquire);
+    if (slot == 0)
+        return true; // the stock is unlimited
+    atomic<unsigned long long> &counts = inventory_counts(slot);
+    unsigned long long expected = counts.load(memory_order_relaxed);
+    do
+    {
+        unsigned int onHand = expected >> 32;
+        unsigned int reserved = expected & 0xffffffffULL;
+        if (onHand - reserved < quantity)
+            return false;
+    } while (!counts.compare_exchange_weak(expected, expected + quantity, memory_order_relaxed));
+    return true;
+}
+
+// Give reserved units of a StockItem back, the shopping cart no longer holds them
+void inventory_release(const StockItem *stockItem, const unsigned int quantity)
+{
+    unsigned int slot = stockItem->inventorySlot.load(memory_order_acquire);
+    if (slot != 0)
+        inventory_counts(slot).fetch_sub(quantity, memory_order_relaxed);
+}
+
+// Commit reserved units of a StockItem at checkout, they leave the units on hand and the reserved units at once
+void inventory_commit(const StockItem *stockItem, const unsigned int quantity)
+{
+    unsigned int slot = stockItem->inventorySlot.load(memory_order_acquire);
+    if (slot != 0)
+        inventory_counts(slot).fetch_sub(inventory_pack(quantity, quantity), memory_order_relaxed);
+}
+
+// Add units on hand to a tracked StockItem
+// return false if the units on hand would overflow, nothing is added then
+bool inventory_restock(const StockItem *stockItem, const unsigned int quantity)
+{
+    atomic<unsigned long long> &counts = inventory_counts(stockItem->inventorySlot.load(memory_order_acquire));
+    unsigned long long expected = counts.load(memory_order_relaxed);
+    do
+    {
+        unsigned int onHand;
+        if (__builtin_add_overflow(static_cast<unsigned int>(expected >> 32), quantity, &onHand))
+            return false;
+    } while (!counts.compare_exchange_weak(expected, expected + inventory_pack(quantity, 0), memory_order_relaxed));
+    return true;
+}
+
+// Every slot is given back at once, the StockItems are released with their slabs
+void inventory_release_all()
+{
+    if (inventory.chunks != nullptr)
+    {
+        for (int i = 0; i < MAX_INVENTORY_CHUNKS; i++)
+            delete[] inventory.chunks[i];
+    }
+    delete[] inventory.chunks;
+    inventory.chunks = nullptr;
+    inventory.numOfSlots = 1;
+    inventory.firstFreeSlot = 0;
+}
+
+void snapshot_release_mapping()
+{
+    if (snapshotMapping.data != nullptr)
+        munmap(const_cast<char *>(snapshotMapping.data), snapshotMapping.size);
+    snapshotMapping.data = nullptr;
+    snapshotMapping.size = 0;
+}
+
+// Encode an id into a 64-bit key
+// Each character takes 7 bits, the first character in the most significant bits,
+// so comparing the keys of two ASCII ids gives the same order as strcmp.
+// An id with a non-ASCII character or more than MAX_ID - 1 characters gets ID_KEY_STRCMP set
+unsigned long long encode_id_key(const char id[MAX_ID])
+{
+    unsigned long long key = 0;
+    int i;
+    for (i = 0; i < MAX_ID - 1 && id[i] != '\0'; i++)
+    {
+        unsigned char c = id[i];
+        if (c >= 0x80)
+        {
+            key |= ID_KEY_STRCMP;
+            c = 0x7f;
+        }
+        key |= static_cast<unsigned long long>(c) << (7 * (MAX_ID - 2 - i));
+    }
+    if (i == MAX_ID - 1 && id[i] != '\0')
+        key |= ID_KEY_STRCMP;
+    return key;
+}
+
+// Compare two ids by their keys, return a value with the same sign as strcmp(itemId, id)
+// The ids themselves are only read when one of the keys has ID_KEY_STRCMP set
+int compare_id_key(const unsigned long long itemKey, const char itemId[MAX_ID], const unsigned long long key, const char id[MAX_ID])
+{
+    if (((itemKey | key) & ID_KEY_STRCMP) != 0)
+        return strcmp(itemId, id);
+    return (itemKey > key) - (itemKey < key);
+}
+
+// === Sorted container functions ===
+// The key and id of each type of node kept in a sorted container
+unsigned long long sorted_key(const StockItem *stockItem)
+{
+    return stockItem->key;
+}
+
+const char *sorted_id(const StockItem *stockItem)
+{
+    return stockItem->id;
+}
+
+unsigned long long sorted_key(const ShoppingCartItem *shoppingCartItem)
+{
+    return shoppingCartItem->key;
+}
+
+const char *sorted_id(const ShoppingCartItem *shoppingCartItem)
+{
+    return shoppingCartItem->item->id;
+}
+
+// Helper function: binary search the sorted entries first to last - 1 for the first entry that is not before id
+// found is set if that entry is id, numOfCompared counts the entries compared
+template <typename Node>
+unsigned int sorted_lower_bound(const unsigned long long keys[], Node *const nodes[], unsigned int first, unsigned int last, const unsigned long long key, const char id[MAX_ID], bool &found, unsigned long long &numOfCompared)
+{
+    found = false;
+    while (first < last)
+    {
+        unsigned int middle = first + (last - first) / 2;
+        int cmp = compare_id_key(keys[middle], sorted_id(nodes[middle]), key, id);
+        numOfCompared++;
+        if (cmp == 0)
+        {
+            found = true;
+            return middle;
+        }
+        if (cmp < 0)
+            first = middle + 1;
+        else
+            last = middle;
+    }
+    return first;
+}
+
+// ListStorage
+template <typename Node>
+void sorted_init(ListStorage<Node> &storage)
+{
+    storage.head = nullptr;
+    storage.size = 0;
+}
+
+// Search from position onwards, position must not be after id
+// return true if id is found, position is where id is or is to be inserted
+template <typename Node>
+bool sorted_find_after(ListStorage<Node> &, const unsigned long long key, const char id[MAX_ID], typename ListStorage<Node>::Position &position, unsigned long long &numOfCompared)
+{
+    for (; *position != nullptr; position = &(*position)->next)
+    {
+        numOfCompared++;
+        int cmp = compare_id_key(sorted_key(*position), sorted_id(*position), key, id);
+        if (cmp >= 0)
+            return cmp == 0;
+    }
+    return false;
+}
+
+template <typename Node>
+bool sorted_find(ListStorage<Node> &storage, const unsigned long long key, const char id[MAX_ID], typename ListStorage<Node>::Position &position, unsigned long long &numOfCompared)
+{
+    position = &storage.head;
+    return sorted_find_after(storage, key, id, position, numOfCompared);
+}
+
+// Insert a node at a position found by sorted_find, the position is then where the node is
+template <typename Node>
+void sorted_insert(ListStorage<Node> &storage, typename ListStorage<Node>::Position &position, Node *node)
+{
+    node->next = *position;
+    *position = node;
+    storage.size++;
+}
+
+template <typename Node>
+void sorted_erase(ListStorage<Node> &storage, const typename ListStorage<Node>::Position position)
+{
+    *position = (*position)->next;
+    storage.size--;
+}
+
+template <typename Node>
+typename ListStorage<Node>::Position sorted_first(const ListStorage<Node> &storage)
+{
+    return const_cast<Node **>(&storage.head);
+}
+
+template <typename Node>
+bool sorted_is_end(const ListStorage<Node> &, const typename ListStorage<Node>::Position position)
+{
+    return *position == nullptr;
+}
+
+template <typename Node>
+typename ListStorage<Node>::Position sorted_next(const ListStorage<Node> &, const typename ListStorage<Node>::Position position)
+{
+    return &(*position)->next;
+}
+
+template <typename Node>
+Node *sorted_node(const ListStorage<Node> &, const typename ListStorage<Node>::Position position)
+{
+    return *position;
+}
+
+// Forget every node, the nodes themselves are released by the caller
+template <typename Node>
+void sorted_clear(ListStorage<Node> &storage)
+{
+    sorted_init(storage);
+}
+
+template <typename Node>
+void sorted_release(ListStorage<Node> &storage)
+{
+    sorted_init(storage);
+}
+
+// FlatStorage
+template <typename Node>
+void sorted_init(FlatStorage<Node> &storage)
+{
+    storage.keys = nullptr;
+    storage.nodes = nullptr;
+    storage.size = 0;
+    storage.capacity = 0;
+}
+
+template <typename Node>
+bool sorted_find_after(FlatStorage<Node> &storage, const unsigned long long key, const char id[MAX_ID], typename FlatStorage<Node>::Position &position, unsigned long long &numOfCompared)
+{
+    bool found;
+    position = sorted_lower_bound(storage.keys, storage.nodes, position, storage.size, key, id, found, numOfCompared);
+    return found;
+}
+
+template <typename Node>
+bool sorted_find(FlatStorage<Node> &storage, const unsigned long long key, const char id[MAX_ID], typename FlatStorage<Node>::Position &position, unsigned long long &numOfCompared)
+{
+    position = 0;
+    return sorted_find_after(storage, key, id, position, numOfCompared);
+}
+
+template <typename Node>
+void sorted_insert(FlatStorage<Node> &storage, typename FlatStorage<Node>::Position &position, Node *node)
+{
+    if (storage.size == storage.capacity)
+    {
+        unsigned int capacity = (storage.capacity == 0) ? FLAT_MIN_CAPACITY : 2 * storage.capacity;
+        unsigned long long *keys = new unsigned long long[capacity];
+        Node **nodes = new Node *[capacity];
+        for (unsigned int i = 0; i < storage.size; i++)
+        {
+            keys[i] = storage.keys[i];
+            nodes[i] = storage.nodes[i];
+        }
+        delete[] storage.keys;
+        delete[] storage.nodes;
+        storage.keys = keys;
+        storage.nodes = nodes;
+        storage.capacity = capacity;
+    }
+    memmove(storage.keys + position + 1, storage.keys + position, (storage.size - position) * sizeof(storage.keys[0]));
+    memmove(storage.nodes + position + 1, storage.nodes + position, (storage.size - position) * sizeof(storage.nodes[0]));
+    storage.keys[position] = sorted_key(node);
+    storage.nodes[position] = node;
+    storage.size++;
+}
+
+template <typename Node>
+void sorted_erase(FlatStorage<Node> &storage, const typename FlatStorage<Node>::Position position)
+{
+    storage.size--;
+    memmove(storage.keys + position, storage.keys + position + 1, (storage.size - position) * sizeof(storage.keys[0]));
+    memmove(storage.nodes + position, storage.nodes + position + 1, (storage.size - position) * sizeof(storage.nodes[0]));
+}
+
+template <typename Node>
+typename FlatStorage<Node>::Position sorted_first(const FlatStorage<Node> &)
+{
+    return 0;
+}
+
+template <typename Node>
+bool sorted_is_end(const FlatStorage<Node> &storage, const typename FlatStorage<Node>::Position position)
+{
+    return position >= storage.size;
+}
+
+template <typename Node>
+typename FlatStorage<Node>::Position sorted_next(const FlatStorage<Node> &, const typename FlatStorage<Node>::Position position)
+{
+    return position + 1;
+}
+
+template <typename Node>
+Node *sorted_node(const FlatStorage<Node> &storage, const typename FlatStorage<Node>::Position position)
+{
+    return storage.nodes[position];
+}
+
+// The arrays are kept, so a shopping cart refilled after a checkout does not allocate them again
+template <typename Node>
+void sorted_clear(FlatStorage<Node> &storage)
+{
+    storage.size = 0;
+}
+
+template <typename Node>
+void sorted_release(FlatStorage<Node> &storage)
+{
+    delete[] storage.keys;
+    delete[] storage.nodes;
+    sorted_init(storage);
+}
+
+// InlineStorage
+template <typename Node>
+void sorted_init(InlineStorage<Node> &storage)
+{
+    storage.keys = storage.inlineKeys;
+    storage.nodes = storage.inlineNodes;
+    storage.size = 0;
+    storage.capacity = CART_INLINE_LINES;
+    storage.numOfStrcmpKeys = 0;
+}
+
+// Helper function: the number of keys before key, counted without a branch per key
+// (the compare is vectorized on targets with 64-bit vector compares, e.g., -msse4.2)
+VECTORIZE unsigned int sorted_count_before(const unsigned long long keys[], const unsigned int numOfKeys, const unsigned long long key)
+{
+    unsigned int numOfBefore = 0;
+    for (unsigned int i = 0; i < numOfKeys; i++)
+        numOfBefore += (keys[i] < key);
+    return numOfBefore;
+}
+
+template <typename Node>
+bool sorted_find_after(InlineStorage<Node> &storage, const unsigned long long key, const char id[MAX_ID], typename InlineStorage<Node>::Position &position, unsigned long long &numOfCompared)
+{
+    unsigned int numOfKeys = storage.size - position;
+    if (numOfKeys <= MAX_COUNTED_KEYS && storage.numOfStrcmpKeys == 0 && (key & ID_KEY_STRCMP) == 0)
+    {
+        // the keys are in the same order as the ids, and equal keys are equal ids
+        position += sorted_count_before(storage.keys + position, numOfKeys, key);
+        numOfCompared += numOfKeys;
+        return position < storage.size && storage.keys[position] == key;
+    }
+    bool found;
+    position = sorted_lower_bound(storage.keys, storage.nodes, position, storage.size, key, id, found, numOfCompared);
+    return found;
+}
+
+template <typename Node>
+bool sorted_find(InlineStorage<Node> &storage, const unsigned long long key, const char id[MAX_ID], typename InlineStorage<Node>::Position &position, unsigned long long &numOfCompared)
+{
+    position = 0;
+    return sorted_find_after(storage, key, id, position, numOfCompared);
+}
+
+template <typename Node>
+void sorted_insert(InlineStorage<Node> &storage, typename InlineStorage<Node>::Position &position, Node *node)
+{
+    if (storage.size == storage.capacity)
+    {
+        // the nodes spill from the inline arrays, or the heap arrays grow
+        unsigned int capacity = 2 * storage.capacity;
+        unsigned long long *keys = new unsigned long long[capacity];
+        Node **nodes = new Node *[capacity];
+        for (unsigned int i = 0; i < storage.size; i++)
+        {
+            keys[i] = storage.keys[i];
+            nodes[i] = storage.nodes[i];
+        }
+        if (storage.keys != storage.inlineKeys)
+        {
+            delete[] storage.keys;
+            delete[] storage.nodes;
+        }
+        storage.keys = keys;
+        storage.nodes = nodes;
+        storage.capacity = capacity;
+    }
+    memmove(storage.keys + position + 1, storage.keys + position, (storage.size - position) * sizeof(storage.keys[0]));
+    memmove(storage.nodes + position + 1, storage.nodes + position, (storage.size - position) * sizeof(storage.nodes[0]));
+    storage.keys[position] = sorted_key(node);
+    storage.nodes[position] = node;
+    storage.size++;
+    if ((storage.keys[position] & ID_KEY_STRCMP) != 0)
+        storage.numOfStrcmpKeys++;
+}
+
+template <typename Node>
+void sorted_erase(InlineStorage<Node> &storage, const typename InlineStorage<Node>::Position position)
+{
+    if ((storage.keys[position] & ID_KEY_STRCMP) != 0)
+        storage.numOfStrcmpKeys--;
+    storage.size--;
+    memmove(storage.keys + position, storage.keys + position + 1, (storage.size - position) * sizeof(storage.keys[0]));
+    memmove(storage.nodes + position, storage.nodes + position + 1, (storage.size - position) * sizeof(storage.nodes[0]));
+}
+
+template <typename Node>
+typename InlineStorage<Node>::Position sorted_first(const InlineStorage<Node> &)
+{
+    return 0;
+}
+
+template <typename Node>
+bool sorted_is_end(const InlineStorage<Node> &storage, const typename InlineStorage<Node>::Position position)
+{
+    return position >= storage.size;
+}
+
+template <typename Node>
+typename InlineStorage<Node>::Position sorted_next(const InlineStorage<Node> &, const typename InlineStorage<Node>::Position position)
+{
+    return position + 1;
+}
+
+template <typename Node>
+Node *sorted_node(const InlineStorage<Node> &storage, const typename InlineStorage<Node>::Position position)
+{
+    return storage.nodes[position];
+}
+
+// A container that has spilled keeps its heap arrays, like a FlatStorage
+template <typename Node>
+void sorted_clear(InlineStorage<Node> &storage)
+{
+    storage.size = 0;
+    storage.numOfStrcmpKeys = 0;
+}
+
+template <typename Node>
+void sorted_release(InlineStorage<Node> &storage)
+{
+    if (storage.keys != storage.inlineKeys)
+    {
+        delete[] storage.keys;
+        delete[] storage.nodes;
+    }
+    sorted_init(storage);
+}
+
+// BTreeStorage
+template <typename Node>
+void sorted_init(BTreeStorage<Node> &storage)
+{
+    storage.root = nullptr;
+    storage.firstLeaf = nullptr;
+    storage.size = 0;
+}
+
+// Helper function: create an empty block
+template <typename Node>
+BTreeBlock<Node> *btree_create_block(const bool isLeaf)
+{
+    BTreeBlock<Node> *block = new BTreeBlock<Node>;
+    block->parent = nullptr;
+    block->prevLeaf = nullptr;
+    block->nextLeaf = nullptr;
+    block->count = 0;
+    block->isLeaf = isLeaf;
+    return block;
+}
+
+// Helper function: the index of a block in its parent
+template <typename Node>
+unsigned int btree_child_index(const BTreeBlock<Node> *block)
+{
+    unsigned int i = 0;
+    while (block->parent->children[i] != block)
+        i++;
+    return i;
+}
+
+// Helper function: the first node of a block has changed, update the first nodes kept by the blocks above
+template <typename Node>
+void btree_update_first(BTreeBlock<Node> *block)
+{
+    while (block->parent != nullptr)
+    {
+        unsigned int i = btree_child_index(block);
+        block->parent->keys[i] = block->keys[0];
+        block->parent->nodes[i] = block->nodes[0];
+        if (i != 0)
+            return;
+        block = block->parent;
+    }
+}
+
+// Helper function: split a full block, the upper half moves to a new block after it
+// return the new block
+template <typename Node>
+BTreeBlock<Node> *btree_split(BTreeStorage<Node> &storage, BTreeBlock<Node> *block)
+{
+    const unsigned int half = BTREE_FANOUT / 2;
+    BTreeBlock<Node> *right = btree_create_block<Node>(block->isLeaf);
+    for (unsigned int i = half; i < BTREE_FANOUT; i++)
+    {
+        right->keys[i - half] = block->keys[i];
+        right->nodes[i - half] = block->nodes[i];
+        if (!block->isLeaf)
+        {
+            right->children[i - half] = block->children[i];
+            block->children[i]->parent = right;
+        }
+    }
+    right->count = BTREE_FANOUT - half;
+    block->count = half;
+    if (block->isLeaf)
+    {
+        right->prevLeaf = block;
+        right->nextLeaf = block->nextLeaf;
+        if (block->nextLeaf != nullptr)
+            block->nextLeaf->prevLeaf = right;
+        block->nextLeaf = right;
+    }
+
+    BTreeBlock<Node> *parent = block->parent;
+    if (parent == nullptr)
+    {
+        // the root is split, a new root holds both halves
+        parent = btree_create_block<Node>(false);
+        parent->keys[0] = block->keys[0];
+        parent->nodes[0] = block->nodes[0];
+        parent->children[0] = block;
+        parent->count = 1;
+        block->parent = parent;
+        storage.root = parent;
+    }
+    else if (parent->count == BTREE_FANOUT)
+    {
+        btree_split(storage, parent);
+        parent = block->parent; // block may have moved to the upper half of its parent
+    }
+    unsigned int i = btree_child_index(block) + 1;
+    for (unsigned int j = parent->count; j > i; j--)
+    {
+        parent->keys[j] = parent->keys[j - 1];
+        parent->nodes[j] = parent->nodes[j - 1];
+        parent->children[j] = parent->children[j - 1];
+    }
+    parent->keys[i] = right->keys[0];
+    parent->nodes[i] = right->nodes[0];
+    parent->children[i] = right;
+    parent->count++;
+    right->parent = parent;
+    return right;
+}
+
+// Helper function: remove an empty block, and the blocks above it that become empty
+template <typename Node>
+void btree_remove_block(BTreeStorage<Node> &storage, BTreeBlock<Node> *block)
+{
+    while (true)
+    {
+        if (block->isLeaf)
+        {
+            if (block->prevLeaf != nullptr)
+                block->prevLeaf->nextLeaf = block->nextLeaf;
+            else
+                storage.firstLeaf = block->nextLeaf;
+            if (block->nextLeaf != nullptr)
+                block->nextLeaf->prevLeaf = block->prevLeaf;
+        }
+        BTreeBlock<Node> *parent = block->parent;
+        if (parent == nullptr)
+        {
+            // the tree is empty
+            delete block;
+            storage.root = nullptr;
+            storage.firstLeaf = nullptr;
+            return;
+        }
+        unsigned int i = btree_child_index(block);
+        delete block;
+        parent->count--;
+        for (unsigned int j = i; j < parent->count; j++)
+        {
+            parent->keys[j] = parent->keys[j + 1];
+            parent->nodes[j] = parent->nodes[j + 1];
+            parent->children[j] = parent->children[j + 1];
+        }
+        if (parent->count > 0)
+        {
+            if (i == 0)
+                btree_update_first(parent);
+            break;
+        }
+        block = parent;
+    }
+
+    // an inner root with a single child is replaced by the child
+    while (!storage.root->isLeaf && storage.root->count == 1)
+    {
+        BTreeBlock<Node> *root = storage.root;
+        storage.root = root->children[0];
+        storage.root->parent = nullptr;
+        delete root;
+    }
+}
+
+// The position found from the root, the search does not go on from position
+template <typename Node>
+bool sorted_find(BTreeStorage<Node> &storage, const unsigned long long key, const char id[MAX_ID], typename BTreeStorage<Node>::Position &position, unsigned long long &numOfCompared)
+{
+    BTreeBlock<Node> *block = storage.root;
+    bool found = false;
+    position.leaf = nullptr;
+    position.index = 0;
+    if (block == nullptr)
+        return false;
+    while (!block->isLeaf)
+    {
+        // the last child whose first node is not after id, or the first child
+        unsigned int i = sorted_lower_bound(block->keys, block->nodes, 0, block->count, key, id, found, numOfCompared);
+        if (!found && i > 0)
+            i--;
+        block = block->children[i];
+    }
+    position.leaf = block;
+    position.index = sorted_lower_bound(block->keys, block->nodes, 0, block->count, key, id, found, numOfCompared);
+    return found;
+}
+
+template <typename Node>
+bool sorted_find_after(BTreeStorage<Node> &storage, const unsigned long long key, const char id[MAX_ID], typename BTreeStorage<Node>::Position &position, unsigned long long &numOfCompared)
+{
+    return sorted_find(storage, key, id, position, numOfCompared);
+}
+
+template <typename Node>
+void sorted_insert(BTreeStorage<Node> &storage, typename BTreeStorage<Node>::Position &position, Node *node)
+{
+    if (storage.root == nullptr)
+    {
+        storage.root = btree_create_block<Node>(true);
+        storage.firstLeaf = storage.root;
+        position.leaf = storage.root;
+        position.index = 0;
+    }
+    BTreeBlock<Node> *leaf = position.leaf;
+    if (leaf->count == BTREE_FANOUT)
+    {
+        BTreeBlock<Node> *right = btree_split(storage, leaf);
+        if (position.index > leaf->count)
+        {
+            position.index -= leaf->count;
+            position.leaf = leaf = right;
+        }
+    }
+    for (unsigned int j = leaf->count; j > position.index; j--)
+    {
+        leaf->keys[j] = leaf->keys[j - 1];
+        leaf->nodes[j] = leaf->nodes[j - 1];
+    }
+    leaf->keys[position.index] = sorted_key(node);
+    leaf->nodes[position.index] = node;
+    leaf->count++;
+    storage.size++;
+    if (position.index == 0)
+        btree_update_first(leaf);
+}
+
+template <typename Node>
+void sorted_erase(BTreeStorage<Node> &storage, const typename BTreeStorage<Node>::Position position)
+{
+    BTreeBlock<Node> *leaf = position.leaf;
+    leaf->count--;
+    storage.size--;
+    for (unsigned int j = position.index; j < leaf->count; j++)
+    {
+        leaf->keys[j] = leaf->keys[j + 1];
+        leaf->nodes[j] = leaf->nodes[j + 1];
+    }
+    if (leaf->count == 0)
+        btree_remove_block(storage, leaf);
+    else if (position.index == 0)
+        btree_update_first(leaf);
+}
+
+template <typename Node>
+typename BTreeStorage<Node>::Position sorted_first(const BTreeStorage<Node> &storage)
+{
+    typename BTreeStorage<Node>::Position position = {storage.firstLeaf, 0};
+    return position;
+}
+
+template <typename Node>
+bool sorted_is_end(const BTreeStorage<Node> &, const typename BTreeStorage<Node>::Position position)
+{
+    return position.leaf == nullptr || position.index >= position.leaf->count;
+}
+
+template <typename Node>
+typename BTreeStorage<Node>::Position sorted_next(const BTreeStorage<Node> &, typename BTreeStorage<Node>::Position position)
+{
+    position.index++;
+    if (position.index == position.leaf->count && position.leaf->nextLeaf != nullptr)
+    {
+        position.leaf = position.leaf->nextLeaf;
+        position.index = 0;
+    }
+    return position;
+}
+
+template <typename Node>
+Node *sorted_node(const BTreeStorage<Node> &, const typename BTreeStorage<Node>::Position position)
+{
+    return position.leaf->nodes[position.index];
+}
+
+// Helper function: delete a block and the blocks below it
+template <typename Node>
+void btree_release_block(BTreeBlock<Node> *block)
+{
+    if (!block->isLeaf)
+        for (unsigned int i = 0; i < block->count; i++)
+            btree_release_block(block->children[i]);
+    delete block;
+}
+
+template <typename Node>
+void sorted_clear(BTreeStorage<Node> &storage)
+{
+    if (storage.root != nullptr)
+        btree_release_block(storage.root);
+    sorted_init(storage);
+}
+
+template <typename Node>
+void sorted_release(BTreeStorage<Node> &storage)
+{
+    sorted_clear(storage);
+}
+
+// Helper function: create a StockItem whose title is already stored (in the TitlePool or a snapshot)
+StockItem *ll_create_stock_item_with_stored_title(const char id[MAX_ID], const char *title, const unsigned int priceInCents)
+{
+    StockItem *newStockItem = pool_allocate(stockItemPool);
+    strcpy(newStockItem->id, id);
+    newStockItem->key = encode_id_key(id);
+    newStockItem->title = title;
+    newStockItem->priceInCents = priceInCents;
+    newStockItem->next = nullptr;
+    newStockItem->level = 1;
+    newStockItem->skip = nullptr;
+    newStockItem->cartItems = nullptr;
+    newStockItem->cartItemsLock.locked.store(false);
+    newStockItem->inventorySlot.store(0, memory_order_relaxed);
+    title_index_add(newStockItem);
+    return newStockItem;
+}
+
+StockItem *ll_create_stock_item(const char id[MAX_ID], const char title[MAX_TITLE], const unsigned int priceInCents)
+{
+    return ll_create_stock_item_with_stored_title(id, title_pool_intern(title), priceInCents);
+}
+
+void ll_delete_stock_item(StockItem *stockItem)
+{
+    title_index_remove(stockItem);
+    title_pool_release(stockItem->title);
+    inventory_untrack(stockItem);
+    if (stockItem->skip != nullptr)
+        skip_pool_release(stockItem->skip, stockItem->level - 1);
+    pool_release(stockItemPool, stockItem);
+}
+
+// Helper function: return the next StockItem on the given skip list level
+StockItemLink &ll_next_stock_item(StockItem *stockItem, const int level)
+{
+    if (level == 0)
+        return stockItem->next;
+    return stockItem->skip[level - 1];
+}
+
+// Helper function: change the number of levels a StockItem can be linked into
+// The links of the levels kept are preserved, the new levels are set to nullptr
+void ll_resize_stock_item_levels(StockItem *stockItem, const int level)
+{
+    StockItemLink *skip = nullptr;
+    if (level > 1)
+    {
+        skip = skip_pool_allocate(level - 1);
+        for (int i = 1; i < level; i++)
+            skip[i - 1] = (i < stockItem->level) ? stockItem->skip[i - 1].load() : nullptr;
+    }
+    if (stockItem->skip != nullptr)
+        skip_pool_release(stockItem->skip, stockItem->level - 1);
+    stockItem->skip = skip;
+    stockItem->level = level;
+}
+
+// Helper function: pick a random level for a new StockItem
+// Each level is kept with probability 1/4, the head level MAX_SKIP_LEVEL is never picked
+int ll_random_stock_item_level()
+{
+    static unsigned int seed = 2463534242u; // xorshift32 state
+    seed ^= seed << 13;
+    seed ^= seed >> 17;
+    seed ^= seed << 5;
+    unsigned int bits = seed;
+    int level = 1;
+    while (level < MAX_SKIP_LEVEL - 1 && (bits & 3) == 0)
+    {
+        level++;
+        bits >>= 2;
+    }
+    return level;
+}
+
+ShoppingCartItem *ll_create_shopping_cart_item(const StockItem *stockItem, const unsigned int quantity)
+{
+    ShoppingCartItem *newShoppingCartItem = pool_allocate(shoppingCartItemPool);
+    newShoppingCartItem->item = stockItem;
+    newShoppingCartItem->key = stockItem->key;
+    newShoppingCartItem->quantity = quantity;
+    newShoppingCartItem->priceInCents = stockItem->priceInCents;
+    newShoppingCartItem->next = nullptr;
+    newShoppingCartItem->cart = nullptr;
+    newShoppingCartItem->nextInStockItem = nullptr;
+    newShoppingCartItem->pprevInStockItem = nullptr;
+    return newShoppingCartItem;
+}
+
+// Helper function: record that a shopping cart holds a StockItem
+void ll_link_shopping_cart_item(StockItem *stockItem, ShoppingCart *shoppingCart, ShoppingCartItem *shoppingCartItem)
+{
+    shoppingCartItem->cart = shoppingCart;
+    spin_lock(stockItem->cartItemsLock);
+    shoppingCartItem->nextInStockItem = stockItem->cartItems;
+    shoppingCartItem->pprevInStockItem = &stockItem->cartItems;
+    if (stockItem->cartItems != nullptr)
+        stockItem->cartItems->pprevInStockItem = &shoppingCartItem->nextInStockItem;
+    stockItem->cartItems = shoppingCartItem;
+    spin_unlock(stockItem->cartItemsLock);
+}
+
+// Helper function: remove a ShoppingCartItem from the list of its StockItem, before releasing it
+void ll_unlink_shopping_cart_item(ShoppingCartItem *shoppingCartItem)
+{
+    // the neighbours in the list change the links of a ShoppingCartItem, so they are only read under the lock
+    SpinLock &lock = shoppingCartItem->item->cartItemsLock;
+    spin_lock(lock);
+    if (shoppingCartItem->pprevInStockItem != nullptr)
+    {
+        *shoppingCartItem->pprevInStockItem = shoppingCartItem->nextInStockItem;
+        if (shoppingCartItem->nextInStockItem != nullptr)
+            shoppingCartItem->nextInStockItem->pprevInStockItem = shoppingCartItem->pprevInStockItem;
+        shoppingCartItem->nextInStockItem = nullptr;
+        shoppingCartItem->pprevInStockItem = nullptr;
+    }
+    spin_unlock(lock);
+}
+
+// Helper function: find the last StockItem before id on every level of the list
+// The head must be before id, so predecessors[level] is never nullptr for level < head->level
+void ll_search_stock_item_predecessors(StockItem *head, const unsigned long long key, const char id[MAX_ID], StockItem *predecessors[MAX_SKIP_LEVEL])
+{
+    StockItem *prev = head;
+    StockItem *current;
+    unsigned long long numOfWalked = 1;
+    for (int level = head->level - 1; level >= 0; level--)
+    {
+        for (current = ll_next_stock_item(prev, level).load(memory_order_acquire); current != nullptr;
+             current = ll_next_stock_item(prev, level).load(memory_order_acquire))
+        {
+            numOfWalked++;
+            if (compare_id_key(current->key, current->id, key, id) >= 0)
+                break;
+            prev = current;
+        }
+        predecessors[level] = prev;
+    }
+    stats_record(STATS_STOCK_ITEM_WALK, numOfWalked);
+}
+
+// Helper function: move the predecessors found for an id on to a later id
+// The levels are climbed only while the next StockItem on the level above is still before id,
+// so searching ids in increasing order costs O(log d) for each distance d walked, instead of O(log n) per id
+void ll_advance_stock_item_predecessors(StockItem *head, const unsigned long long key, const char id[MAX_ID], StockItem *predecessors[MAX_SKIP_LEVEL])
+{
+    int top = 0;
+    while (top + 1 < head->level)
+    {
+        StockItem *next = ll_next_stock_item(predecessors[top + 1], top + 1).load(memory_order_acquire);
+        if (next == nullptr || compare_id_key(next->key, next->id, key, id) >= 0)
+            break;
+        top++;
+    }
+    StockItem *prev = predecessors[top];
+    StockItem *current;
+    unsigned long long numOfWalked = top + 1;
+    for (int level = top; level >= 0; level--)
+    {
+        for (current = ll_next_stock_item(prev, level).load(memory_order_acquire); current != nullptr;
+             current = ll_next_stock_item(prev, level).load(memory_order_acquire))
+        {
+            numOfWalked++;
+            if (compare_id_key(current->key, current->id, key, id) >= 0)
+                break;
+            prev = current;
+        }
+        predecessors[level] = prev;
+    }
+    stats_record(STATS_STOCK_ITEM_WALK, numOfWalked);
+}
+
+// Helper function: search stock item and return prev, current, and the predecessors of id on every level
+// The predecessors are only filled in if prev is not nullptr, for linking or unlinking id without searching again
+// return true if found an existing entry
+// return false if an existing entry is not found
+bool ll_search_stock_item(StockItem *head, const char id[MAX_ID], StockItem *predecessors[MAX_SKIP_LEVEL], StockItem *&prev, StockItem *&current)
+{
+    prev = nullptr;
+    current = head;
+    if (head == nullptr)
+        return false;
+
+    unsigned long long key = encode_id_key(id);
+    int cmp = compare_id_key(head->key, head->id, key, id);
+    if (cmp >= 0)
+    {
+        // the head is the existing entry, or id is before the head
+        stats_record(STATS_STOCK_ITEM_WALK, 1);
+        return cmp == 0;
+    }
+
+    ll_search_stock_item_predecessors(head, key, id, predecessors);
+    prev = predecessors[0];
+    current = prev->next.load(memory_order_acquire);
+    return current != nullptr && compare_id_key(current->key, current->id, key, id) == 0;
+}
+
+// Helper function: overloaded, return prev, current only
+bool ll_search_stock_item(StockItem *head, const char id[MAX_ID], StockItem *&prev, StockItem *&current)
+{
+    StockItem *predecessors[MAX_SKIP_LEVEL];
+    return ll_search_stock_item(head, id, predecessors, prev, current);
+}
+
+// Helper function: overloaded, return current only
+StockItem *ll_search_stock_item(StockItem *head, const char id[MAX_ID])
+{
+    StockItem *prev, *current;
+    prev = current = nullptr;
+    if (ll_search_stock_item(head, id, prev, current))
+        return current;
+    return nullptr;
+}
+
+// Helper function: search shopping cart and return the position of id in its CartLines
+// return true if found an existing entry
+// return false if an existing entry is not found, the position is then where id is to be inserted
+bool ll_search_shopping_cart_item(ShoppingCart &shoppingCart, const char id[MAX_ID], CartLines::Position &position)
+{
+    unsigned long long numOfCompared = 0;
+    bool found = sorted_find(shoppingCart.lines, encode_id_key(id), id, position, numOfCompared);
+    stats_record(STATS_SHOPPING_CART_WALK, numOfCompared);
+    return found;
+}
+
+// Helper function: overloaded, return the ShoppingCartItem only
+ShoppingCartItem *ll_search_shopping_cart_item(ShoppingCart &shoppingCart, const char id[MAX_ID])
+{
+    CartLines::Position position;
+    if (ll_search_shopping_cart_item(shoppingCart, id, position))
+        return sorted_node(shoppingCart.lines, position);
+    return nullptr;
+}
+
+// Return the shopping cart with the given ID, which must be below numOfCarts
+ShoppingCart *shopping_cart_table_get(const ShoppingCartTable &shoppingCartTable, const unsigned int whichCart)
+{
+    return &shoppingCartTable.chunks[whichCart / CARTS_PER_CHUNK][whichCart % CARTS_PER_CHUNK];
+}
+
+bool shopping_cart_table_is_open(const ShoppingCartTable &shoppingCartTable, const unsigned int whichCart)
+{
+    return whichCart < shoppingCartTable.numOfCarts && shopping_cart_table_get(shoppingCartTable, whichCart)->isOpen;
+}
+
+// Open an empty shopping cart and return its ID
+// The ID of a closed shopping cart is reused if there is one
+unsigned int shopping_cart_table_open(ShoppingCartTable &shoppingCartTable)
+{
+    unsigned int whichCart = shoppingCartTable.firstFreeId;
+    if (whichCart != NO_SHOPPING_CART)
+    {
+        shoppingCartTable.firstFreeId = shopping_cart_table_get(shoppingCartTable, whichCart)->nextFreeId;
+    }
+    else
+    {
+        whichCart = shoppingCartTable.numOfCarts;
+        if (whichCart % CARTS_PER_CHUNK == 0)
+        {
+            // the last chunk is full
+            unsigned int chunk = whichCart / CARTS_PER_CHUNK;
+            if (chunk == shoppingCartTable.capacity)
+            {
+                unsigned int capacity = (shoppingCartTable.capacity == 0) ? 1 : 2 * shoppingCartTable.capacity;
+                ShoppingCart **chunks = new ShoppingCart *[capacity];
+                for (unsigned int i = 0; i < shoppingCartTable.capacity; i++)
+                    chunks[i] = shoppingCartTable.chunks[i];
+                delete[] shoppingCartTable.chunks;
+                shoppingCartTable.chunks = chunks;
+                shoppingCartTable.capacity = capacity;
+            }
+            shoppingCartTable.chunks[chunk] = new ShoppingCart[CARTS_PER_CHUNK];
+            for (int i = 0; i < CARTS_PER_CHUNK; i++)
+                sorted_init(shoppingCartTable.chunks[chunk][i].lines);
+        }
+        shoppingCartTable.numOfCarts++;
+    }
+
+    ShoppingCart *shoppingCart = shopping_cart_table_get(shoppingCartTable, whichCart);
+    shoppingCart->totalAmount = 0;
+    shoppingCart->isOpen = true;
+    shoppingCart->nextFreeId = NO_SHOPPING_CART;
+    shoppingCartTable.numOfOpenCarts++;
+    return whichCart;
+}
+
+// Given the number of shopping cart, dynamicially creates and initializes the shopping cart table
+ShoppingCartTable *dynamic_init_shopping_cart_table(const unsigned int numOfShoppingCart)
+{
+    ShoppingCartTable *ret = new ShoppingCartTable;
+    ret->chunks = nullptr;
+    ret->capacity = 0;
+    ret->numOfCarts = 0;
+    ret->firstFreeId = NO_SHOPPING_CART;
+    ret->numOfOpenCarts = 0;
+    for (unsigned int i = 0; i < numOfShoppingCart; i++)
+        shopping_cart_table_open(*ret);
+    return ret;
+}
+
+bool ll_insert_stock_item(StockItem *&stockItemHead, const char id[MAX_ID], const char title[MAX_TITLE], const unsigned int priceInCents)
+{
+    StatsTimer timer(STATS_INSERT_STOCK_ITEM);
+
+    // empty list handling
+    if (stockItemHead == nullptr)
+    {
+        stockItemHead = ll_create_stock_item(id, title, priceInCents);
+        ll_resize_stock_item_levels(stockItemHead, MAX_SKIP_LEVEL); // the head is linked into all levels
+        return true;
+    }
+
+    StockItem *prev, *current;
+    StockItem *predecessors[MAX_SKIP_LEVEL];
+    prev = current = nullptr;
+    bool foundGoods = ll_search_stock_item(stockItemHead, id, predecessors, prev, current);
+
+    if (foundGoods)
+    {
+        // found an existing entry
+        return false; // cannot insert
+    }
+
+    // a list not built by ll_insert_stock_item has no index, keep it that way
+    bool indexed = (stockItemHead->level == MAX_SKIP_LEVEL);
+    int level = indexed ? ll_random_stock_item_level() : 1;
+
+    // insert - normal case handling
+    StockItem *newStockItem = ll_create_stock_item(id, title, priceInCents);
+    if (prev == nullptr)
+    {
+        // insert to the front
+        // the new head takes over the levels above the level of the old head
+        if (indexed)
+        {
+            ll_resize_stock_item_levels(newStockItem, MAX_SKIP_LEVEL);
+            for (int i = 1; i < MAX_SKIP_LEVEL; i++)
+                newStockItem->skip[i - 1] = (i < level) ? stockItemHead : stockItemHead->skip[i - 1].load();
+            ll_resize_stock_item_levels(stockItemHead, level);
+        }
+        newStockItem->next = stockItemHead;
+        stockItemHead = newStockItem;
+    }
+    else
+    {
+        ll_resize_stock_item_levels(newStockItem, level);
+        // linked bottom up, a reader reaching the new StockItem on a level can go on below it
+        for (int i = 0; i < level; i++)
+        {
+            ll_next_stock_item(newStockItem, i).store(ll_next_stock_item(predecessors[i], i).load(memory_order_relaxed), memory_order_relaxed);
+            ll_next_stock_item(predecessors[i], i).store(newStockItem, memory_order_release);
+        }
+    }
+    return true;
+}
+
+// Helper function: add quantity items at priceInCents each to a total amount, in newTotalAmount
+// The amount of a line always fits in 64 bits, only the sum can overflow
+// return false if the new total amount does not fit in 64 bits
+bool add_amount(const unsigned long long totalAmount, const unsigned int quantity, const unsigned int priceInCents, unsigned long long &newTotalAmount)
+{
+    return !__builtin_add_overflow(totalAmount, static_cast<unsigned long long>(quantity) * priceInCents, &newTotalAmount);
+}
+
+// Helper function: change the price of a StockItem
+// return false, and change nothing, if the total amount of a shopping cart holding it would overflow
+bool ll_set_stock_item_price(StockItem *stockItem, const unsigned int newPriceInCents)
+{
+    unsigned int oldPriceInCents = stockItem->priceInCents;
+    unsigned long long newTotalAmount;
+    if (newPriceInCents > oldPriceInCents)
+    {
+        for (ShoppingCartItem *c = stockItem->cartItems; c != nullptr; c = c->nextInStockItem)
+        {
+            if (!add_amount(c->cart->totalAmount, c->quantity, newPriceInCents - oldPriceInCents, newTotalAmount))
+                return false;
+        }
+    }
+
+    // the totals of the shopping carts holding the goods follow the new price
+    for (ShoppingCartItem *c = stockItem->cartItems; c != nullptr; c = c->nextInStockItem)
+    {
+        c->cart->totalAmount = c->cart->totalAmount - static_cast<unsigned long long>(c->quantity) * oldPriceInCents +
+                               static_cast<unsigned long long>(c->quantity) * newPriceInCents;
+        c->priceInCents = newPriceInCents;
+    }
+    stockItem->priceInCents = newPriceInCents; // updated
+    return true;
+}
+
+bool ll_update_stock_item_price(StockItem *stockItemHead, const char id[MAX_ID], const unsigned int newPriceInCents)
+{
+    StatsTimer timer(STATS_UPDATE_STOCK_ITEM_PRICE);
+    StockItem *prev, *current;
+    prev = current = nullptr;
+    bool foundGoods = ll_search_stock_item(stockItemHead, id, prev, current);
+    if (foundGoods)
+    {
+        return ll_set_stock_item_price(current, newPriceInCents);
+    }
+    return false;
+}
+
+// A new price of a StockItem in a bulk price update
+struct PriceUpdate
+{
+    unsigned long long key;    // id encoded by encode_id_key
+    char id[MAX_ID];           // The id of the StockItem
+    unsigned int priceInCents; // The new price in cents
+    StockItem *stockItem;      // The StockItem found by ll_find_price_updates, nullptr if there is none
+};
+
+// Helper function: the order of the price updates in the list
+bool price_update_before(const PriceUpdate &update, const PriceUpdate &other)
+{
+    return compare_id_key(update.key, update.id, other.key, other.id) < 0;
+}
+
+// Find the StockItem of every price update
+// The updates are sorted by id first (unless they already are, keeping the order of the updates of the same id),
+// then the list and the updates are walked together once, instead of searching the list once per update
+// return the number of updates whose StockItem is found
+unsigned int ll_find_price_updates(StockItem *stockItemHead, PriceUpdate *updates, const unsigned int numOfUpdates)
+{
+    if (!is_sorted(updates, updates + numOfUpdates, price_update_before))
+        stable_sort(updates, updates + numOfUpdates, price_update_before);
+
+    unsigned int numOfFound = 0;
+    StockItem *current = stockItemHead;
+    for (unsigned int i = 0; i < numOfUpdates; i++)
+    {
+        int cmp = 1;
+        while (current != nullptr && (cmp = compare_id_key(current->key, current->id, updates[i].key, updates[i].id)) < 0)
+            current = current->next;
+        updates[i].stockItem = (current != nullptr && cmp == 0) ? current : nullptr;
+        if (updates[i].stockItem != nullptr)
+            numOfFound++;
+    }
+    return numOfFound;
+}
+
+// Apply the price updates found by ll_find_price_updates, the ones without a StockItem are skipped
+// The stockItem of an update that would overflow the total amount of a shopping cart is set to nullptr
+// return the number of updates applied
+unsigned int ll_apply_price_updates(PriceUpdate *updates, const unsigned int numOfUpdates)
+{
+    unsigned int numOfApplied = 0;
+    for (unsigned int i = 0; i < numOfUpdates; i++)
+    {
+        if (updates[i].stockItem == nullptr)
+            continue;
+        if (ll_set_stock_item_price(updates[i].stockItem, updates[i].priceInCents))
+            numOfApplied++;
+        else
+            updates[i].stockItem = nullptr;
+    }
+    return numOfApplied;
+}
+
+bool ll_insert_or_add_stock_item_quantity(ShoppingCart &shoppingCart, StockItem *stockItemHead, const char id[MAX_ID], const unsigned int quantity)
+{
+    StatsTimer timer(STATS_INSERT_OR_ADD_STOCK_ITEM);
+
+    StockItem *currentGoods = ll_search_stock_item(stockItemHead, id);
+    if (currentGoods == nullptr)
+    {
+        // cannot find the goods based on the id
+        return false; // cannot insert
+    }
+
+    // currentGoods is not nullptr
+    // nothing is changed if the total amount would overflow or the units are not available
+    unsigned long long newTotalAmount;
+    if (!add_amount(shoppingCart.totalAmount, quantity, currentGoods->priceInCents, newTotalAmount))
+        return false;
+    if (!inventory_reserve(currentGoods, quantity))
+        return false;
+
+    CartLines::Position position;
+    bool foundShoppingCartItem = ll_search_shopping_cart_item(shoppingCart, id, position);
+
+    if (foundShoppingCartItem)
+    {
+        // found an existing entry
+        // Action: update the quantity, unless it would overflow
+        ShoppingCartItem *current = sorted_node(shoppingCart.lines, position);
+        unsigned int newQuantity;
+        if (__builtin_add_overflow(current->quantity, quantity, &newQuantity))
+        {
+            inventory_release(currentGoods, quantity);
+            return false;
+        }
+        current->quantity = newQuantity;
+        shoppingCart.totalAmount = newTotalAmount;
+        return true;
+    }
+    shoppingCart.totalAmount = newTotalAmount;
+
+    // insert - normal case handling
+    ShoppingCartItem *newItem = ll_create_shopping_cart_item(currentGoods, quantity);
+    ll_link_shopping_cart_item(currentGoods, &shoppingCart, newItem);
+    sorted_insert(shoppingCart.lines, position, newItem);
+    return true;
+}
+
+// A stock item scanned into a basket, added to a shopping cart with the rest of the basket
+struct BasketItem
+{
+    unsigned long long key; // id encoded by encode_id_key
+    char id[MAX_ID];        // The id of the StockItem
+    unsigned int quantity;  // The number of items scanned
+    StockItem *stockItem;   // The StockItem found by ll_add_basket_to_shopping_cart, nullptr if there is none
+};
+
+// Helper function: the order of the basket items in the shopping cart
+bool basket_item_before(const BasketItem &item, const BasketItem &other)
+{
+    return compare_id_key(item.key, item.id, other.key, other.id) < 0;
+}
+
+// Add a whole basket to a shopping cart, as if every basket item was added by ll_insert_or_add_stock_item_quantity
+// The basket is sorted by id first (unless it already is), then the StockItems are found in a single sweep
+// of the skip list, each search going on from where the previous one stopped, and the basket is merged
+// into the shopping cart in a single pass, instead of searching the list and the shopping cart once per item
+// A basket item that would overflow the quantity or the total amount, or whose units are not available,
+// is not added, like a missing id
+// return the number of basket items added, the stockItem of the others is nullptr
+unsigned int ll_add_basket_to_shopping_cart(ShoppingCart &shoppingCart, StockItem *stockItemHead, BasketItem *basket, const unsigned int numOfItems)
+{
+    StatsTimer timer(STATS_ADD_BASKET);
+    if (!is_sorted(basket, basket + numOfItems, basket_item_before))
+        stable_sort(basket, basket + numOfItems, basket_item_before);
+
+    StockItem *predecessors[MAX_SKIP_LEVEL];
+    bool searched = false;
+    for (unsigned int i = 0; i < numOfItems; i++)
+    {
+        basket[i].stockItem = nullptr;
+        if (stockItemHead == nullptr)
+            continue;
+        int cmp = compare_id_key(stockItemHead->key, stockItemHead->id, basket[i].key, basket[i].id);
+        if (cmp >= 0)
+        {
+            // the head is the StockItem, or id is before the head
+            if (cmp == 0)
+                basket[i].stockItem = stockItemHead;
+            continue;
+        }
+        if (searched)
+            ll_advance_stock_item_predecessors(stockItemHead, basket[i].key, basket[i].id, predecessors);
+        else
+            ll_search_stock_item_predecessors(stockItemHead, basket[i].key, basket[i].id, predecessors);
+        searched = true;
+        StockItem *current = predecessors[0]->next.load(memory_order_acquire);
+        if (current != nullptr && compare_id_key(current->key, current->id, basket[i].key, basket[i].id) == 0)
+            basket[i].stockItem = current;
+    }
+
+    // merge the basket into the shopping cart, each search going on from the position of the previous basket item
+    unsigned int numOfFound = 0;
+    unsigned long long numOfCompared = 0;
+    CartLines::Position position = sorted_first(shoppingCart.lines);
+    for (unsigned int i = 0; i < numOfItems; i++)
+    {
+        StockItem *stockItem = basket[i].stockItem;
+        if (stockItem == nullptr)
+            continue;
+        unsigned long long newTotalAmount;
+        if (!add_amount(shoppingCart.totalAmount, basket[i].quantity, stockItem->priceInCents, newTotalAmount))
+        {
+            basket[i].stockItem = nullptr; // the total amount would overflow
+            continue;
+        }
+        if (!inventory_reserve(stockItem, basket[i].quantity))
+        {
+            basket[i].stockItem = nullptr; // the units are not available
+            continue;
+        }
+
+        if (sorted_find_after(shoppingCart.lines, stockItem->key, stockItem->id, position, numOfCompared))
+        {
+            ShoppingCartItem *current = sorted_node(shoppingCart.lines, position);
+            unsigned int newQuantity;
+            if (__builtin_add_overflow(current->quantity, basket[i].quantity, &newQuantity))
+            {
+                inventory_release(stockItem, basket[i].quantity);
+                basket[i].stockItem = nullptr; // the quantity would overflow
+                continue;
+            }
+            current->quantity = newQuantity;
+            shoppingCart.totalAmount = newTotalAmount;
+            numOfFound++;
+            continue;
+        }
+        shoppingCart.totalAmount = newTotalAmount;
+        numOfFound++;
+
+        // the position is then the new ShoppingCartItem, so a later basket item of the same id is added to it
+        ShoppingCartItem *newItem = ll_create_shopping_cart_item(stockItem, basket[i].quantity);
+        ll_link_shopping_cart_item(stockItem, &shoppingCart, newItem);
+        sorted_insert(shoppingCart.lines, position, newItem);
+    }
+    return numOfFound;
+}
+
+bool ll_deduct_stock_item_quantity_from_shopping_cart(ShoppingCart &shoppingCart, const char id[MAX_ID], const unsigned int deductQuantity)
+{
+    StatsTimer timer(STATS_DEDUCT_STOCK_ITEM);
+
+    CartLines::Position position;
+    bool foundShoppingCartItem = ll_search_shopping_cart_item(shoppingCart, id, position);
+
+    if (foundShoppingCartItem)
+    {
+        // found an existing entry
+        // Action: update the quantity
+        ShoppingCartItem *current = sorted_node(shoppingCart.lines, position);
+        if (deductQuantity > current->quantity)
+        {
+            return false; // quantity cannot be negative in the shopping cart
+        }
+        unsigned int newQuatity = current->quantity - deductQuantity;
+        shoppingCart.totalAmount -= static_cast<unsigned long long>(deductQuantity) * current->priceInCents;
+        inventory_release(current->item, deductQuantity);
+        if (newQuatity == 0)
+        {
+            // need to delete the shopping cart item
+            sorted_erase(shoppingCart.lines, position);
+            ll_unlink_shopping_cart_item(current);
+            pool_release(shoppingCartItemPool, current);
+            return true;
+        }
+
+        // quantity is positive
+        current->quantity = newQuatity;
+        return true;
+    }
+
+    return false;
+}
+
+bool ll_remove_stock_item_from_shopping_cart(ShoppingCart &shoppingCart, const char id[MAX_ID])
+{
+    StatsTimer timer(STATS_REMOVE_STOCK_ITEM_FROM_CART);
+
+    CartLines::Position position;
+    bool foundShoppingCartItem = ll_search_shopping_cart_item(shoppingCart, id, position);
+
+    if (foundShoppingCartItem)
+    {
+        // found an existing entry
+        ShoppingCartItem *current = sorted_node(shoppingCart.lines, position);
+        shoppingCart.totalAmount -= static_cast<unsigned long long>(current->quantity) * current->priceInCents;
+        inventory_release(current->item, current->quantity);
+        sorted_erase(shoppingCart.lines, position);
+        ll_unlink_shopping_cart_item(current);
+        pool_release(shoppingCartItemPool, current);
+        return true;
+    }
+
+    return false;
+}
+
+// A range of the stock item list for a listing
+// An empty firstId, lastId or prefix does not limit the range
+struct StockItemRange
+{
+    char firstId[MAX_ID]; // The first id of the range
+    char lastId[MAX_ID];  // The last id of the range (included)
+    char prefix[MAX_ID];  // The beginning of every id of the range
+};
+
+// List a page of the StockItems of a range, in id order
+// The page starts at resumeId ("" for the start of the range) and holds at most pageSize StockItems.
+// nextId is set to the id the next page starts at, or "" after the last page.
+// The start is found with the skip list, so a page takes O(log n + pageSize) however far into the list it is
+// return the number of StockItems in the page
+unsigned int ll_list_stock_items(StockItem *stockItemHead, const StockItemRange &range, const char resumeId[MAX_ID], const unsigned int pageSize, const StockItem *page[], char nextId[MAX_ID])
+{
+    StatsTimer timer(STATS_LIST_STOCK_ITEMS);
+    // start at the greatest of the first id, the prefix and resumeId, the ids before it are not in the page
+    const char *startId = range.firstId;
+    if (strcmp(range.prefix, startId) > 0)
+        startId = range.prefix;
+    if (strcmp(resumeId, startId) > 0)
+        startId = resumeId;
+    StockItem *prev, *current;
+    prev = current = nullptr;
+    ll_search_stock_item(stockItemHead, startId, prev, current);
+
+    unsigned long long lastKey = encode_id_key(range.lastId);
+    int prefixLength = strlen(range.prefix);
+    unsigned int numOfItems = 0;
+    nextId[0] = '\0';
+    for (; current != nullptr; current = current->next)
+    {
+        if (range.lastId[0] != '\0' && compare_id_key(current->key, current->id, lastKey, range.lastId) > 0)
+            break;
+        if (strncmp(current->id, range.prefix, prefixLength) != 0)
+            break; // the ids with the prefix are next to each other
+        if (numOfItems == pageSize)
+        {
+            strcpy(nextId, current->id);
+            break;
+        }
+        page[numOfItems++] = current;
+    }
+    return numOfItems;
+}
+
+// Helper function: order the buckets of a TitleIndex by size
+bool title_index_bucket_smaller(const TitleIndex::Bucket *a, const TitleIndex::Bucket *b)
+{
+    return a->size < b->size;
+}
+
+// Search the StockItems whose title contains the keyword, or begins with it if atStart, ignoring case
+// The buckets of the trigrams of the keyword are intersected, smallest first, and only the StockItems
+// left are checked against the keyword. A keyword too short to have a trigram is searched by walking the list instead
+// return the number of matches put in matches (at most maxMatches), in the order the StockItems were created
+unsigned int ll_search_stock_item_titles(StockItem *stockItemHead, const char keyword[MAX_TITLE], const bool atStart, const StockItem *matches[], const unsigned int maxMatches)
+{
+    StatsTimer timer(STATS_SEARCH_STOCK_ITEM_TITLES);
+    unsigned int numOfMatches = 0;
+    unsigned int trigrams[MAX_TITLE];
+    int numOfTrigrams = title_trigrams(keyword, atStart, trigrams, MAX_TITLE);
+    if (numOfTrigrams == 0)
+    {
+        for (StockItem *current = stockItemHead; current != nullptr && numOfMatches < maxMatches; current = current->next)
+        {
+            if (title_matches(current->title, keyword, atStart))
+                matches[numOfMatches++] = current;
+        }
+        return numOfMatches;
+    }
+    if (titleIndex.buckets == nullptr)
+        return 0;
+
+    // the buckets sorted by size, each with the position reached in it
+    const TitleIndex::Bucket *buckets[MAX_TITLE];
+    const unsigned int *positions[MAX_TITLE];
+    const unsigned int *ends[MAX_TITLE];
+    for (int i = 0; i < numOfTrigrams; i++)
+        buckets[i] = &titleIndex.buckets[trigrams[i]];
+    sort(buckets, buckets + numOfTrigrams, title_index_bucket_smaller);
+    for (int i = 0; i < numOfTrigrams; i++)
+    {
+        positions[i] = buckets[i]->serials;
+        ends[i] = buckets[i]->serials + buckets[i]->size;
+    }
+
+    for (const unsigned int *serial = positions[0]; serial != ends[0] && numOfMatches < maxMatches; serial++)
+    {
+        int i;
+        for (i = 1; i < numOfTrigrams; i++)
+        {
+            positions[i] = lower_bound(positions[i], ends[i], *serial);
+            if (positions[i] == ends[i] || *positions[i] != *serial)
+                break;
+        }
+        if (i < numOfTrigrams)
+            continue; // a trigram of the keyword is not in the title
+        const StockItem *stockItem = titleIndex.stockItems[*serial];
+        if (stockItem != nullptr && title_matches(stockItem->title, keyword, atStart))
+            matches[numOfMatches++] = stockItem;
+    }
+    return numOfMatches;
+}
+
+// Helper function: take a StockItem out of the shopping carts and the list, without releasing it
+// return the StockItem, or nullptr if it is not found
+// The links of the StockItem are kept, so a reader standing on it can still go on to the rest of the list
+StockItem *ll_unlink_stock_item(StockItem *&stockItemHead, const char id[MAX_ID])
+{
+
+    // empty list handling
+    if (stockItemHead == nullptr)
+    {
+        return nullptr; // no need to remove anything from an empty list
+    }
+
+    StockItem *prev, *current;
+    StockItem *predecessors[MAX_SKIP_LEVEL];
+    prev = current = nullptr;
+    bool foundGoods = ll_search_stock_item(stockItemHead, id, predecessors, prev, current);
+
+    if (foundGoods == false)
+    {
+        return nullptr; // cannot remove a goods if it is not found
+    }
+
+    // We need to remove the corresponding shopping cart item on each shopping cart holding the goods
+    // Only these shopping carts are visited, through the list of ShoppingCartItem of the goods
+    while (current->cartItems != nullptr)
+        ll_remove_stock_item_from_shopping_cart(*current->cartItems->cart, id);
+
+    // Now, it is safe to remove the goods
+
+    if (prev == nullptr)
+    {
+        // delete and update the head
+        // the new head takes over the levels above its own level
+        stockItemHead = current->next;
+        if (stockItemHead != nullptr && current->level == MAX_SKIP_LEVEL)
+        {
+            int level = stockItemHead->level;
+            ll_resize_stock_item_levels(stockItemHead, MAX_SKIP_LEVEL);
+            for (int i = level; i < MAX_SKIP_LEVEL; i++)
+                stockItemHead->skip[i - 1] = current->skip[i - 1].load();
+        }
+    }
+    else
+    {
+        // unlinked top down, the StockItem leaves the list on level 0 last
+        for (int i = current->level - 1; i >= 0; i--)
+            ll_next_stock_item(predecessors[i], i).store(ll_next_stock_item(current, i).load(memory_order_relaxed), memory_order_release);
+    }
+    return current;
+}
+
+bool ll_remove_stock_item(StockItem *&stockItemHead, const char id[MAX_ID])
+{
+    StatsTimer timer(STATS_REMOVE_STOCK_ITEM);
+    StockItem *stockItem = ll_unlink_stock_item(stockItemHead, id);
+    if (stockItem == nullptr)
+        return false;
+    ll_delete_stock_item(stockItem);
+    return true;
+}
+
+// Add units on hand to a StockItem
+// The first restock starts tracking the stock of the StockItem: the units already in the shopping carts
+// are taken to be on hand and are reserved, and quantity more units are on hand.
+// Only the first restock walks the shopping carts holding the StockItem, so it must not run while a
+// shopping cart changes the StockItem (see engine_restock_stock_item), the later ones are a single atomic update
+// return false if the StockItem is not found or the units on hand would overflow, nothing is changed then
+bool ll_restock_stock_item(StockItem *stockItemHead, const char id[MAX_ID], const unsigned int quantity)
+{
+    StatsTimer timer(STATS_RESTOCK_STOCK_ITEM);
+    StockItem *stockItem = ll_search_stock_item(stockItemHead, id);
+    if (stockItem == nullptr)
+        return false;
+    if (stockItem->inventorySlot.load(memory_order_acquire) != 0)
+        return inventory_restock(stockItem, quantity);
+
+    unsigned long long reserved = 0;
+    for (const ShoppingCartItem *c = stockItem->cartItems; c != nullptr; c = c->nextInStockItem)
+        reserved += c->quantity;
+    unsigned long long onHand = reserved + quantity;
+    if (onHand > 0xffffffffULL)
+        return false;
+    return inventory_track(stockItem, onHand, reserved);
+}
+
+// Total the lines of a contiguous shopping cart, quantities[i] items at pricesInCents[i] each
+// The low and high 32 bits of the amounts are summed apart, which cannot overflow for fewer than 2^32 lines,
+// so the loop has no overflow check (and no branch) and is vectorized; the total is checked once at the end
+// return false if the total amount does not fit in 64 bits
+VECTORIZE bool calculate_total_amount(const unsigned int quantities[], const unsigned int pricesInCents[], const unsigned int numOfLines, unsigned long long &totalAmount)
+{
+    unsigned long long low = 0;
+    unsigned long long high = 0;
+    for (unsigned int i = 0; i < numOfLines; i++)
+    {
+        unsigned long long amount = static_cast<unsigned long long>(quantities[i]) * pricesInCents[i];
+        low += amount & 0xffffffffULL;
+        high += amount >> 32;
+    }
+    // the total is high * 2^32 + low
+    if ((high >> 32) != 0)
+        return false;
+    return !__builtin_add_overflow(high << 32, low, &totalAmount);
+}
+
+// The total is kept up to date by every change of the shopping cart, so no walk is needed
+unsigned long long calculate_total_amount_in_shopping_cart(const ShoppingCart &shoppingCart)
+{
+    return shoppingCart.totalAmount;
+}
+
+// Helper function: empty a shopping cart, the reserved units are committed if they are sold and released otherwise
+// The whole shopping cart is given back to the pool at once
+void ll_empty_shopping_cart(ShoppingCart &shoppingCart, const bool sold)
+{
+    StatsTimer timer(STATS_CLEAR_SHOPPING_CART);
+    // the ShoppingCartItems are linked by next as they are visited, and released as one list
+    // the first one visited is the tail of the list
+    ShoppingCartItem *released = nullptr;
+    ShoppingCartItem *releasedTail = nullptr;
+    CartLines &lines = shoppingCart.lines;
+    for (CartLines::Position l = sorted_first(lines); !sorted_is_end(lines, l); l = sorted_next(lines, l))
+    {
+        ShoppingCartItem *c = sorted_node(lines, l);
+        if (sold)
+            inventory_commit(c->item, c->quantity);
+        else
+            inventory_release(c->item, c->quantity);
+        ll_unlink_shopping_cart_item(c);
+        c->next = released;
+        released = c;
+        if (releasedTail == nullptr)
+            releasedTail = c;
+    }
+    pool_release_list(shoppingCartItemPool, released, releasedTail);
+    sorted_clear(lines);
+    shoppingCart.totalAmount = 0;
+}
+
+// The shopping cart is abandoned, its reserved units are released
+void ll_clear_shopping_cart(ShoppingCart &shoppingCart)
+{
+    ll_empty_shopping_cart(shoppingCart, false);
+}
+
+// Clear a shopping cart and give its ID back for reuse
+// The last open shopping cart cannot be closed, so there is always a shopping cart to enter
+bool shopping_cart_table_close(ShoppingCartTable &shoppingCartTable, const unsigned int whichCart)
+{
+    if (!shopping_cart_table_is_open(shoppingCartTable, whichCart) || shoppingCartTable.numOfOpenCarts == 1)
+        return false;
+    ShoppingCart *shoppingCart = shopping_cart_table_get(shoppingCartTable, whichCart);
+    ll_clear_shopping_cart(*shoppingCart);
+    shoppingCart->isOpen = false;
+    shoppingCart->nextFreeId = shoppingCartTable.firstFreeId;
+    shoppingCartTable.firstFreeId = whichCart;
+    shoppingCartTable.numOfOpenCarts--;
+    return true;
+}
+
+// Every StockItem and ShoppingCartItem is released with its slab,
+// without removing the items one by one
+void ll_cleanup(StockItem *&stockItemHead, ShoppingCartTable *&shoppingCartTable)
+{
+    for (unsigned int i = 0; i < shoppingCartTable->numOfCarts; i++)
+        sorted_release(shopping_cart_table_get(*shoppingCartTable, i)->lines);
+    pool_release_all(shoppingCartItemPool);
+
+    stockItemHead = nullptr;
+    pool_release_all(stockItemPool);
+    skip_pool_release_all();
+    title_pool_release_all();
+    title_index_release_all();
+    inventory_release_all();
+    snapshot_release_mapping();
+
+    // delete the dynamically allocated shopping cart table
+    for (unsigned int i = 0; i * CARTS_PER_CHUNK < shoppingCartTable->numOfCarts; i++)
+        delete[] shoppingCartTable->chunks[i];
+    delete[] shoppingCartTable->chunks;
+    delete shoppingCartTable;
+    shoppingCartTable = nullptr;
+}
+
+// === Sale records ===
+// Every checkout appends a line to the sale records for each line of the shopping cart.
+// The records are columns of 32-bit values in chunks of SALES_PER_CHUNK lines which never move,
+// and a line is visible to the reports once numOfLines is published past it,
+// so a report reads the lines checked out before it started while the checkouts go on, without any lock.
+// The sale records are kept in memory, with a log they are recovered from the checkouts logged since the last checkpoint.
+// The stock items are numbered in the order of their first sale (their SKU number), so a column holds
+// a number instead of an id and the totals of a report are arrays indexed by the SKU number
+struct SaleChunk
+{
+    unsigned int skus[SALES_PER_CHUNK];          // The SKU number of the stock item of each line
+    unsigned int quantities[SALES_PER_CHUNK];    // The quantity of each line
+    unsigned int pricesInCents[SALES_PER_CHUNK]; // The price of the stock item at checkout
+    unsigned int checkouts[SALES_PER_CHUNK];     // The number of the checkout of each line, from 0
+};
+
+// The ids of the SKU numbers, in the same chunks as the lines
+struct SaleSkuChunk
+{
+    char ids[SALES_PER_CHUNK][MAX_ID];
+};
+
+// A slot of the table of the SKU numbers
+struct SaleSkuSlot
+{
+    unsigned long long key; // The key of the id of the stock item
+    unsigned int sku;       // The SKU number + 1 (0 for an empty slot)
+};
+
+struct SaleLog
+{
+    SaleChunk **chunks;          // The chunks of lines (MAX_SALE_CHUNKS of them, allocated on the first checkout)
+    SaleSkuChunk **skuChunks;    // The chunks of SKU ids (MAX_SALE_CHUNKS of them)
+    atomic<unsigned int> numOfLines; // The lines visible to the reports
+    atomic<unsigned int> numOfSkus;  // The SKU numbers visible to the reports, published before the lines using them
+    unsigned int numOfCheckouts; // The checkouts appended so far
+    atomic<unsigned int> dayStart; // The first line of the current day (see sales_start_day)
+    SaleSkuSlot *hashSlots;       // The open addressing table of the SKU numbers, searched by the key of an id
+    unsigned int hashCapacity;    // The number of slots, a power of 2
+    SpinLock lock;                // The lock of the checkouts appending lines
+};
+
+SaleLog saleLog = {nullptr, nullptr, {0}, {0}, 0, {0}, nullptr, 0, {{false}}};
+
+// Helper function: the slot of a key in a table of capacity slots (a power of 2)
+unsigned int sales_hash_slot(const unsigned long long key, const unsigned int capacity)
+{
+    return (key * 0x9E3779B97F4A7C15ULL) >> 32 & (capacity - 1);
+}
+
+// Helper function: double the slots of the SKU numbers
+void sales_grow_hash()
+{
+    unsigned int capacity = (saleLog.hashCapacity == 0) ? 1024 : 2 * saleLog.hashCapacity;
+    SaleSkuSlot *slots = new SaleSkuSlot[capacity]();
+    for (unsigned int i = 0; i < saleLog.hashCapacity; i++)
+    {
+        if (saleLog.hashSlots[i].sku == 0)
+            continue;
+        unsigned int slot = sales_hash_slot(saleLog.hashSlots[i].key, capacity);
+        while (slots[slot].sku != 0)
+            slot = (slot + 1) & (capacity - 1);
+        slots[slot] = saleLog.hashSlots[i];
+    }
+    delete[] saleLog.hashSlots;
+    saleLog.hashSlots = slots;
+    saleLog.hashCapacity = capacity;
+}
+
+// Helper function: the id of a SKU number
+char *sales_sku_id(const unsigned int sku)
+{
+    return saleLog.skuChunks[sku / SALES_PER_CHUNK]->ids[sku % SALES_PER_CHUNK];
+}
+
+// Helper function: return the SKU number of a stock item, numbering it if it was never sold
+// The caller holds saleLog.lock, keeps the table at most half full, and publishes numOfSkus with the lines
+unsigned int sales_find_sku(const StockItem *stockItem, unsigned int &numOfSkus)
+{
+    unsigned int slot = sales_hash_slot(stockItem->key, saleLog.hashCapacity);
+    while (saleLog.hashSlots[slot].sku != 0)
+    {
+        unsigned int sku = saleLog.hashSlots[slot].sku - 1;
+        if (saleLog.hashSlots[slot].key == stockItem->key && ((stockItem->key & ID_KEY_STRCMP) == 0 || strcmp(sales_sku_id(sku), stockItem->id) == 0))
+            return sku;
+        slot = (slot + 1) & (saleLog.hashCapacity - 1);
+    }
+    unsigned int sku = numOfSkus++;
+    if (sku % SALES_PER_CHUNK == 0)
+        saleLog.skuChunks[sku / SALES_PER_CHUNK] = new SaleSkuChunk;
+    strcpy(sales_sku_id(sku), stockItem->id);
+    saleLog.hashSlots[slot] = {stockItem->key, sku + 1};
+    return sku;
+}
+
+// Append the lines of a shopping cart as one checkout
+// return false if the sale records are full (MAX_SALE_CHUNKS * SALES_PER_CHUNK lines), nothing is appended then
+bool sales_record_checkout(const ShoppingCart &shoppingCart)
+{
+    const CartLines &lines = shoppingCart.lines;
+    unsigned int numOfCartLines = lines.size;
+    if (numOfCartLines == 0)
+        return true; // nothing is sold
+
+    spin_lock(saleLog.lock);
+    unsigned int line = saleLog.numOfLines.load(memory_order_relaxed);
+    if (static_cast<unsigned long long>(line) + numOfCartLines > static_cast<unsigned long long>(MAX_SALE_CHUNKS) * SALES_PER_CHUNK - 1)
+    {
+        spin_unlock(saleLog.lock);
+        return false;
+    }
+    if (saleLog.chunks == nullptr)
+    {
+        saleLog.chunks = new SaleChunk *[MAX_SALE_CHUNKS];
+        saleLog.skuChunks = new SaleSkuChunk *[MAX_SALE_CHUNKS];
+    }
+    unsigned int numOfSkus = saleLog.numOfSkus.load(memory_order_relaxed);
+    while (2 * (numOfSkus + numOfCartLines) > saleLog.hashCapacity)
+        sales_grow_hash();
+    // the slots of all the lines are fetched from memory at once, before they are searched one by one
+    for (CartLines::Position l = sorted_first(lines); !sorted_is_end(lines, l); l = sorted_next(lines, l))
+        __builtin_prefetch(&saleLog.hashSlots[sales_hash_slot(sorted_node(lines, l)->key, saleLog.hashCapacity)]);
+    for (CartLines::Position l = sorted_first(lines); !sorted_is_end(lines, l); l = sorted_next(lines, l), line++)
+    {
+        const ShoppingCartItem *c = sorted_node(lines, l);
+        if (line % SALES_PER_CHUNK == 0)
+            saleLog.chunks[line / SALES_PER_CHUNK] = new SaleChunk;
+        SaleChunk *chunk = saleLog.chunks[line / SALES_PER_CHUNK];
+        chunk->skus[line % SALES_PER_CHUNK] = sales_find_sku(c->item, numOfSkus);
+        chunk->quantities[line % SALES_PER_CHUNK] = c->quantity;
+        chunk->pricesInCents[line % SALES_PER_CHUNK] = c->priceInCents;
+        chunk->checkouts[line % SALES_PER_CHUNK] = saleLog.numOfCheckouts;
+    }
+    saleLog.numOfCheckouts++;
+    saleLog.numOfSkus.store(numOfSkus, memory_order_release);
+    saleLog.numOfLines.store(line, memory_order_release);
+    spin_unlock(saleLog.lock);
+    return true;
+}
+
+// Checkout: record the sale of a shopping cart, commit its reserved units, clear it and return its total amount
+// Return false and leave the shopping cart as it is if the sale lines of the day are full (see sales_record_checkout)
+bool ll_checkout_shopping_cart(ShoppingCart &shoppingCart, unsigned long long &totalAmount)
+{
+    if (!sales_record_checkout(shoppingCart))
+        return false;
+    totalAmount = calculate_total_amount_in_shopping_cart(shoppingCart);
+    ll_empty_shopping_cart(shoppingCart, true);
+    return true;
+}
+
+// The totals of a stock item in a report
+struct SkuTotal
+{
+    unsigned int sku;           // The SKU number of the stock item
+    unsigned long long units;   // The quantity sold
+    unsigned long long revenue; // The amount sold in cents
+};
+
+// The totals of the lines [firstLine, lastLine) of the sale records
+struct SalesReport
+{
+    unsigned int firstLine;
+    unsigned int lastLine;
+    unsigned int numOfCheckouts;
+    unsigned long long units;
+    unsigned long long revenue;
+    SkuTotal *skuTotals;   // The stock items sold, sorted by revenue (the top ones at least, see sales_aggregate)
+    unsigned int numOfSkus; // The number of skuTotals
+};
+
+// Helper function: a SkuTotal with more revenue comes first, then the lower SKU number
+bool sku_total_more_revenue(const SkuTotal &a, const SkuTotal &b)
+{
+    if (a.revenue != b.revenue)
+        return a.revenue > b.revenue;
+    return a.sku < b.sku;
+}
+
+// Helper function: add the units and revenue of the lines [firstLine, lastLine) to the totals of their SKU numbers
+void sales_scan(const unsigned int firstLine, const unsigned int lastLine, SkuTotal totals[])
+{
+    unsigned int line = firstLine;
+    while (line < lastLine)
+    {
+        // the lines of a chunk are scanned column by column
+        const SaleChunk *chunk = saleLog.chunks[line / SALES_PER_CHUNK];
+        unsigned int first = line % SALES_PER_CHUNK;
+        unsigned int last = min(lastLine - (line - first), static_cast<unsigned int>(SALES_PER_CHUNK));
+        for (unsigned int i = first; i < last; i++)
+        {
+            SkuTotal &total = totals[chunk->skus[i]];
+            total.units += chunk->quantities[i];
+            total.revenue += static_cast<unsigned long long>(chunk->quantities[i]) * chunk->pricesInCents[i];
+        }
+        line += last - first;
+    }
+}
+
+// Helper function: sum up the SKU numbers [first, last) of the totals of every scan into those of the first scan
+void sales_merge(SkuTotal *totals[], const unsigned int numOfScans, const unsigned int first, const unsigned int last)
+{
+    for (unsigned int scan = 1; scan < numOfScans; scan++)
+    {
+        for (unsigned int sku = first; sku < last; sku++)
+        {
+            totals[0][sku].units += totals[scan][sku].units;
+            totals[0][sku].revenue += totals[scan][sku].revenue;
+        }
+    }
+}
+
+// Total the lines of the current day visible when the report starts (a point in time),
+// the checkouts appended meanwhile are left to the next report.
+// The lines are split among up to hardware_concurrency threads, at least SALES_PER_SCAN lines each,
+// every thread totals its lines into its own arrays, and the arrays are then merged SKU range by SKU range.
+// Only the top maxTopSkus of report.skuTotals are sorted by revenue, the others follow in any order
+void sales_aggregate(SalesReport &report, const unsigned int maxTopSkus)
+{
+    StatsTimer timer(STATS_SALES_REPORT);
+    report.lastLine = saleLog.numOfLines.load(memory_order_acquire);
+    report.firstLine = min(saleLog.dayStart.load(memory_order_relaxed), report.lastLine);
+    unsigned int numOfSkus = saleLog.numOfSkus.load(memory_order_acquire);
+    report.numOfCheckouts = 0;
+    report.units = 0;
+    report.revenue = 0;
+    report.skuTotals = nullptr;
+    report.numOfSkus = 0;
+    if (report.firstLine == report.lastLine)
+        return;
+
+    const unsigned int firstCheckout = saleLog.chunks[report.firstLine / SALES_PER_CHUNK]->checkouts[report.firstLine % SALES_PER_CHUNK];
+    const unsigned int lastCheckout = saleLog.chunks[(report.lastLine - 1) / SALES_PER_CHUNK]->checkouts[(report.lastLine - 1) % SALES_PER_CHUNK];
+    report.numOfCheckouts = lastCheckout - firstCheckout + 1;
+
+    unsigned int numOfLines = report.lastLine - report.firstLine;
+    unsigned int numOfScans = max(1U, min(thread::hardware_concurrency(), numOfLines / SALES_PER_SCAN));
+    SkuTotal **totals = new SkuTotal *[numOfScans];
+    thread *threads = new thread[numOfScans];
+    for (unsigned int scan = 0; scan < numOfScans; scan++)
+    {
+        totals[scan] = new SkuTotal[numOfSkus]();
+        unsigned int first = report.firstLine + static_cast<unsigned long long>(numOfLines) * scan / numOfScans;
+        unsigned int last = report.firstLine + static_cast<unsigned long long>(numOfLines) * (scan + 1) / numOfScans;
+        if (scan + 1 < numOfScans)
+            threads[scan] = thread(sales_scan, first, last, totals[scan]);
+        else
+            sales_scan(first, last, totals[scan]); // the last range is scanned by the caller
+    }
+    for (unsigned int scan = 0; scan + 1 < numOfScans; scan++)
+        threads[scan].join();
+    for (unsigned int scan = 0; scan + 1 < numOfScans; scan++)
+    {
+        unsigned int first = static_cast<unsigned long long>(numOfSkus) * scan / numOfScans;
+        unsigned int last = static_cast<unsigned long long>(numOfSkus) * (scan + 1) / numOfScans;
+        threads[scan] = thread(sales_merge, totals, numOfScans, first, last);
+    }
+    sales_merge(totals, numOfScans, static_cast<unsigned long long>(numOfSkus) * (numOfScans - 1) / numOfScans, numOfSkus);
+    for (unsigned int scan = 0; scan + 1 < numOfScans; scan++)
+        threads[scan].join();
+
+    // the stock items sold are moved to the front of the totals of the first scan, which become skuTotals
+    report.skuTotals = totals[0];
+    for (unsigned int sku = 0; sku < numOfSkus; sku++)
+    {
+        if (totals[0][sku].units == 0)
+            continue;
+        report.skuTotals[report.numOfSkus++] = {sku, totals[0][sku].units, totals[0][sku].revenue};
+        report.units += totals[0][sku].units;
+        report.revenue += totals[0][sku].revenue;
+    }
+    unsigned int numOfTopSkus = min(maxTopSkus, report.numOfSkus);
+    partial_sort(report.skuTotals, report.skuTotals + numOfTopSkus, report.skuTotals + report.numOfSkus, sku_total_more_revenue);
+
+    for (unsigned int scan = 1; scan < numOfScans; scan++)
+        delete[] totals[scan];
+    delete[] totals;
+    delete[] threads;
+}
+
+// Start a new day at a line, the lines before it are left out of the next reports
+void sales_start_day(const unsigned int line)
+{
+    saleLog.dayStart.store(line, memory_order_relaxed);
+}
+
+// Release every sale record
+void sales_release_all()
+{
+    unsigned int numOfLines = saleLog.numOfLines.load(memory_order_relaxed);
+    unsigned int numOfSkus = saleLog.numOfSkus.load(memory_order_relaxed);
+    for (unsigned int i = 0; i * SALES_PER_CHUNK < numOfLines; i++)
+        delete saleLog.chunks[i];
+    for (unsigned int i = 0; i * SALES_PER_CHUNK < numOfSkus; i++)
+        delete saleLog.skuChunks[i];
+    delete[] saleLog.chunks;
+    delete[] saleLog.skuChunks;
+    delete[] saleLog.hashSlots;
+    saleLog.chunks = nullptr;
+    saleLog.skuChunks = nullptr;
+    saleLog.numOfLines.store(0, memory_order_relaxed);
+    saleLog.numOfSkus.store(0, memory_order_relaxed);
+    saleLog.numOfCheckouts = 0;
+    saleLog.dayStart.store(0, memory_order_relaxed);
+    saleLog.hashSlots = nullptr;
+    saleLog.hashCapacity = 0;
+}
+
+// === Snapshot files ===
+// A snapshot file holds, in the byte order of the machine:
+// a SnapshotHeader, the StockItems sorted by id, the shopping carts, the ShoppingCartItems of the open
+// shopping carts (cart by cart, sorted by id), and the titles, each one followed by a NULL character.
+// A loaded snapshot is mapped into memory, so the titles are used in place instead of being copied
+const char SNAPSHOT_MAGIC[8] = {'S', 'R', 'M', 'S', 'N', 'A', 'P', '2'};
+
+struct SnapshotHeader
+{
+    char magic[8];                             // SNAPSHOT_MAGIC
+    unsigned long long numOfStockItems;        // The number of SnapshotStockItem
+    unsigned long long numOfShoppingCartItems; // The number of SnapshotShoppingCartItem
+    unsigned long long titlesSize;             // The number of characters of the titles
+    unsigned int numOfCarts;                   // The number of SnapshotShoppingCart
+    unsigned int firstFreeId;                  // ShoppingCartTable::firstFreeId
+};
+
+struct SnapshotStockItem
+{
+    char id[MAX_ID];                // StockItem::id
+    char reserved[2];               // Always 0, keeps titleOffset aligned
+    unsigned int priceInCents;      // StockItem::priceInCents
+    unsigned long long titleOffset; // The offset of the title from the first title
+    unsigned int isTracked;         // 1 if the stock of the StockItem is tracked, 0 otherwise
+    unsigned int onHand;            // The units on hand if the stock is tracked (the reserved units are in the shopping carts)
+};
+
+struct SnapshotShoppingCart
+{
+    unsigned int isOpen;       // 1 if the shopping cart is open, 0 otherwise
+    unsigned int numOfItems;   // The number of SnapshotShoppingCartItem of the shopping cart
+    unsigned int nextFreeId;   // ShoppingCart::nextFreeId
+};
+
+struct SnapshotShoppingCartItem
+{
+    unsigned int stockItem; // The index of the SnapshotStockItem
+    unsigned int quantity;  // ShoppingCartItem::quantity
+};
+
+// Helper function: total the ShoppingCartItems of a shopping cart in a snapshot
+// The quantities and the prices are gathered a chunk at a time, so calculate_total_amount runs on contiguous arrays
+// return false if the total amount does not fit in 64 bits
+bool snapshot_total_amount(const SnapshotStockItem *records, const SnapshotShoppingCartItem *cartItems, const unsigned int numOfItems, unsigned long long &totalAmount)
+{
+    unsigned int quantities[TOTAL_CHUNK_SIZE];
+    unsigned int pricesInCents[TOTAL_CHUNK_SIZE];
+    totalAmount = 0;
+    for (unsigned int start = 0; start < numOfItems; start += TOTAL_CHUNK_SIZE)
+    {
+        unsigned int numOfLines = min(numOfItems - start, static_cast<unsigned int>(TOTAL_CHUNK_SIZE));
+        for (unsigned int i = 0; i < numOfLines; i++)
+        {
+            quantities[i] = cartItems[start + i].quantity;
+            pricesInCents[i] = records[cartItems[start + i].stockItem].priceInCents;
+        }
+        unsigned long long chunkAmount;
+        if (!calculate_total_amount(quantities, pricesInCents, numOfLines, chunkAmount) ||
+            __builtin_add_overflow(totalAmount, chunkAmount, &totalAmount))
+            return false;
+    }
+    return true;
+}
+
+// Helper function: return the index of the StockItem with the given id in the sorted records
+unsigned int snapshot_find_stock_item(const SnapshotStockItem *records, const unsigned int numOfRecords, const StockItem *stockItem)
+{
+    unsigned int low = 0, high = numOfRecords;
+    while (high - low > 1)
+    {
+        unsigned int middle = low + (high - low) / 2;
+        if (strcmp(records[middle].id, stockItem->id) <= 0)
+            low = middle;
+        else
+            high = middle;
+    }
+    return low;
+}
+
+// Helper function: flush a file or a directory to the disk
+bool sync_file(const char *fileName, const bool isDirectory)
+{
+    int fd = open(fileName, isDirectory ? O_RDONLY | O_DIRECTORY : O_RDONLY);
+    if (fd < 0)
+        return false;
+    bool ok = fsync(fd) == 0;
+    close(fd);
+    return ok;
+}
+
+// Helper function: flush the directory entry of a file to the disk, e.g., after the file is created or renamed
+bool sync_directory_of(const char *fileName)
+{
+    char directory[MAX_FILE_NAME];
+    const char *slash = strrchr(fileName, '/');
+    if (slash == nullptr)
+        return sync_file(".", true);
+    int length = (slash == fileName) ? 1 : slash - fileName;
+    if (length >= MAX_FILE_NAME)
+        return false;
+    memcpy(directory, fileName, length);
+    directory[length] = '\0';
+    return sync_file(directory, true);
+}
+
+// Save the stock item list and the shopping carts to a snapshot file
+// The snapshot is written next to the file first and flushed to the disk before it is renamed,
+// so an existing file is only replaced by a complete snapshot, and the rename is flushed before returning
+bool snapshot_save(const char fileName[MAX_FILE_NAME], const StockItem *stockItemHead, const ShoppingCartTable *shoppingCartTable)
+{
+    StatsTimer timer(STATS_SAVE_SNAPSHOT);
+    SnapshotHeader header;
+    memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+    header.numOfStockItems = 0;
+    header.numOfShoppingCartItems = 0;
+    header.titlesSize = 0;
+    header.numOfCarts = shoppingCartTable->numOfCarts;
+    header.firstFreeId = shoppingCartTable->firstFreeId;
+
+    const StockItem *p;
+    for (p = stockItemHead; p != nullptr; p = p->next)
+        header.numOfStockItems++;
+    SnapshotStockItem *records = new SnapshotStockItem[header.numOfStockItems];
+    unsigned int i = 0;
+    for (p = stockItemHead; p != nullptr; p = p->next, i++)
+    {
+        memset(&records[i], 0, sizeof(SnapshotStockItem));
+        strcpy(records[i].id, p->id);
+        records[i].priceInCents = p->priceInCents;
+        records[i].titleOffset = header.titlesSize;
+        unsigned int reserved;
+        records[i].isTracked = inventory_get(p, records[i].onHand, reserved) ? 1 : 0;
+        header.titlesSize += strlen(p->title) + 1;
+    }
+
+    SnapshotShoppingCart *carts = new SnapshotShoppingCart[header.numOfCarts];
+    for (i = 0; i < header.numOfCarts; i++)
+    {
+        const ShoppingCart *shoppingCart = shopping_cart_table_get(*shoppingCartTable, i);
+        carts[i].isOpen = shoppingCart->isOpen ? 1 : 0;
+        carts[i].numOfItems = shoppingCart->lines.size;
+        carts[i].nextFreeId = shoppingCart->nextFreeId;
+        header.numOfShoppingCartItems += carts[i].numOfItems;
+    }
+
+    char tempFileName[MAX_FILE_NAME + 4];
+    strcpy(tempFileName, fileName);
+    strcat(tempFileName, ".tmp");
+    ofstream file(tempFileName, ios::binary | ios::trunc);
+    file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    file.write(reinterpret_cast<const char *>(records), header.numOfStockItems * sizeof(SnapshotStockItem));
+    file.write(reinterpret_cast<const char *>(carts), header.numOfCarts * sizeof(SnapshotShoppingCart));
+    for (i = 0; i < header.numOfCarts; i++)
+    {
+        const CartLines &lines = shopping_cart_table_get(*shoppingCartTable, i)->lines;
+        for (CartLines::Position l = sorted_first(lines); !sorted_is_end(lines, l); l = sorted_next(lines, l))
+        {
+            const ShoppingCartItem *c = sorted_node(lines, l);
+            SnapshotShoppingCartItem record = {snapshot_find_stock_item(records, header.numOfStockItems, c->item), c->quantity};
+            file.write(reinterpret_cast<const char *>(&record), sizeof(record));
+        }
+    }
+    for (p = stockItemHead; p != nullptr; p = p->next)
+        file.write(p->title, strlen(p->title) + 1);
+    file.close();
+    delete[] records;
+    delete[] carts;
+
+    if (!file || !sync_file(tempFileName, false) || rename(tempFileName, fileName) != 0)
+    {
+        remove(tempFileName);
+        return false;
+    }
+    return sync_directory_of(fileName);
+}
+
+// Helper function: check that a mapped snapshot is complete and consistent, before anything is built from it
+bool snapshot_is_valid(const char *data, const size_t size)
+{
+    if (size < sizeof(SnapshotHeader))
+        return false;
+    const SnapshotHeader *header = reinterpret_cast<const SnapshotHeader *>(data);
+    if (memcmp(header->magic, SNAPSHOT_MAGIC, sizeof(header->magic)) != 0 || header->numOfStockItems > 0xffffffffULL ||
+        header->numOfShoppingCartItems > size || header->titlesSize > size)
+        return false;
+    unsigned long long expectedSize = sizeof(SnapshotHeader) + header->numOfStockItems * sizeof(SnapshotStockItem) +
+                                      header->numOfCarts * sizeof(SnapshotShoppingCart) +
+                                      header->numOfShoppingCartItems * sizeof(SnapshotShoppingCartItem) + header->titlesSize;
+    if (expectedSize != size)
+        return false;
+
+    // every id is terminated and greater than the one before it, every title is terminated and shorter than MAX_TITLE
+    const SnapshotStockItem *records = reinterpret_cast<const SnapshotStockItem *>(data + sizeof(SnapshotHeader));
+    const char *titles = data + size - header->titlesSize;
+    if (header->numOfStockItems > 0 && (header->titlesSize == 0 || titles[header->titlesSize - 1] != '\0'))
+        return false;
+    for (unsigned long long i = 0; i < header->numOfStockItems; i++)
+    {
+        if (memchr(records[i].id, '\0', MAX_ID) == nullptr || records[i].titleOffset >= header->titlesSize || records[i].isTracked > 1)
+            return false;
+        if (strnlen(titles + records[i].titleOffset, MAX_TITLE) == MAX_TITLE)
+            return false;
+        if (i > 0 && strcmp(records[i - 1].id, records[i].id) >= 0)
+            return false;
+    }
+
+    // the shopping carts hold existing StockItems with a positive quantity, sorted by id, and their totals fit,
+    // and they reserve no more units of a tracked StockItem than it has on hand
+    const SnapshotShoppingCart *carts = reinterpret_cast<const SnapshotShoppingCart *>(records + header->numOfStockItems);
+    const SnapshotShoppingCartItem *cartItems = reinterpret_cast<const SnapshotShoppingCartItem *>(carts + header->numOfCarts);
+    unsigned long long numOfShoppingCartItems = 0;
+    unsigned int numOfClosedCarts = 0;
+    unsigned long long *reserved = (header->numOfShoppingCartItems > 0) ? new unsigned long long[header->numOfStockItems]() : nullptr;
+    bool valid = true;
+    for (unsigned int i = 0; i < header->numOfCarts && valid; i++)
+    {
+        valid = carts[i].isOpen <= 1 && (carts[i].isOpen == 1 || carts[i].numOfItems == 0) &&
+                carts[i].numOfItems <= header->numOfShoppingCartItems - numOfShoppingCartItems;
+        if (carts[i].isOpen == 0)
+            numOfClosedCarts++;
+        for (unsigned int j = 0; j < carts[i].numOfItems && valid; j++)
+        {
+            const SnapshotShoppingCartItem &c = cartItems[numOfShoppingCartItems + j];
+            valid = c.stockItem < header->numOfStockItems && c.quantity > 0 && (j == 0 || cartItems[numOfShoppingCartItems + j - 1].stockItem < c.stockItem);
+            if (valid)
+            {
+                reserved[c.stockItem] += c.quantity;
+                valid = records[c.stockItem].isTracked == 0 || reserved[c.stockItem] <= records[c.stockItem].onHand;
+            }
+        }
+        unsigned long long totalAmount;
+        valid = valid && snapshot_total_amount(records, cartItems + numOfShoppingCartItems, carts[i].numOfItems, totalAmount);
+        numOfShoppingCartItems += carts[i].numOfItems;
+    }
+    delete[] reserved;
+    if (!valid || numOfShoppingCartItems != header->numOfShoppingCartItems)
+        return false;
+
+    // the free IDs are exactly the closed shopping carts, and at least one shopping cart is open (see shopping_cart_table_close)
+    unsigned int numOfFreeIds = 0;
+    for (unsigned int id = header->firstFreeId; id != NO_SHOPPING_CART; id = carts[id].nextFreeId)
+    {
+        if (id >= header->numOfCarts || carts[id].isOpen != 0 || ++numOfFreeIds > numOfClosedCarts)
+            return false;
+    }
+    return numOfFreeIds == numOfClosedCarts && numOfClosedCarts < header->numOfCarts;
+}
+
+// Replace the stock item list and the shopping carts with the ones of a snapshot file
+// The StockItems are already sorted, so the list is built in a single pass without searching,
+// and the titles stay in the mapped file. Nothing is changed if the file is not a valid snapshot
+bool snapshot_load(const char fileName[MAX_FILE_NAME], StockItem *&stockItemHead, ShoppingCartTable *&shoppingCartTable)
+{
+    StatsTimer timer(STATS_LOAD_SNAPSHOT);
+    int fd = open(fileName, O_RDONLY);
+    if (fd < 0)
+        return false;
+    struct stat fileStatus;
+    void *mapped = MAP_FAILED;
+    if (fstat(fd, &fileStatus) == 0 && fileStatus.st_size > 0)
+        mapped = mmap(nullptr, fileStatus.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapped == MAP_FAILED)
+        return false;
+    const char *data = static_cast<const char *>(mapped);
+    size_t size = fileStatus.st_size;
+    if (!snapshot_is_valid(data, size))
+    {
+        munmap(mapped, size);
+        return false;
+    }
+
+    ll_cleanup(stockItemHead, shoppingCartTable);
+    snapshotMapping.data = data;
+    snapshotMapping.size = size;
+
+    const SnapshotHeader *header = reinterpret_cast<const SnapshotHeader *>(data);
+    const SnapshotStockItem *records = reinterpret_cast<const SnapshotStockItem *>(data + sizeof(SnapshotHeader));
+    const SnapshotShoppingCart *carts = reinterpret_cast<const SnapshotShoppingCart *>(records + header->numOfStockItems);
+    const SnapshotShoppingCartItem *cartItems = reinterpret_cast<const SnapshotShoppingCartItem *>(carts + header->numOfCarts);
+    const char *titles = data + size - header->titlesSize;
+
+    // append every StockItem to the last StockItem of each of its levels
+    // the StockItems are only kept by index if the shopping carts refer to them
+    StockItem **stockItems = (header->numOfShoppingCartItems > 0) ? new StockItem *[header->numOfStockItems] : nullptr;
+    StockItem *last[MAX_SKIP_LEVEL];
+    for (unsigned int i = 0; i < header->numOfStockItems; i++)
+    {
+        StockItem *stockItem = ll_create_stock_item_with_stored_title(records[i].id, titles + records[i].titleOffset, records[i].priceInCents);
+        if (records[i].isTracked == 1)
+            inventory_track(stockItem, records[i].onHand, 0); // the shopping carts reserve their units below
+        int level = (i == 0) ? MAX_SKIP_LEVEL : ll_random_stock_item_level();
+        ll_resize_stock_item_levels(stockItem, level);
+        for (int j = 0; j < level; j++)
+        {
+            if (i > 0)
+                ll_next_stock_item(last[j], j) = stockItem;
+            last[j] = stockItem;
+        }
+        if (i == 0)
+            stockItemHead = stockItem;
+        if (stockItems != nullptr)
+            stockItems[i] = stockItem;
+    }
+
+    shoppingCartTable = dynamic_init_shopping_cart_table(header->numOfCarts);
+    shoppingCartTable->firstFreeId = header->firstFreeId;
+    for (unsigned int i = 0; i < header->numOfCarts; i++)
+    {
+        ShoppingCart *shoppingCart = shopping_cart_table_get(*shoppingCartTable, i);
+        shoppingCart->isOpen = (carts[i].isOpen == 1);
+        shoppingCart->nextFreeId = carts[i].nextFreeId;
+        if (!shoppingCart->isOpen)
+            shoppingCartTable->numOfOpenCarts--;
+        snapshot_total_amount(records, cartItems, carts[i].numOfItems, shoppingCart->totalAmount);
+        // the items of a shopping cart are saved in order, so each one is inserted after the previous one
+        CartLines::Position position = sorted_first(shoppingCart->lines);
+        unsigned long long numOfCompared = 0;
+        for (unsigned int j = 0; j < carts[i].numOfItems; j++, cartItems++)
+        {
+            StockItem *stockItem = stockItems[cartItems->stockItem];
+            ShoppingCartItem *newShoppingCartItem = ll_create_shopping_cart_item(stockItem, cartItems->quantity);
+            ll_link_shopping_cart_item(stockItem, shoppingCart, newShoppingCartItem);
+            inventory_reserve(stockItem, cartItems->quantity);
+            sorted_find_after(shoppingCart->lines, stockItem->key, stockItem->id, position, numOfCompared);
+            sorted_insert(shoppingCart->lines, position, newShoppingCartItem);
+        }
+    }
+    delete[] stockItems;
+    return true;
+}
+
+// === Operation log ===
+// Every operation that changes the lists is appended to the log after it succeeds,
+// and the log is replayed on startup to recover the lists after a crash.
+// A record is a LogRecordHeader followed by its payload: the type, the shopping cart ID and the price or quantity,
+// then the id and the title (or the snapshot file name), each one followed by a NULL character.
+// Records are written to the file in groups of commitBatchSize, with one fdatasync per group
+const int LOG_BUFFER_SIZE = 1 << 20;                              // number of characters of records kept before they are written
+const int MAX_LOG_RECORD = 1 + 4 + 4 + MAX_ID + MAX_FILE_NAME + 8; // at most this many characters in the payload of a record
+
+enum LogRecordType
+{
+    LOG_INIT_SHOPPING_CART_TABLE = 1, // dynamic_init_shopping_cart_table(cart)
+    LOG_INSERT_STOCK_ITEM,            // ll_insert_stock_item(id, title, value)
+    LOG_UPDATE_STOCK_ITEM_PRICE,      // ll_update_stock_item_price(id, value)
+    LOG_REMOVE_STOCK_ITEM,            // ll_remove_stock_item(id)
+    LOG_INSERT_OR_ADD_STOCK_ITEM,     // ll_insert_or_add_stock_item_quantity(cart, id, value)
+    LOG_DEDUCT_STOCK_ITEM,            // ll_deduct_stock_item_quantity_from_shopping_cart(cart, id, value)
+    LOG_REMOVE_STOCK_ITEM_FROM_CART,  // ll_remove_stock_item_from_shopping_cart(cart, id)
+    LOG_CLEAR_SHOPPING_CART,          // ll_clear_shopping_cart(cart), the checkout
+    LOG_OPEN_SHOPPING_CART,           // shopping_cart_table_open()
+    LOG_CLOSE_SHOPPING_CART,          // shopping_cart_table_close(cart)
+    LOG_LOAD_SNAPSHOT,                // snapshot_load(title), always the first record after a checkpoint
+    LOG_UPDATE_STOCK_ITEM_PRICES,     // followed by value LOG_UPDATE_STOCK_ITEM_PRICE records, replayed all or none
+    LOG_END_DAY,                      // sales_start_day(), the sale records before it belong to the previous day
+    LOG_RESTOCK_STOCK_ITEM            // ll_restock_stock_item(id, value)
+};
+
+struct LogRecordHeader
+{
+    unsigned int size;     // The number of characters of the payload
+    unsigned int checksum; // The FNV-1a hash of the payload, a torn record at the end of the log does not match
+};
+
+// A write-ahead log of the operations, disabled if fd is -1
+struct OperationLog
+{
+    int fd;                       // The log file
+    char fileName[MAX_FILE_NAME]; // The name of the log file
+    char *buffer;                 // The records not written yet
+    int length;                   // The number of characters in buffer
+    unsigned int numPending;      // The number of records not made durable yet
+    unsigned int commitBatchSize; // The number of records made durable together
+    bool failed;                  // A write to the log failed, nothing is logged after it
+};
+
+// FNV-1a hash of a log record payload
+unsigned int log_checksum(const char *payload, const unsigned int size)
+{
+    unsigned int hash = 2166136261u;
+    for (unsigned int i = 0; i < size; i++)
+        hash = (hash ^ static_cast<unsigned char>(payload[i])) * 16777619u;
+    return hash;
+}
+
+// Helper function: write the whole buffer to fd
+bool log_write_all(const int fd, const char *buffer, int length)
+{
+    while (length > 0)
+    {
+        ssize_t written = write(fd, buffer, length);
+        if (written < 0)
+            return false;
+        buffer += written;
+        length -= written;
+    }
+    return true;
+}
+
+// Make every record appended so far durable
+// Once a write fails the log is marked as failed and the records are kept in the buffer, as the end of the
+// log file is unknown. Every later commit fails, so no change after it is acknowledged
+bool log_commit(OperationLog &log)
+{
+    if (log.fd < 0 || (log.numPending == 0 && !log.failed))
+        return true;
+    if (log.failed || !log_write_all(log.fd, log.buffer, log.length) || fdatasync(log.fd) != 0)
+    {
+        log.failed = true;
+        return false;
+    }
+    log.length = 0;
+    log.numPending = 0;
+    return true;
+}
+
+// Append a record, committing the group once it has commitBatchSize records
+// id and title are "" for the records without them. Return false if the log has failed (see log_commit)
+bool log_append(OperationLog &log, const LogRecordType type, const unsigned int whichCart, const unsigned int value, const char *id, const char *title)
+{
+    if (log.fd < 0)
+        return true;
+    if (log.failed || (log.length + (int)sizeof(LogRecordHeader) + MAX_LOG_RECORD > LOG_BUFFER_SIZE && !log_commit(log)))
+        return false;
+
+    char *payload = log.buffer + log.length + sizeof(LogRecordHeader);
+    unsigned int size = 0;
+    payload[size++] = static_cast<char>(type);
+    memcpy(payload + size, &whichCart, sizeof(whichCart));
+    size += sizeof(whichCart);
+    memcpy(payload + size, &value, sizeof(value));
+    size += sizeof(value);
+    strcpy(payload + size, id);
+    size += strlen(id) + 1;
+    strcpy(payload + size, title);
+    size += strlen(title) + 1;
+
+    LogRecordHeader header = {size, log_checksum(payload, size)};
+    memcpy(log.buffer + log.length, &header, sizeof(header));
+    log.length += sizeof(header) + size;
+    if (++log.numPending >= log.commitBatchSize)
+        return log_commit(log);
+    return true;
+}
+
+// Helper function: return the number of characters of the complete record at the start of data, 0 if it is torn
+size_t log_record_length(const char *data, const size_t size)
+{
+    LogRecordHeader header;
+    if (size < sizeof(header))
+        return 0;
+    memcpy(&header, data, sizeof(header));
+    if (header.size > size - sizeof(header) || header.size > MAX_LOG_RECORD ||
+        log_checksum(data + sizeof(header), header.size) != header.checksum)
+        return 0;
+    return sizeof(header) + header.size;
+}
+
+// Helper function: apply a record to the lists, return false if the record cannot be applied
+bool log_replay_record(const char *payload, const unsigned int size, StockItem *&stockItemHead, ShoppingCartTable *&shoppingCartTable)
+{
+    unsigned int whichCart, value;
+    if (size < 1 + sizeof(whichCart) + sizeof(value) + 2 || payload[size - 1] != '\0')
+        return false;
+    LogRecordType type = static_cast<LogRecordType>(payload[0]);
+    memcpy(&whichCart, payload + 1, sizeof(whichCart));
+    memcpy(&value, payload + 1 + sizeof(whichCart), sizeof(value));
+    const char *id = payload + 1 + sizeof(whichCart) + sizeof(value);
+    const char *title = id + strlen(id) + 1;
+    if (title >= payload + size || strlen(id) >= MAX_ID || strlen(title) >= MAX_FILE_NAME)
+        return false;
+
+    bool isCartOperation = (type >= LOG_INSERT_OR_ADD_STOCK_ITEM && type <= LOG_CLEAR_SHOPPING_CART) || type == LOG_CLOSE_SHOPPING_CART;
+    if (isCartOperation && !shopping_cart_table_is_open(*shoppingCartTable, whichCart))
+        return false;
+    ShoppingCart *shoppingCart = isCartOperation ? shopping_cart_table_get(*shoppingCartTable, whichCart) : nullptr;
+    switch (type)
+    {
+    case LOG_INIT_SHOPPING_CART_TABLE:
+        ll_cleanup(stockItemHead, shoppingCartTable);
+        shoppingCartTable = dynamic_init_shopping_cart_table(whichCart);
+        return true;
+    case LOG_INSERT_STOCK_ITEM:
+        return strlen(title) < MAX_TITLE && ll_insert_stock_item(stockItemHead, id, title, value);
+    case LOG_UPDATE_STOCK_ITEM_PRICE:
+        return ll_update_stock_item_price(stockItemHead, id, value);
+    case LOG_REMOVE_STOCK_ITEM:
+        return ll_remove_stock_item(stockItemHead, id);
+    case LOG_INSERT_OR_ADD_STOCK_ITEM:
+        return ll_insert_or_add_stock_item_quantity(*shoppingCart, stockItemHead, id, value);
+    case LOG_DEDUCT_STOCK_ITEM:
+        return ll_deduct_stock_item_quantity_from_shopping_cart(*shoppingCart, id, value);
+    case LOG_REMOVE_STOCK_ITEM_FROM_CART:
+        return ll_remove_stock_item_from_shopping_cart(*shoppingCart, id);
+    case LOG_CLEAR_SHOPPING_CART:
+    {
+        unsigned long long totalAmount;
+        return ll_checkout_shopping_cart(*shoppingCart, totalAmount);
+    }
+    case LOG_OPEN_SHOPPING_CART:
+        return shopping_cart_table_open(*shoppingCartTable) == whichCart;
+    case LOG_CLOSE_SHOPPING_CART:
+        return shopping_cart_table_close(*shoppingCartTable, whichCart);
+    case LOG_LOAD_SNAPSHOT:
+        return snapshot_load(title, stockItemHead, shoppingCartTable);
+    case LOG_UPDATE_STOCK_ITEM_PRICES:
+        return true; // the updates follow
+    case LOG_END_DAY:
+        sales_start_day(saleLog.numOfLines.load(memory_order_relaxed));
+        return true;
+    case LOG_RESTOCK_STOCK_ITEM:
+        return ll_restock_stock_item(stockItemHead, id, value);
+    default:
+        return false;
+    }
+}
+
+// Open the log and replay it on top of the current lists
+// The replay stops at the first torn record, which is cut off together with the rest of the log.
+// A new log starts with the current shopping cart table. Return the number of records replayed, or -1 on failure
+long log_open(OperationLog &log, const char fileName[MAX_FILE_NAME], const unsigned int commitBatchSize, StockItem *&stockItemHead, ShoppingCartTable *&shoppingCartTable)
+{
+    log.fd = open(fileName, O_RDWR | O_CREAT, 0644);
+    if (log.fd < 0)
+        return -1;
+    strncpy(log.fileName, fileName, MAX_FILE_NAME - 1);
+    log.fileName[MAX_FILE_NAME - 1] = '\0';
+    log.buffer = new char[LOG_BUFFER_SIZE];
+    log.length = 0;
+    log.numPending = 0;
+    log.commitBatchSize = (commitBatchSize > 0) ? commitBatchSize : 1;
+    log.failed = false;
+
+    struct stat fileStatus;
+    if (fstat(log.fd, &fileStatus) != 0)
+        return -1;
+    size_t size = fileStatus.st_size;
+    size_t offset = 0;
+    long numOfRecords = 0;
+    if (size > 0)
+    {
+        void *mapped = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, log.fd, 0);
+        if (mapped == MAP_FAILED)
+            return -1;
+        const char *data = static_cast<const char *>(mapped);
+        size_t length;
+        while ((length = log_record_length(data + offset, size - offset)) > 0)
+        {
+            const char *payload = data + offset + sizeof(LogRecordHeader);
+            unsigned int payloadSize = length - sizeof(LogRecordHeader);
+            if (payload[0] == LOG_UPDATE_STOCK_ITEM_PRICES && payloadSize >= 9)
+            {
+                // the prices of a bulk price update are only replayed if every update made it to the log
+                unsigned int numOfUpdates, i;
+                size_t end = offset + length;
+                memcpy(&numOfUpdates, payload + 5, sizeof(numOfUpdates));
+                for (i = 0; i < numOfUpdates && (length = log_record_length(data + end, size - end)) > 0; i++)
+                    end += length;
+                if (i < numOfUpdates)
+                    break;
+            }
+            if (!log_replay_record(payload, payloadSize, stockItemHead, shoppingCartTable))
+            {
+                // a complete record that cannot be applied, the log is kept for a look
+                munmap(mapped, size);
+                return -1;
+            }
+            offset += sizeof(LogRecordHeader) + payloadSize;
+            numOfRecords++;
+        }
+        munmap(mapped, size);
+    }
+    if ((offset < size && ftruncate(log.fd, offset) != 0) || lseek(log.fd, offset, SEEK_SET) < 0)
+        return -1;
+    if (numOfRecords == 0)
+    {
+        if (!log_append(log, LOG_INIT_SHOPPING_CART_TABLE, shoppingCartTable->numOfCarts, 0, "", "") || !log_commit(log) || !sync_directory_of(fileName))
+            return -1;
+    }
+    return numOfRecords;
+}
+
+// Start the log over after a snapshot is saved or loaded, as the snapshot holds everything logged so far
+// The snapshot is flushed to the disk first and referred to by its absolute path, so the log is replayed
+// from any directory. The new log is written next to the old one and renamed, so a crash leaves one of the two complete
+bool log_checkpoint(OperationLog &log, const char snapshotFileName[MAX_FILE_NAME])
+{
+    if (log.fd < 0)
+        return true;
+    char snapshotPath[PATH_MAX];
+    if (!log_commit(log) || realpath(snapshotFileName, snapshotPath) == nullptr || strlen(snapshotPath) >= MAX_FILE_NAME ||
+        !sync_file(snapshotPath, false) || !sync_directory_of(snapshotPath))
+        return false;
+    char tempFileName[MAX_FILE_NAME + 4];
+    strcpy(tempFileName, log.fileName);
+    strcat(tempFileName, ".tmp");
+    int fd = open(tempFileName, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+        return false;
+    int oldFd = log.fd;
+    log.fd = fd;
+    if (!log_append(log, LOG_LOAD_SNAPSHOT, 0, 0, "", snapshotPath) || !log_commit(log) || rename(tempFileName, log.fileName) != 0)
+    {
+        // the old log is still complete, as everything was committed to it
+        close(fd);
+        log.fd = oldFd;
+        log.length = 0;
+        log.numPending = 0;
+        log.failed = false;
+        remove(tempFileName);
+        return false;
+    }
+    close(oldFd);
+    // the log is renamed even if its directory is not flushed, so only a crash after it can bring the old log back
+    if (!sync_directory_of(log.fileName))
+        log.failed = true;
+    return !log.failed;
+}
+
+void log_close(OperationLog &log)
+{
+    if (log.fd < 0)
+        return;
+    log_commit(log);
+    close(log.fd);
+    delete[] log.buffer;
+    log.fd = -1;
+    log.buffer = nullptr;
+}
+
+// A reader of the stock item lists of the RetailEngines
+// A reader announces the epoch it started in, and a removed StockItem is only released
+// once no reader that started before its removal is still reading
+struct EpochRecord
+{
+    atomic<unsigned long long> epoch; // The epoch the reader started in, 0 if the thread is not reading
+    atomic<bool> inUse;               // Whether a thread owns the record
+    EpochRecord *next;                // The pointer pointing to the next record
+};
+
+// A StockItem removed from the list, waiting for the readers that may still hold it
+struct RetiredStockItem
+{
+    StockItem *stockItem;     // The removed StockItem
+    unsigned long long epoch; // The epoch of the removal, readers of later epochs cannot reach the StockItem
+    RetiredStockItem *next;   // The pointer pointing to the previously removed StockItem
+};
+
+// The record of the current thread, given back for reuse when the thread exits
+struct EpochThread
+{
+    EpochRecord *record;
+    ~EpochThread()
+    {
+        if (record != nullptr)
+            record->inUse.store(false, memory_order_release);
+    }
+};
+
+atomic<unsigned long long> globalEpoch(1);
+atomic<EpochRecord *> epochRecords(nullptr);
+thread_local EpochThread epochThread = {nullptr};
+
+// Helper function: return the record of the current thread, taking a free one or adding a new one
+EpochRecord *epoch_thread_record()
+{
+    if (epochThread.record != nullptr)
+        return epochThread.record;
+    EpochRecord *record;
+    for (record = epochRecords.load(memory_order_acquire); record != nullptr; record = record->next)
+    {
+        bool inUse = false;
+        if (!record->inUse.load(memory_order_relaxed) && record->inUse.compare_exchange_strong(inUse, true))
+            break;
+    }
+    if (record == nullptr)
+    {
+        // the records are never deleted, a thread exiting leaves its record to the next thread
+        record = new EpochRecord;
+        record->epoch.store(0, memory_order_relaxed);
+        record->inUse.store(true, memory_order_relaxed);
+        record->next = epochRecords.load(memory_order_relaxed);
+        while (!epochRecords.compare_exchange_weak(record->next, record))
+        {
+        }
+    }
+    epochThread.record = record;
+    return record;
+}
+
+// Start reading a stock item list without a lock
+// Every StockItem reached before epoch_exit stays allocated
+EpochRecord *epoch_enter()
+{
+    EpochRecord *record = epoch_thread_record();
+    record->epoch.store(globalEpoch.load(memory_order_relaxed), memory_order_relaxed);
+    atomic_thread_fence(memory_order_seq_cst); // announced before any link is read
+    return record;
+}
+
+void epoch_exit(EpochRecord *record)
+{
+    record->epoch.store(0, memory_order_release);
+}
+
+// Helper function: return the oldest epoch a reader is still reading in
+unsigned long long epoch_oldest_reader()
+{
+    atomic_thread_fence(memory_order_seq_cst); // the StockItems retired so far are unlinked before the records are read
+    unsigned long long oldest = ~0ULL;
+    for (EpochRecord *record = epochRecords.load(memory_order_acquire); record != nullptr; record = record->next)
+    {
+        unsigned long long epoch = record->epoch.load(memory_order_acquire);
+        if (epoch != 0 && epoch < oldest)
+            oldest = epoch;
+    }
+    return oldest;
+}
+
+// A thread-safe retail system over the stock item list and the shopping cart table
+// Catalog lookups take no lock: the links of the list are atomic, and a removed StockItem is retired
+// instead of released until the readers that may hold it are done (see epoch_enter).
+// The head of the list is a sentinel with an empty id, so it is never replaced while readers walk the list.
+// Shopping cart operations hold the lock shared, so they never wait for each other,
+// and the operations on different shopping carts run in parallel, each one holding only its own cart lock.
+// Catalog writes and opening/closing shopping carts hold the lock exclusively, so no shopping cart
+// operation is in flight when a StockItem is removed, and no shopping cart keeps a dangling StockItem
+struct RetailEngine
+{
+    StockItem *stockItemHead;             // The sentinel heading the sorted linked list of StockItem
+    ShoppingCartTable *shoppingCartTable; // The shopping carts
+    RetiredStockItem *retired;            // The removed StockItems not released yet
+    atomic<unsigned int> priceVersion;    // Odd while a bulk price update is applied
+    shared_mutex lock;                    // The lock of the stock item list and the shopping cart table
+};
+
+RetailEngine *engine_init(const unsigned int numOfShoppingCart)
+{
+    RetailEngine *engine = new RetailEngine;
+    engine->stockItemHead = ll_create_stock_item("", "", 0);
+    ll_resize_stock_item_levels(engine->stockItemHead, MAX_SKIP_LEVEL);
+    engine->shoppingCartTable = dynamic_init_shopping_cart_table(numOfShoppingCart);
+    engine->retired = nullptr;
+    engine->priceVersion.store(0);
+    return engine;
+}
+
+// Helper function: the sentinel is not a StockItem of the engine
+bool engine_is_stock_item_id(const char id[MAX_ID])
+{
+    return id[0] != '\0';
+}
+
+// Helper function: release the removed StockItems no reader can hold anymore
+// Called with the lock held exclusively
+void engine_release_retired_stock_items(RetailEngine &engine)
+{
+    unsigned long long oldest = epoch_oldest_reader();
+    RetiredStockItem **pprev = &engine.retired;
+    while (*pprev != nullptr)
+    {
+        RetiredStockItem *retired = *pprev;
+        if (retired->epoch < oldest)
+        {
+            *pprev = retired->next;
+            ll_delete_stock_item(retired->stockItem);
+            delete retired;
+        }
+        else
+            pprev = &retired->next;
+    }
+}
+
+void engine_cleanup(RetailEngine *&engine)
+{
+    while (engine->retired != nullptr)
+    {
+        RetiredStockItem *retired = engine->retired;
+        engine->retired = retired->next;
+        delete retired; // the StockItem is released with its slab
+    }
+    ll_cleanup(engine->stockItemHead, engine->shoppingCartTable);
+    delete engine;
+    engine = nullptr;
+}
+
+bool engine_insert_stock_item(RetailEngine &engine, const char id[MAX_ID], const char title[MAX_TITLE], const unsigned int priceInCents)
+{
+    unique_lock<shared_mutex> writer(engine.lock);
+    return ll_insert_stock_item(engine.stockItemHead, id, title, priceInCents);
+}
+
+bool engine_update_stock_item_price(RetailEngine &engine, const char id[MAX_ID], const unsigned int newPriceInCents)
+{
+    if (!engine_is_stock_item_id(id))
+        return false;
+    unique_lock<shared_mutex> writer(engine.lock);
+    return ll_update_stock_item_price(engine.stockItemHead, id, newPriceInCents);
+}
+
+bool engine_remove_stock_item(RetailEngine &engine, const char id[MAX_ID])
+{
+    if (!engine_is_stock_item_id(id))
+        return false;
+    unique_lock<shared_mutex> writer(engine.lock);
+    StockItem *stockItem = ll_unlink_stock_item(engine.stockItemHead, id);
+    if (stockItem == nullptr)
+        return false;
+    RetiredStockItem *retired = new RetiredStockItem;
+    retired->stockItem = stockItem;
+    retired->epoch = globalEpoch.fetch_add(1); // readers starting from now on cannot reach the StockItem
+    retired->next = engine.retired;
+    engine.retired = retired;
+    engine_release_retired_stock_items(engine);
+    return true;
+}
+
+// Look up the price of a StockItem without taking a lock
+// A copy is returned, the StockItem may be removed as soon as the lookup is done
+bool engine_get_stock_item_price(RetailEngine &engine, const char id[MAX_ID], unsigned int &priceInCents)
+{
+    if (!engine_is_stock_item_id(id))
+        return false;
+    EpochRecord *reader = epoch_enter();
+    const StockItem *stockItem;
+    unsigned int version;
+    while (true)
+    {
+        // looked up again if a bulk price update is applied meanwhile, so it is seen as a whole
+        version = engine.priceVersion.load(memory_order_acquire);
+        if ((version & 1) != 0)
+        {
+            this_thread::yield();
+            continue;
+        }
+        stockItem = ll_search_stock_item(engine.stockItemHead, id);
+        if (stockItem != nullptr)
+            priceInCents = stockItem->priceInCents.load(memory_order_relaxed);
+        atomic_thread_fence(memory_order_acquire);
+        if (engine.priceVersion.load(memory_order_relaxed) == version)
+            break;
+    }
+    epoch_exit(reader);
+    return stockItem != nullptr;
+}
+
+// Apply a batch of price updates at once (see ll_find_price_updates)
+// Shopping cart operations wait for the whole batch, and lookups see either none or all of the new prices
+// return the number of updates applied, the stockItem of the others is nullptr
+unsigned int engine_update_stock_item_prices(RetailEngine &engine, PriceUpdate *updates, const unsigned int numOfUpdates)
+{
+    unique_lock<shared_mutex> writer(engine.lock);
+    unsigned int numOfFound = ll_find_price_updates(engine.stockItemHead, updates, numOfUpdates);
+    for (unsigned int i = 0; i < numOfUpdates; i++)
+    {
+        if (updates[i].stockItem == engine.stockItemHead)
+        {
+            updates[i].stockItem = nullptr; // the sentinel
+            numOfFound--;
+        }
+    }
+    unsigned int version = engine.priceVersion.load(memory_order_relaxed);
+    engine.priceVersion.store(version + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    numOfFound = ll_apply_price_updates(updates, numOfUpdates);
+    engine.priceVersion.store(version + 2, memory_order_release);
+    return numOfFound;
+}
+
+unsigned int engine_open_shopping_cart(RetailEngine &engine)
+{
+    unique_lock<shared_mutex> writer(engine.lock);
+    return shopping_cart_table_open(*engine.shoppingCartTable);
+}
+
+bool engine_close_shopping_cart(RetailEngine &engine, const unsigned int whichCart)
+{
+    unique_lock<shared_mutex> writer(engine.lock);
+    return shopping_cart_table_close(*engine.shoppingCartTable, whichCart);
+}
+
+bool engine_insert_or_add_stock_item_quantity(RetailEngine &engine, const unsigned int whichCart, const char id[MAX_ID], const unsigned int quantity)
+{
+    if (!engine_is_stock_item_id(id))
+        return false;
+    shared_lock<shared_mutex> reader(engine.lock);
+    if (!shopping_cart_table_is_open(*engine.shoppingCartTable, whichCart))
+        return false;
+    ShoppingCart *shoppingCart = shopping_cart_table_get(*engine.shoppingCartTable, whichCart);
+    lock_guard<mutex> cartLock(shoppingCart->lock);
+    return ll_insert_or_add_stock_item_quantity(*shoppingCart, engine.stockItemHead, id, quantity);
+}
+
+// A StockItem already tracked is restocked by a single atomic update, with the lock shared,
+// so the tills keep reserving units of it meanwhile.
+// The first restock of a StockItem walks the shopping carts holding it, with the lock held exclusively
+bool engine_restock_stock_item(RetailEngine &engine, const char id[MAX_ID], const unsigned int quantity)
+{
+    if (!engine_is_stock_item_id(id))
+        return false;
+    {
+        shared_lock<shared_mutex> reader(engine.lock);
+        StockItem *stockItem = ll_search_stock_item(engine.stockItemHead, id);
+        if (stockItem == nullptr)
+            return false;
+        if (stockItem->inventorySlot.load(memory_order_acquire) != 0)
+            return inventory_restock(stockItem, quantity);
+    }
+    unique_lock<shared_mutex> writer(engine.lock);
+    return ll_restock_stock_item(engine.stockItemHead, id, quantity);
+}
+
+bool engine_deduct_stock_item_quantity_from_shopping_cart(RetailEngine &engine, const unsigned int whichCart, const char id[MAX_ID], const unsigned int deductQuantity)
+{
+    shared_lock<shared_mutex> reader(engine.lock);
+    if (!shopping_cart_table_is_open(*engine.shoppingCartTable, whichCart))
+        return false;
+    ShoppingCart *shoppingCart = shopping_cart_table_get(*engine.shoppingCartTable, whichCart);
+    lock_guard<mutex> cartLock(shoppingCart->lock);
+    return ll_deduct_stock_item_quantity_from_shopping_cart(*shoppingCart, id, deductQuantity);
+}
+
+bool engine_remove_stock_item_from_shopping_cart(RetailEngine &engine, const unsigned int whichCart, const char id[MAX_ID])
+{
+    shared_lock<shared_mutex> reader(engine.lock);
+    if (!shopping_cart_table_is_open(*engine.shoppingCartTable, whichCart))
+        return false;
+    ShoppingCart *shoppingCart = shopping_cart_table_get(*engine.shoppingCartTable, whichCart);
+    lock_guard<mutex> cartLock(shoppingCart->lock);
+    return ll_remove_stock_item_from_shopping_cart(*shoppingCart, id);
+}
+
+// Checkout: return the total amount of the shopping cart and clear it
+// Return false if the shopping cart is not open or the sale records are full
+bool engine_checkout_shopping_cart(RetailEngine &engine, const unsigned int whichCart, unsigned long long &totalAmount)
+{
+    shared_lock<shared_mutex> reader(engine.lock);
+    if (!shopping_cart_table_is_open(*engine.shoppingCartTable, whichCart))
+        return false;
+    ShoppingCart *shoppingCart = shopping_cart_table_get(*engine.shoppingCartTable, whichCart);
+    lock_guard<mutex> cartLock(shoppingCart->lock);
+    return ll_checkout_shopping_cart(*shoppingCart, totalAmount);
+}
+
+const int IO_CHUNK_SIZE = 1 << 20;    // number of characters read or written at once in batch mode
+const int PRINT_CHUNK_SIZE = 1 << 16; // number of characters written at once by ll_print_all
+const int MAX_TITLE_MATCHES = 100;    // at most 100 matches of a title search are displayed
+
+// A reader of a command stream, refilled from an istream in chunks of IO_CHUNK_SIZE
+struct InputBuffer
+{
+    istream *in;   // The stream the commands are read from
+    char *chars;   // The characters read so far and not consumed
+    int length;    // The number of characters in chars
+    int position;  // The position of the next character to consume
+};
+
+// A writer of the messages of batch mode, written to an ostream in chunks of capacity characters
+struct OutputBuffer
+{
+    ostream *out;       // The stream the messages are written to
+    char *chars;        // The messages not written yet
+    int length;         // The number of characters in chars
+    OperationLog *log;  // The log committed before the messages are written, so no operation is reported before it is durable (or nullptr)
+    int capacity;       // The size of chars
+};
+
+// Return the next character without consuming it, or -1 at the end of the stream
+int input_peek(InputBuffer &input)
+{
+    if (input.position == input.length)
+    {
+        input.in->read(input.chars, IO_CHUNK_SIZE);
+        input.length = input.in->gcount();
+        input.position = 0;
+        if (input.length == 0)
+            return -1;
+    }
+    return static_cast<unsigned char>(input.chars[input.position]);
+}
+
+// Consume the rest of the current line, including the newline character
+void input_skip_line(InputBuffer &input)
+{
+    int c;
+    while ((c = input_peek(input)) != -1)
+    {
+        input.position++;
+        if (c == '\n')
+            break;
+    }
+}
+
+// Read the next token of the current line into token
+// return true if a token of at most maxLength - 1 characters is read
+// return false if the line has no more tokens, or the token is too long
+bool input_next_token(InputBuffer &input, char *token, const int maxLength)
+{
+    int c;
+    while ((c = input_peek(input)) == ' ' || c == '\t' || c == '\r')
+        input.position++;
+
+    int length = 0;
+    while ((c = input_peek(input)) != -1 && c != ' ' && c != '\t' && c != '\r' && c != '\n')
+    {
+        if (length < maxLength - 1)
+            token[length] = c;
+        length++;
+        input.position++;
+    }
+    if (length == 0 || length > maxLength - 1)
+        return false;
+    token[length] = '\0';
+    return true;
+}
+
+// Convert a text of decimal digits to an unsigned int
+bool parse_number(const char *text, unsigned int &number)
+{
+    unsigned long long value = 0;
+    if (text[0] == '\0')
+        return false;
+    for (int i = 0; text[i] != '\0'; i++)
+    {
+        if (text[i] < '0' || text[i] > '9')
+            return false;
+        value = value * 10 + (text[i] - '0');
+        if (value > 0xffffffffULL)
+            return false;
+    }
+    number = value;
+    return true;
+}
+
+// Read the next token of the current line as an unsigned int
+bool input_next_number(InputBuffer &input, unsigned int &number)
+{
+    char token[MAX_ID + 1];
+    if (!input_next_token(input, token, MAX_ID + 1))
+        return false;
+    return parse_number(token, number);
+}
+
+// Read the next field of a CSV row into field, and consume the comma after it
+// A field ends at a comma or at the end of the line, and may be quoted with " (a "" inside stands for ")
+// return true if the field has at most maxLength - 1 characters, the rest of a longer field is skipped
+// more is set to true if another field of the row follows
+bool input_next_csv_field(InputBuffer &input, char *field, const int maxLength, bool &more)
+{
+    int c;
+    int length = 0;
+    bool quoted = (input_peek(input) == '"');
+    if (quoted)
+        input.position++;
+    while ((c = input_peek(input)) != -1)
+    {
+        if (quoted && c == '"')
+        {
+            input.position++;
+            if (input_peek(input) != '"')
+            {
+                quoted = false; // the closing quote
+                continue;
+            }
+        }
+        else if (!quoted && (c == ',' || c == '\n'))
+            break;
+        if (c != '\r' || quoted)
+        {
+            if (length < maxLength - 1)
+                field[length] = c;
+            length++;
+        }
+        input.position++;
+    }
+    more = (c == ',');
+    if (more)
+        input.position++;
+    field[(length < maxLength) ? length : maxLength - 1] = '\0';
+    return length < maxLength;
+}
+
+// Write the messages, once the operations they report are durable
+// The messages are dropped if the log cannot be committed, as their operations are not saved (see log_commit)
+void output_flush(OutputBuffer &output)
+{
+    if (output.log == nullptr || log_commit(*output.log))
+        output.out->write(output.chars, output.length);
+    output.length = 0;
+}
+
+void output_append(OutputBuffer &output, const char *text)
+{
+    int length = strlen(text);
+    while (output.length + length > output.capacity)
+    {
+        int part = output.capacity - output.length;
+        memcpy(output.chars + output.length, text, part);
+        output.length += part;
+        output_flush(output);
+        text += part;
+        length -= part;
+    }
+    memcpy(output.chars + output.length, text, length);
+    output.length += length;
+}
+
+void output_append_number(OutputBuffer &output, unsigned long long number)
+{
+    char digits[21];
+    int i = sizeof(digits) - 1;
+    digits[i] = '\0';
+    do
+    {
+        digits[--i] = '0' + number % 10;
+        number /= 10;
+    } while (number > 0);
+    output_append(output, &digits[i]);
+}
+
+// Append a price in cents as $X.YY
+void output_append_price(OutputBuffer &output, const unsigned long long priceInCents)
+{
+    char cents[3] = {static_cast<char>('0' + priceInCents % 100 / 10), static_cast<char>('0' + priceInCents % 10), '\0'};
+    output_append(output, "$");
+    output_append_number(output, priceInCents / 100);
+    output_append(output, ".");
+    output_append(output, cents);
+}
+
+// Display the lists, formatted into a buffer on the stack and written out in chunks of PRINT_CHUNK_SIZE
+// instead of one stream operation per field, with the same output as formatting each field with cout
+void ll_print_all(const StockItem *stockItemHead, const ShoppingCartTable *shoppingCartTable)
+{
+    StatsTimer timer(STATS_PRINT_ALL);
+    const StockItem *p;
+    const ShoppingCartItem *c;
+    int count;
+    unsigned int i;
+    char chars[PRINT_CHUNK_SIZE];
+    OutputBuffer output = {&cout, chars, 0, nullptr, PRINT_CHUNK_SIZE};
+    output_append(output, "=== StockItem List (id[price]) ===\n");
+    count = 0;
+    for (p = stockItemHead; p != nullptr; p = p->next)
+    {
+        output_append(output, p->id);
+        output_append(output, "[");
+        output_append_price(output, p->priceInCents);
+        output_append(output, "]");
+        if (p->next != nullptr)
+            output_append(output, " -> ");
+        count++;
+    }
+    if (count == 0)
+    {
+        output_append(output, "No items in the StockItem list");
+    }
+    output_append(output, "\n");
+
+    output_append(output, "=== StockItem titles ===\n");
+    count = 0;
+    for (p = stockItemHead; p != nullptr; p = p->next)
+    {
+        output_append(output, p->id);
+        output_append(output, ": ");
+        output_append(output, p->title);
+        output_append(output, "\n");
+        count++;
+    }
+    if (count == 0)
+    {
+        output_append(output, "No StockItem titles\n");
+    }
+
+    output_append(output, "=== Shopping carts ===\n");
+    if (shoppingCartTable != nullptr)
+    {
+        for (i = 0; i < shoppingCartTable->numOfCarts; i++)
+        {
+            if (!shopping_cart_table_is_open(*shoppingCartTable, i))
+                continue;
+            count = 0;
+            output_append(output, "Cart ");
+            output_append_number(output, i);
+            output_append(output, ": ");
+            const CartLines &lines = shopping_cart_table_get(*shoppingCartTable, i)->lines;
+            for (CartLines::Position l = sorted_first(lines); !sorted_is_end(lines, l); l = sorted_next(lines, l))
+            {
+                c = sorted_node(lines, l);
+                if (count > 0)
+                    output_append(output, ", "); // except before the first item, print a comma
+                output_append(output, c->item->id);
+                output_append(output, ": ");
+                output_append_number(output, c->quantity);
+                count++;
+            }
+            if (count == 0)
+            {
+                output_append(output, "No items in the shopping cart\n");
+            }
+            else
+            {
+                output_append(output, "\n");
+            }
+        }
+    }
+    output_flush(output);
+    cout.flush();
+}
+
+// Display a page of StockItems listed by ll_list_stock_items
+void ll_print_stock_item_page(const StockItem *page[], const unsigned int numOfItems, const char nextId[MAX_ID], OutputBuffer &output)
+{
+    for (unsigned int i = 0; i < numOfItems; i++)
+    {
+        output_append(output, page[i]->id);
+        output_append(output, "[");
+        output_append_price(output, page[i]->priceInCents);
+        output_append(output, "]: ");
+        output_append(output, page[i]->title);
+        output_append(output, "\n");
+    }
+    if (numOfItems == 0)
+        output_append(output, "No items in the range\n");
+    if (nextId[0] != '\0')
+    {
+        output_append(output, "Next page from ");
+        output_append(output, nextId);
+        output_append(output, "\n");
+    }
+}
+
+// Display the matches of ll_search_stock_item_titles
+// keyword is the one given by the user, a keyword beginning with ^ is searched at the beginning of the titles
+void ll_print_stock_item_title_search(StockItem *stockItemHead, const char keyword[MAX_TITLE], OutputBuffer &output)
+{
+    const StockItem *matches[MAX_TITLE_MATCHES + 1];
+    bool atStart = (keyword[0] == '^');
+    unsigned int numOfMatches = ll_search_stock_item_titles(stockItemHead, keyword + atStart, atStart, matches, MAX_TITLE_MATCHES + 1);
+    if (numOfMatches == 0)
+        output_append(output, "No items found\n");
+    for (unsigned int i = 0; i < numOfMatches && i < MAX_TITLE_MATCHES; i++)
+    {
+        output_append(output, matches[i]->id);
+        output_append(output, "[");
+        output_append_price(output, matches[i]->priceInCents);
+        output_append(output, "]: ");
+        output_append(output, matches[i]->title);
+        output_append(output, "\n");
+    }
+    if (numOfMatches > MAX_TITLE_MATCHES)
+    {
+        output_append(output, "Only the first ");
+        output_append_number(output, MAX_TITLE_MATCHES);
+        output_append(output, " matches are shown\n");
+    }
+}
+
+// Display the count and the p50, p99 and p999 of every operation recorded so far, summed over all the threads
+// A percentile is given as the greatest value of its histogram bucket, the latencies are the sampled ones
+// Helper function: display the p50, p99 and p999 of a histogram, each as the greatest value of its bucket
+void stats_append_percentiles(OutputBuffer &output, const unsigned long long counts[STATS_BUCKETS], const char *unit)
+{
+    const unsigned int permilles[] = {500, 990, 999};
+    const char *percentileNames[] = {", p50 ", ", p99 ", ", p999 "};
+    unsigned long long numOfRecorded = 0;
+    for (int bucket = 0; bucket < STATS_BUCKETS; bucket++)
+        numOfRecorded += counts[bucket];
+    for (int i = 0; i < 3 && numOfRecorded > 0; i++)
+    {
+        // the bucket of the value ranked ceil(numOfRecorded * permille / 1000)
+        unsigned long long rank = (numOfRecorded * permilles[i] + 999) / 1000;
+        unsigned long long numOfSeen = 0;
+        int bucket = 0;
+        while ((numOfSeen += counts[bucket]) < rank)
+            bucket++;
+        output_append(output, percentileNames[i]);
+        output_append_number(output, stats_bucket_limit(bucket));
+        output_append(output, unit);
+    }
+}
+
+void stats_print(OutputBuffer &output)
+{
+    bool recorded = false;
+    for (int operation = 0; operation < NUM_STATS_OPERATIONS; operation++)
+    {
+        unsigned long long counts[STATS_BUCKETS] = {};
+        unsigned long long numOfOperations = 0;
+        for (StatsRecord *record = statsRecords.load(memory_order_acquire); record != nullptr; record = record->next)
+        {
+            numOfOperations += record->numOfOperations[operation].load(memory_order_relaxed);
+            for (int bucket = 0; bucket < STATS_BUCKETS; bucket++)
+                counts[bucket] += record->counts[operation][bucket].load(memory_order_relaxed);
+        }
+        if (numOfOperations == 0)
+            continue;
+        recorded = true;
+
+        output_append(output, statsOperationNames[operation]);
+        output_append(output, ": count ");
+        output_append_number(output, numOfOperations);
+        stats_append_percentiles(output, counts, (operation >= STATS_STOCK_ITEM_WALK) ? " nodes" : " ns");
+        output_append(output, "\n");
+    }
+    if (!recorded)
+        output_append(output, "No operations are recorded\n");
+}
+
+// Write the statistics displayed by stats_print to a file
+bool stats_save(const char *fileName)
+{
+    ofstream out(fileName);
+    if (!out)
+        return false;
+    OutputBuffer output = {&out, new char[IO_CHUNK_SIZE], 0, nullptr, IO_CHUNK_SIZE};
+    stats_print(output);
+    output_flush(output);
+    delete[] output.chars;
+    return out.good();
+}
+
+// Display the units on hand and the reserved units of a StockItem
+void ll_print_stock_item_inventory(const StockItem *stockItem, OutputBuffer &output)
+{
+    unsigned int onHand, reserved;
+    output_append(output, stockItem->id);
+    if (!inventory_get(stockItem, onHand, reserved))
+    {
+        output_append(output, ": not tracked\n");
+        return;
+    }
+    output_append(output, ": ");
+    output_append_number(output, onHand);
+    output_append(output, " on hand, ");
+    output_append_number(output, reserved);
+    output_append(output, " reserved\n");
+}
+
+// Display the totals of a report and its top stock items by revenue (numOfTopSkus of them at most)
+void sales_print_report(const SalesReport &report, const unsigned int numOfTopSkus, OutputBuffer &output)
+{
+    output_append(output, "Sales of the day: ");
+    output_append_number(output, report.numOfCheckouts);
+    output_append(output, " checkouts, ");
+    output_append_number(output, report.lastLine - report.firstLine);
+    output_append(output, " lines, ");
+    output_append_number(output, report.units);
+    output_append(output, " units, ");
+    output_append_price(output, report.revenue);
+    output_append(output, "\n");
+    for (unsigned int i = 0; i < numOfTopSkus && i < report.numOfSkus; i++)
+    {
+        output_append_number(output, i + 1);
+        output_append(output, ". ");
+        output_append(output, sales_sku_id(report.skuTotals[i].sku));
+        output_append(output, ": ");
+        output_append_number(output, report.skuTotals[i].units);
+        output_append(output, " units, ");
+        output_append_price(output, report.skuTotals[i].revenue);
+        output_append(output, "\n");
+    }
+}
+
+// Write the totals of every stock item of a report as CSV id,units,revenue rows (the revenue in cents)
+bool sales_save_report(const SalesReport &report, const char *fileName)
+{
+    ofstream out(fileName);
+    if (!out)
+        return false;
+    OutputBuffer output = {&out, new char[IO_CHUNK_SIZE], 0, nullptr, IO_CHUNK_SIZE};
+    output_append(output, "id,units,revenue\n");
+    for (unsigned int i = 0; i < report.numOfSkus; i++)
+    {
+        output_append(output, sales_sku_id(report.skuTotals[i].sku));
+        output_append(output, ",");
+        output_append_number(output, report.skuTotals[i].units);
+        output_append(output, ",");
+        output_append_number(output, report.skuTotals[i].revenue);
+        output_append(output, "\n");
+    }
+    output_flush(output);
+    delete[] output.chars;
+    return out.good();
+}
+
+// End the day: display the sales of the day with its top stock items by revenue,
+// write the totals of every stock item of the day to a file (unless fileName is nullptr),
+// and start a new day
+void sales_end_day(const unsigned int numOfTopSkus, const char *fileName, OutputBuffer &output)
+{
+    SalesReport report;
+    sales_aggregate(report, (fileName != nullptr) ? ~0U : numOfTopSkus);
+    sales_print_report(report, numOfTopSkus, output);
+    if (fileName != nullptr && !sales_save_report(report, fileName))
+    {
+        output_append(output, "Failed to write the sales to ");
+        output_append(output, fileName);
+        output_append(output, "\n");
+    }
+    sales_start_day(report.lastLine); // the next report begins where this one ended
+    delete[] report.skuTotals;
+}
+
+// Helper function: a - given for the first id, the last id or the prefix of a range means no limit
+void stock_item_range_clear_dashes(StockItemRange &range)
+{
+    if (strcmp(range.firstId, "-") == 0)
+        range.firstId[0] = '\0';
+    if (strcmp(range.lastId, "-") == 0)
+        range.lastId[0] = '\0';
+    if (strcmp(range.prefix, "-") == 0)
+        range.prefix[0] = '\0';
+}
+
+// A row of a CSV file of stock items, waiting to be merged into the list
+struct ImportRow
+{
+    unsigned long long key;    // id encoded by encode_id_key
+    char id[MAX_ID];           // StockItem::id
+    unsigned int priceInCents; // StockItem::priceInCents
+    const char *title;         // StockItem::title, already interned in the TitlePool
+};
+
+// Helper function: the order of the rows in the list
+bool import_row_before(const ImportRow &row, const ImportRow &other)
+{
+    return compare_id_key(row.key, row.id, other.key, other.id) < 0;
+}
+
+// Import the stock items of a CSV stream of id,title,price rows (the price in cents, a header row is skipped)
+// The rows are sorted and merged with the list in a single pass, and every skip list level is relinked on the way,
+// instead of searching the list once per row. As with ll_insert_stock_item, a row whose id is already in the list
+// (or on an earlier row) is rejected with "Failed to insert <id>". Every inserted StockItem is logged.
+// return the number of StockItems inserted
+unsigned int ll_import_stock_items(StockItem *&stockItemHead, istream &in, OutputBuffer &output, OperationLog &log)
+{
+    StatsTimer timer(STATS_IMPORT_STOCK_ITEMS);
+    InputBuffer input = {&in, new char[IO_CHUNK_SIZE], 0, 0};
+    unsigned int capacity = 1024;
+    unsigned int numOfRows = 0;
+    ImportRow *rows = new ImportRow[capacity];
+    char title[MAX_TITLE];
+    char price[MAX_ID + 1];
+    unsigned int line = 0;
+    while (input_peek(input) != -1)
+    {
+        line++;
+        if (numOfRows == capacity)
+        {
+            ImportRow *grown = new ImportRow[capacity * 2];
+            memcpy(grown, rows, capacity * sizeof(ImportRow));
+            delete[] rows;
+            rows = grown;
+            capacity *= 2;
+        }
+        ImportRow &row = rows[numOfRows];
+        bool more = false;
+        bool valid = input_next_csv_field(input, row.id, MAX_ID, more) && more && row.id[0] != '\0' &&
+                     input_next_csv_field(input, title, MAX_TITLE, more) && more && title[0] != '\0' &&
+                     input_next_csv_field(input, price, sizeof(price), more) && !more &&
+                     parse_number(price, row.priceInCents) && row.priceInCents > 0;
+        input_skip_line(input);
+        if (!valid)
+        {
+            if (line > 1 && (row.id[0] != '\0' || more)) // the header row and blank lines are skipped quietly
+            {
+                output_append(output, "Invalid row ");
+                output_append_number(output, line);
+                output_append(output, "\n");
+            }
+            continue;
+        }
+        row.key = encode_id_key(row.id);
+        row.title = title_pool_intern(title);
+        numOfRows++;
+    }
+    delete[] input.chars;
+
+    // a stable sort keeps the first of the rows with the same id first
+    stable_sort(rows, rows + numOfRows, import_row_before);
+
+    // merge the rows with the list, appending every StockItem to the last StockItem of each of its levels
+    StockItem *oldHead = stockItemHead;
+    StockItem *old = stockItemHead;
+    StockItem *last[MAX_SKIP_LEVEL];
+    unsigned int numOfInserted = 0;
+    unsigned int i = 0;
+    stockItemHead = nullptr;
+    while (old != nullptr || i < numOfRows)
+    {
+        StockItem *stockItem;
+        int cmp = (old == nullptr) ? -1 : (i == numOfRows) ? 1 : compare_id_key(rows[i].key, rows[i].id, old->key, old->id);
+        if (cmp < 0 && stockItemHead != nullptr && compare_id_key(rows[i].key, rows[i].id, last[0]->key, last[0]->id) == 0)
+            cmp = 0; // the same id as the row just inserted
+        if (cmp == 0)
+        {
+            title_pool_release(rows[i].title);
+            output_append(output, "Failed to insert ");
+            output_append(output, rows[i].id);
+            output_append(output, "\n");
+            i++;
+            continue;
+        }
+        if (cmp < 0)
+        {
+            stockItem = ll_create_stock_item_with_stored_title(rows[i].id, rows[i].title, rows[i].priceInCents);
+            ll_resize_stock_item_levels(stockItem, (stockItemHead == nullptr) ? MAX_SKIP_LEVEL : ll_random_stock_item_level());
+            log_append(log, LOG_INSERT_STOCK_ITEM, 0, rows[i].priceInCents, rows[i].id, rows[i].title);
+            numOfInserted++;
+            i++;
+        }
+        else
+        {
+            stockItem = old;
+            old = old->next;
+            // the head is linked into all levels, and only the head
+            if (stockItemHead == nullptr && stockItem->level != MAX_SKIP_LEVEL)
+                ll_resize_stock_item_levels(stockItem, MAX_SKIP_LEVEL);
+            else if (stockItemHead != nullptr && stockItem == oldHead && stockItem->level == MAX_SKIP_LEVEL)
+                ll_resize_stock_item_levels(stockItem, ll_random_stock_item_level());
+        }
+        for (int j = 0; j < stockItem->level; j++)
+        {
+            if (stockItemHead != nullptr)
+                ll_next_stock_item(last[j], j) = stockItem;
+            last[j] = stockItem;
+        }
+        if (stockItemHead == nullptr)
+            stockItemHead = stockItem;
+    }
+    if (stockItemHead != nullptr)
+    {
+        for (int j = 0; j < MAX_SKIP_LEVEL; j++)
+            ll_next_stock_item(last[j], j) = nullptr;
+    }
+    delete[] rows;
+    return numOfInserted;
+}
+
+// Update the prices of StockItems from a CSV stream of id,price rows (the price in cents, a header row is skipped)
+// All the StockItems are found first in a single walk of the list (see ll_find_price_updates), then the prices
+// are changed together and logged as one bulk update, so a crash never leaves only some of them changed.
+// As with ll_update_stock_item_price, a missing id is reported with "Failed to update the price of <id>".
+// return the number of prices updated
+unsigned int ll_bulk_update_stock_item_prices(StockItem *stockItemHead, istream &in, OutputBuffer &output, OperationLog &log)
+{
+    StatsTimer timer(STATS_BULK_UPDATE_PRICES);
+    InputBuffer input = {&in, new char[IO_CHUNK_SIZE], 0, 0};
+    unsigned int capacity = 1024;
+    unsigned int numOfUpdates = 0;
+    PriceUpdate *updates = new PriceUpdate[capacity];
+    char price[MAX_ID + 1];
+    unsigned int line = 0;
+    while (input_peek(input) != -1)
+    {
+        line++;
+        if (numOfUpdates == capacity)
+        {
+            PriceUpdate *grown = new PriceUpdate[capacity * 2];
+            memcpy(grown, updates, capacity * sizeof(PriceUpdate));
+            delete[] updates;
+            updates = grown;
+            capacity *= 2;
+        }
+        PriceUpdate &update = updates[numOfUpdates];
+        bool more = false;
+        bool valid = input_next_csv_field(input, update.id, MAX_ID, more) && more && update.id[0] != '\0' &&
+                     input_next_csv_field(input, price, sizeof(price), more) && !more &&
+                     parse_number(price, update.priceInCents) && update.priceInCents > 0;
+        input_skip_line(input);
+        if (!valid)
+        {
+            if (line > 1 && (update.id[0] != '\0' || more)) // the header row and blank lines are skipped quietly
+            {
+                output_append(output, "Invalid row ");
+                output_append_number(output, line);
+                output_append(output, "\n");
+            }
+            continue;
+        }
+        update.key = encode_id_key(update.id);
+        numOfUpdates++;
+    }
+    delete[] input.chars;
+
+    // only the updates applied are logged, an update that would overflow a total amount fails like a missing id
+    ll_find_price_updates(stockItemHead, updates, numOfUpdates);
+    unsigned int numOfApplied = ll_apply_price_updates(updates, numOfUpdates);
+    if (numOfApplied > 0)
+        log_append(log, LOG_UPDATE_STOCK_ITEM_PRICES, 0, numOfApplied, "", "");
+    for (unsigned int i = 0; i < numOfUpdates; i++)
+    {
+        if (updates[i].stockItem != nullptr)
+        {
+            log_append(log, LOG_UPDATE_STOCK_ITEM_PRICE, 0, updates[i].priceInCents, updates[i].id, "");
+        }
+        else
+        {
+            output_append(output, "Failed to update the price of ");
+            output_append(output, updates[i].id);
+            output_append(output, "\n");
+        }
+    }
+    delete[] updates;
+    return numOfApplied;
+}
+
+// Add a scanned basket to a shopping cart with ll_add_basket_to_shopping_cart, and log every basket item added
+// As with ll_insert_or_add_stock_item_quantity, a missing id is reported with "Failed to insert/update <id>"
+// return the number of basket items added
+unsigned int ll_add_scanned_basket(ShoppingCart &shoppingCart, const unsigned int whichCart, StockItem *stockItemHead, BasketItem *basket, const unsigned int numOfItems, OutputBuffer &output, OperationLog &log)
+{
+    unsigned int numOfFound = ll_add_basket_to_shopping_cart(shoppingCart, stockItemHead, basket, numOfItems);
+    for (unsigned int i = 0; i < numOfItems; i++)
+    {
+        if (basket[i].stockItem != nullptr)
+        {
+            log_append(log, LOG_INSERT_OR_ADD_STOCK_ITEM, whichCart, basket[i].quantity, basket[i].id, "");
+            continue;
+        }
+        output_append(output, "Failed to insert/update ");
+        output_append(output, basket[i].id);
+        output_append(output, "\n");
+    }
+    output_append_number(output, numOfFound);
+    output_append(output, " stock items are successfully inserted/updated\n");
+    return numOfFound;
+}
+
+// Batch mode: apply a stream of commands, one command per line, without prompts
+// The first line is the number of shopping carts, and each following line is one of
+//   P                        Display the current lists
+//   I <id> <title> <price>   Insert a new stock item to the stock item list
+//   U <id> <price>           Update the price of the stock item
+//   A <cart> <id> <quantity> Insert/Add a number of stock items to a shopping cart
+//   R <cart> <id>            Remove an item from the shopping cart
+//   D <cart> <id> <quantity> Deduct a number of stock items from a shopping cart
+//   X <id>                   Remove an item from the stock item list
+//   C <cart>                 Checkout and clear a shopping cart
+//   O                        Open a new shopping cart
+//   K <cart>                 Close a shopping cart (not the last open one)
+//   S <file>                 Save the lists to a snapshot file
+//   L <file>                 Load the lists from a snapshot file
+//   M <file>                 Import stock items from a CSV file
+//   B <file>                 Update the prices of stock items from a CSV file
+//   G <first> <last> <prefix> <page size> [<next>]
+//                            List a page of at most MAX_PAGE_SIZE stock items (- for no first id, last id or prefix)
+//   T <keyword>              Search the stock items by title (^ before the keyword for the beginning of the titles)
+//   N <cart> <id> <quantity> [<id> <quantity> ...]
+//                            Add a scanned basket of stock items to a shopping cart
+//   H                        Display the operation statistics
+//   W <id> <quantity>        Restock a stock item (its stock is unlimited until the first restock)
+//   E <top n> [<file>]       End the day: display the sales of the day and its top n stock items by revenue,
+//                            and write the totals of every stock item of the day to a CSV file
+//   Q                        Exit the system (same as the end of the stream)
+// The same messages as the menu options are printed, buffered and flushed once at the end
+// With a log file, the log is replayed after the first line and every change is logged (see log_open),
+// and the batch stops once the log cannot be written (see log_commit)
+int run_batch(istream &in, ostream &out, const char *logFileName, const unsigned int commitBatchSize)
+{
+    StockItem *stockItemHead = nullptr;
+    ShoppingCartTable *shoppingCartTable = nullptr;
+    unsigned int numOfShoppingCart = 0;
+    unsigned int priceInCents = 0;
+    unsigned int quantity = 0;
+    unsigned int whichCart = 0;
+    unsigned long long totalAmount = 0;
+    char command[2] = "";
+    char id[MAX_ID] = "";
+    char title[MAX_TITLE] = "";
+    char fileName[MAX_FILE_NAME] = "";
+    StockItemRange range;
+    char nextId[MAX_ID] = "";
+    const StockItem **page = nullptr;
+    BasketItem *basket = new BasketItem[MAX_BASKET_ITEMS];
+    unsigned int numOfBasketItems = 0;
+    bool valid = false;
+    bool ret = false;
+
+    OperationLog log = {-1, "", nullptr, 0, 0, 0, false};
+    InputBuffer input = {&in, new char[IO_CHUNK_SIZE], 0, 0};
+    OutputBuffer output = {&out, new char[IO_CHUNK_SIZE], 0, &log, IO_CHUNK_SIZE};
+
+    if (!input_next_number(input, numOfShoppingCart) || numOfShoppingCart == 0 || numOfShoppingCart > MAX_NUM_SHOPPING_CARTS)
+    {
+        output_append(output, "Invalid number of shopping cart\n");
+        output_flush(output);
+        out.flush();
+        delete[] input.chars;
+        delete[] output.chars;
+        return 1;
+    }
+    input_skip_line(input);
+    shoppingCartTable = dynamic_init_shopping_cart_table(numOfShoppingCart);
+    if (logFileName != nullptr)
+    {
+        long numOfRecords = log_open(log, logFileName, commitBatchSize, stockItemHead, shoppingCartTable);
+        if (numOfRecords < 0)
+        {
+            output_append(output, "Failed to recover from ");
+            output_append(output, logFileName);
+            output_append(output, "\n");
+            output_flush(output);
+            out.flush();
+            log_close(log);
+            ll_cleanup(stockItemHead, shoppingCartTable);
+            delete[] input.chars;
+            delete[] output.chars;
+            return 1;
+        }
+        output_append_number(output, numOfRecords);
+        output_append(output, " operations are recovered from ");
+        output_append(output, logFileName);
+        output_append(output, "\n");
+    }
+
+    while (input_peek(input) != -1 && !log.failed)
+    {
+        if (!input_next_token(input, command, sizeof(command)))
+        {
+            // a blank line is skipped, anything else is not a command
+            int c = input_peek(input);
+            if (c != -1 && c != '\n')
+                output_append(output, "Invalid command\n");
+            input_skip_line(input);
+            continue;
+        }
+        if (command[0] == 'Q')
+            break;
+
+        // the cart of A, R, D, C, K and N comes first
+        if (command[0] == 'A' || command[0] == 'R' || command[0] == 'D' || command[0] == 'C' || command[0] == 'K' || command[0] == 'N')
+        {
+            if (!input_next_number(input, whichCart) || !shopping_cart_table_is_open(*shoppingCartTable, whichCart))
+            {
+                output_append(output, "Please enter a valid shopping cart ID\n");
+                input_skip_line(input);
+                continue;
+            }
+        }
+
+        valid = true;
+        switch (command[0])
+        {
+        case 'P':
+            // the display goes straight to out, after the messages before it
+            output_flush(output);
+            ll_print_all(stockItemHead, shoppingCartTable);
+            break;
+        case 'I':
+            valid = input_next_token(input, id, MAX_ID) && input_next_token(input, title, MAX_TITLE) &&
+                    input_next_number(input, priceInCents) && priceInCents > 0;
+            if (!valid)
+                break;
+            ret = ll_insert_stock_item(stockItemHead, id, title, priceInCents);
+            if (ret == false)
+            {
+                output_append(output, "Failed to insert ");
+                output_append(output, id);
+                output_append(output, "\n");
+            }
+            else
+            {
+                log_append(log, LOG_INSERT_STOCK_ITEM, 0, priceInCents, id, title);
+                output_append(output, id);
+                output_append(output, " is successfully inserted\n");
+            }
+            break;
+        case 'U':
+            valid = input_next_token(input, id, MAX_ID) && input_next_number(input, priceInCents) && priceInCents > 0;
+            if (!valid)
+                break;
+            ret = ll_update_stock_item_price(stockItemHead, id, priceInCents);
+            if (ret == false)
+            {
+                output_append(output, "Failed to update the price of ");
+                output_append(output, id);
+                output_append(output, "\n");
+            }
+            else
+            {
+                log_append(log, LOG_UPDATE_STOCK_ITEM_PRICE, 0, priceInCents, id, "");
+                output_append(output, id);
+                output_append(output, " price is updated\n");
+            }
+            break;
+        case 'A':
+            valid = input_next_token(input, id, MAX_ID) && input_next_number(input, quantity) && quantity > 0;
+            if (!valid)
+                break;
+            ret = ll_insert_or_add_stock_item_quantity(*shopping_cart_table_get(*shoppingCartTable, whichCart), stockItemHead, id, quantity);
+            if (ret == false)
+            {
+                output_append(output, "Failed to insert/update ");
+                output_append(output, id);
+                output_append(output, "\n");
+            }
+            else
+            {
+                log_append(log, LOG_INSERT_OR_ADD_STOCK_ITEM, whichCart, quantity, id, "");
+                output_append(output, id);
+                output_append(output, " is successfully inserted/updated\n");
+            }
+            break;
+        case 'D':
+            valid = input_next_token(input, id, MAX_ID) && input_next_number(input, quantity) && quantity > 0;
+            if (!valid)
+                break;
+            ret = ll_deduct_stock_item_quantity_from_shopping_cart(*shopping_cart_table_get(*shoppingCartTable, whichCart), id, quantity);
+            if (ret == false)
+            {
+                output_append(output, "Failed to deduct quantity ");
+                output_append(output, id);
+                output_append(output, "\n");
+            }
+            else
+            {
+                log_append(log, LOG_DEDUCT_STOCK_ITEM, whichCart, quantity, id, "");
+                output_append(output, "Quantity of ");
+                output_append(output, id);
+                output_append(output, " is successfully deducted\n");
+            }
+            break;
+        case 'R':
+            valid = input_next_token(input, id, MAX_ID);
+            if (!valid)
+                break;
+            ret = ll_remove_stock_item_from_shopping_cart(*shopping_cart_table_get(*shoppingCartTable, whichCart), id);
+            if (ret == false)
+            {
+                output_append(output, "Failed to remove goods ");
+                output_append(output, id);
+                output_append(output, "\n");
+            }
+            else
+            {
+                log_append(log, LOG_REMOVE_STOCK_ITEM_FROM_CART, whichCart, 0, id, "");
+                output_append(output, id);
+                output_append(output, " is successfully removed\n");
+            }
+            break;
+        case 'X':
+            valid = input_next_token(input, id, MAX_ID);
+            if (!valid)
+                break;
+            ret = ll_remove_stock_item(stockItemHead, id);
+            if (ret == false)
+            {
+                output_append(output, "Failed to remove ");
+                output_append(output, id);
+                output_append(output, " from the goods list\n");
+            }
+            else
+            {
+                log_append(log, LOG_REMOVE_STOCK_ITEM, 0, 0, id, "");
+                output_append(output, id);
+                output_append(output, " is removed from the goods list\n");
+            }
+            break;
+        case 'C':
+            if (!ll_checkout_shopping_cart(*shopping_cart_table_get(*shoppingCartTable, whichCart), totalAmount))
+            {
+                output_append(output, "The sale records are full, the shopping cart ");
+                output_append_number(output, whichCart);
+                output_append(output, " is not checked out\n");
+                break;
+            }
+            if (totalAmount > 0)
+            {
+                output_append(output, "Please pay for ");
+                output_append_price(output, totalAmount);
+                output_append(output, "\n");
+            }
+            else
+            {
+                output_append(output, "You don't need to pay!\n");
+            }
+            log_append(log, LOG_CLEAR_SHOPPING_CART, whichCart, 0, "", "");
+            output_append(output, "The shopping cart ");
+            output_append_number(output, whichCart);
+            output_append(output, " is cleared\n");
+            break;
+        case 'O':
+            whichCart = shopping_cart_table_open(*shoppingCartTable);
+            log_append(log, LOG_OPEN_SHOPPING_CART, whichCart, 0, "", "");
+            output_append(output, "The shopping cart ");
+            output_append_number(output, whichCart);
+            output_append(output, " is opened\n");
+            break;
+        case 'K':
+            if (!shopping_cart_table_close(*shoppingCartTable, whichCart))
+            {
+                output_append(output, "The last open shopping cart cannot be closed\n");
+                break;
+            }
+            log_append(log, LOG_CLOSE_SHOPPING_CART, whichCart, 0, "", "");
+            output_append(output, "The shopping cart ");
+            output_append_number(output, whichCart);
+            output_append(output, " is closed\n");
+            break;
+        case 'S':
+            valid = input_next_token(input, fileName, MAX_FILE_NAME);
+            if (!valid)
+                break;
+            ret = snapshot_save(fileName, stockItemHead, shoppingCartTable) && log_checkpoint(log, fileName);
+            output_append(output, ret ? "The lists are saved to " : "Failed to save ");
+            output_append(output, fileName);
+            output_append(output, "\n");
+            break;
+        case 'L':
+            valid = input_next_token(input, fileName, MAX_FILE_NAME);
+            if (!valid)
+                break;
+            ret = snapshot_load(fileName, stockItemHead, shoppingCartTable);
+            if (ret && !log_checkpoint(log, fileName))
+                log.failed = true; // the log does not hold the loaded lists
+            output_append(output, ret ? "The lists are loaded from " : "Failed to load ");
+            output_append(output, fileName);
+            output_append(output, "\n");
+            break;
+        case 'M':
+            valid = input_next_token(input, fileName, MAX_FILE_NAME);
+            if (!valid)
+                break;
+            {
+                ifstream csv(fileName, ios::binary);
+                if (!csv)
+                {
+                    output_append(output, "Failed to open ");
+                    output_append(output, fileName);
+                    output_append(output, "\n");
+                    break;
+                }
+                output_append_number(output, ll_import_stock_items(stockItemHead, csv, output, log));
+                output_append(output, " stock items are imported from ");
+                output_append(output, fileName);
+                output_append(output, "\n");
+            }
+            break;
+        case 'B':
+            valid = input_next_token(input, fileName, MAX_FILE_NAME);
+            if (!valid)
+                break;
+            {
+                ifstream csv(fileName, ios::binary);
+                if (!csv)
+                {
+                    output_append(output, "Failed to open ");
+                    output_append(output, fileName);
+                    output_append(output, "\n");
+                    break;
+                }
+                output_append_number(output, ll_bulk_update_stock_item_prices(stockItemHead, csv, output, log));
+                output_append(output, " prices are updated from ");
+                output_append(output, fileName);
+                output_append(output, "\n");
+            }
+            break;
+        case 'G':
+            valid = input_next_token(input, range.firstId, MAX_ID) && input_next_token(input, range.lastId, MAX_ID) &&
+                    input_next_token(input, range.prefix, MAX_ID) && input_next_number(input, quantity) && quantity > 0 && quantity <= MAX_PAGE_SIZE;
+            if (!valid)
+                break;
+            if (!input_next_token(input, id, MAX_ID))
+                id[0] = '\0';
+            stock_item_range_clear_dashes(range);
+            page = new const StockItem *[quantity];
+            ll_print_stock_item_page(page, ll_list_stock_items(stockItemHead, range, id, quantity, page, nextId), nextId, output);
+            delete[] page;
+            break;
+        case 'T':
+            valid = input_next_token(input, title, MAX_TITLE);
+            if (valid)
+                ll_print_stock_item_title_search(stockItemHead, title, output);
+            break;
+        case 'H':
+            stats_print(output);
+            break;
+        case 'W':
+            valid = input_next_token(input, id, MAX_ID) && input_next_number(input, quantity) && quantity > 0;
+            if (!valid)
+                break;
+            ret = ll_restock_stock_item(stockItemHead, id, quantity);
+            if (ret == false)
+            {
+                output_append(output, "Failed to restock ");
+                output_append(output, id);
+                output_append(output, "\n");
+            }
+            else
+            {
+                log_append(log, LOG_RESTOCK_STOCK_ITEM, 0, quantity, id, "");
+                output_append(output, id);
+                output_append(output, " is restocked\n");
+                ll_print_stock_item_inventory(ll_search_stock_item(stockItemHead, id), output);
+            }
+            break;
+        case 'E':
+            valid = input_next_number(input, quantity);
+            if (!valid)
+                break;
+            sales_end_day(quantity, input_next_token(input, fileName, MAX_FILE_NAME) ? fileName : nullptr, output);
+            log_append(log, LOG_END_DAY, 0, 0, "", "");
+            break;
+        case 'N':
+            numOfBasketItems = 0;
+            while (numOfBasketItems < MAX_BASKET_ITEMS && input_next_token(input, basket[numOfBasketItems].id, MAX_ID))
+            {
+                valid = input_next_number(input, basket[numOfBasketItems].quantity) && basket[numOfBasketItems].quantity > 0;
+                if (!valid)
+                    break;
+                basket[numOfBasketItems].key = encode_id_key(basket[numOfBasketItems].id);
+                numOfBasketItems++;
+            }
+            // the basket must end at the end of the line
+            valid = valid && numOfBasketItems > 0 && (input_peek(input) == '\n' || input_peek(input) == -1);
+            if (valid)
+                ll_add_scanned_basket(*shopping_cart_table_get(*shoppingCartTable, whichCart), whichCart, stockItemHead, basket, numOfBasketItems, output, log);
+            break;
+        default:
+            valid = false;
+            break;
+        }
+        if (!valid)
+            output_append(output, "Invalid command\n");
+        input_skip_line(input);
+    }
+
+    output_flush(output);
+    bool logFailed = log.failed;
+    if (logFailed)
+        out << "Failed to write to " << logFileName << ", the operations after the last durable one are lost\n";
+    out.flush();
+    log_close(log);
+    ll_cleanup(stockItemHead, shoppingCartTable);
+    sales_release_all();
+    delete[] basket;
+    delete[] input.chars;
+    delete[] output.chars;
+    return logFailed ? 1 : 0;
+}
+
+// === Benchmark ===
+// A seeded synthetic retail workload driven through the ll_* functions.
+// The trace is generated before it is run and depends on the BenchConfig only,
+// so two builds (or two data structures) run the same operations and must print the same checksum.
+// The popularity of the stock items follows a Zipf distribution, scattered over the ids by a seeded permutation,
+// and every shopping cart is filled up to its own number of lines (cartSize on average) and then checked out
+struct BenchConfig
+{
+    unsigned long long seed;      // The seed of the trace
+    unsigned int numOfStockItems; // The number of stock items in the catalog
+    unsigned int numOfCarts;      // The number of shopping carts filled at the same time
+    unsigned int cartSize;        // The average number of lines of a shopping cart at checkout
+    unsigned int numOfOperations; // The number of operations in the trace
+    double zipfExponent;          // The skew of the popularity of the stock items (0 for uniform)
+    unsigned int deductPercent;   // The percentage of the operations deducting a line of a shopping cart
+    unsigned int churnPercent;    // The percentage of the operations removing a stock item and inserting it again
+    unsigned int numOfTills;      // The threads of the contention benchmark (0 to run the trace instead, see bench_run_contention)
+    unsigned int numOfHotSkus;    // The stock items all the tills of the contention benchmark add to their shopping carts
+};
+
+// The benchmark run by --bench (see main)
+enum BenchMode
+{
+    BENCH_MODE_TRACE = 0,     // bench_run, or bench_run_contention with tills
+    BENCH_MODE_CONTAINERS,    // bench_run_containers
+    BENCH_MODE_ENGINE,        // bench_run_engine
+    BENCH_MODE_READERS,       // bench_run_readers
+    BENCH_MODE_SKIP_LIST,     // bench_run_skip_list
+    BENCH_MODE_KEYS,          // bench_run_keys
+    BENCH_MODE_REVERSE_INDEX, // bench_run_reverse_index
+    BENCH_MODE_PRINT,         // bench_run_print
+    BENCH_MODE_BASKET,        // bench_run_basket
+    BENCH_MODE_TOTALS,        // bench_run_totals
+    BENCH_MODE_RECOVERY       // bench_run_recovery
+};
+
+enum BenchOperationType
+{
+    BENCH_INSERT_OR_ADD = 0, // ll_insert_or_add_stock_item_quantity
+    BENCH_DEDUCT,            // ll_deduct_stock_item_quantity_from_shopping_cart
+    BENCH_CHECKOUT,          // ll_checkout_shopping_cart
+    BENCH_REMOVE_STOCK_ITEM, // ll_remove_stock_item
+    BENCH_INSERT_STOCK_ITEM, // ll_insert_stock_item
+    NUM_BENCH_OPERATION_TYPES
+};
+
+const char *benchOperationNames[NUM_BENCH_OPERATION_TYPES] = {
+    "insert/add",
+    "deduct",
+    "checkout",
+    "remove stock item",
+    "insert stock item"};
+
+// An operation of a trace
+struct BenchOperation
+{
+    BenchOperationType type;
+    unsigned int whichCart; // The shopping cart of an insert/add, a deduct or a checkout
+    unsigned int stockItem; // The number of the stock item in the catalog
+    unsigned int quantity;  // The quantity of an insert/add or a deduct
+};
+
+// Helper function: the next number of a xorshift64* generator, the same on every platform
+unsigned long long bench_random(unsigned long long &state)
+{
+    state ^= state >> 12;
+    state ^= state << 25;
+    state ^= state >> 27;
+    return state * 2685821657736338717ULL;
+}
+
+// Helper function: a random number in [0, bound)
+unsigned int bench_random_below(unsigned long long &state, const unsigned int bound)
+{
+    return (bench_random(state) >> 32) % bound;
+}
+
+// Helper function: the id of a stock item of the catalog (at most 10^8 of them), e.g., s00000042
+void bench_stock_item_id(const unsigned int stockItem, char id[MAX_ID])
+{
+    snprintf(id, MAX_ID, "s%08u", stockItem % 100000000);
+}
+
+// Helper function: the price of a stock item of the catalog, between $0.99 and $100.98
+unsigned int bench_stock_item_price(const BenchConfig &config, const unsigned int stockItem)
+{
+    unsigned long long state = (config.seed ^ (0x9E3779B97F4A7C15ULL * (stockItem + 1))) | 1;
+    return 99 + bench_random_below(state, 10000);
+}
+
+// Helper function: the number of lines a shopping cart is checked out at, in [1, 2 * cartSize - 1]
+unsigned int bench_cart_target(const BenchConfig &config, unsigned long long &state)
+{
+    return 1 + bench_random_below(state, 2 * config.cartSize - 1);
+}
+
+// Generate the trace of a config into operations (config.numOfOperations of them)
+// and the order the catalog is inserted in before the trace is run into catalog (config.numOfStockItems of them)
+// The lines of every shopping cart are tracked, so every deduct and every checkout of the trace succeeds
+void bench_generate(const BenchConfig &config, BenchOperation operations[], unsigned int catalog[])
+{
+    unsigned long long state = (config.seed * 0x9E3779B97F4A7C15ULL) | 1;
+    const unsigned int numOfStockItems = config.numOfStockItems;
+    const unsigned int maxLines = 2 * config.cartSize - 1;
+
+    // the popularity rank of each stock item, a seeded permutation, also the order the catalog is inserted in
+    for (unsigned int i = 0; i < numOfStockItems; i++)
+        catalog[i] = i;
+    for (unsigned int i = numOfStockItems - 1; i > 0; i--)
+        swap(catalog[i], catalog[bench_random_below(state, i + 1)]);
+
+    // the cumulative Zipf distribution of the ranks, searched by a binary search
+    double *cumulative = new double[numOfStockItems];
+    double sum = 0;
+    for (unsigned int i = 0; i < numOfStockItems; i++)
+    {
+        sum += 1.0 / pow(i + 1.0, config.zipfExponent);
+        cumulative[i] = sum;
+    }
+
+    unsigned int *lineStockItems = new unsigned int[config.numOfCarts * maxLines]; // the lines of cart c start at c * maxLines
+    unsigned int *lineQuantities = new unsigned int[config.numOfCarts * maxLines];
+    unsigned int *numOfLines = new unsigned int[config.numOfCarts];
+    unsigned int *targets = new unsigned int[config.numOfCarts];
+    for (unsigned int c = 0; c < config.numOfCarts; c++)
+    {
+        numOfLines[c] = 0;
+        targets[c] = bench_cart_target(config, state);
+    }
+
+    unsigned int n = 0;
+    while (n < config.numOfOperations)
+    {
+        unsigned int whichCart = bench_random_below(state, config.numOfCarts);
+        unsigned int *lines = lineStockItems + whichCart * maxLines;
+        unsigned int *quantities = lineQuantities + whichCart * maxLines;
+        unsigned int percent = bench_random_below(state, 100);
+
+        if (percent < config.churnPercent && n + 2 <= config.numOfOperations)
+        {
+            // a stock item is discontinued and listed again, the shopping carts holding it lose their line
+            unsigned int stockItem = bench_random_below(state, numOfStockItems);
+            operations[n++] = {BENCH_REMOVE_STOCK_ITEM, 0, stockItem, 0};
+            operations[n++] = {BENCH_INSERT_STOCK_ITEM, 0, stockItem, 0};
+            for (unsigned int c = 0; c < config.numOfCarts; c++)
+            {
+                for (unsigned int j = 0; j < numOfLines[c]; j++)
+                {
+                    if (lineStockItems[c * maxLines + j] == stockItem)
+                    {
+                        numOfLines[c]--;
+                        lineStockItems[c * maxLines + j] = lineStockItems[c * maxLines + numOfLines[c]];
+                        lineQuantities[c * maxLines + j] = lineQuantities[c * maxLines + numOfLines[c]];
+                        break;
+                    }
+                }
+            }
+        }
+        else if (percent < config.churnPercent + config.deductPercent && numOfLines[whichCart] > 0)
+        {
+            // a customer puts back some of a line
+            unsigned int j = bench_random_below(state, numOfLines[whichCart]);
+            unsigned int quantity = 1 + bench_random_below(state, quantities[j]);
+            operations[n++] = {BENCH_DEDUCT, whichCart, lines[j], quantity};
+            quantities[j] -= quantity;
+            if (quantities[j] == 0)
+            {
+                numOfLines[whichCart]--;
+                lines[j] = lines[numOfLines[whichCart]];
+                quantities[j] = quantities[numOfLines[whichCart]];
+            }
+        }
+        else
+        {
+            // a customer picks a stock item, most of the time one of it
+            double u = (bench_random(state) >> 11) * (sum / 9007199254740992.0); // uniform in [0, sum)
+            unsigned int rank = upper_bound(cumulative, cumulative + numOfStockItems, u) - cumulative;
+            unsigned int stockItem = catalog[min(rank, numOfStockItems - 1)];
+            unsigned int quantity = (bench_random_below(state, 100) < 80) ? 1 : 2 + bench_random_below(state, 4);
+            operations[n++] = {BENCH_INSERT_OR_ADD, whichCart, stockItem, quantity};
+
+            unsigned int j = 0;
+            while (j < numOfLines[whichCart] && lines[j] != stockItem)
+                j++;
+            if (j < numOfLines[whichCart])
+            {
+                quantities[j] += quantity;
+            }
+            else
+            {
+                lines[j] = stockItem;
+                quantities[j] = quantity;
+                numOfLines[whichCart]++;
+            }
+
+            if (numOfLines[whichCart] >= targets[whichCart] && n < config.numOfOperations)
+            {
+                operations[n++] = {BENCH_CHECKOUT, whichCart, 0, 0};
+                numOfLines[whichCart] = 0;
+                targets[whichCart] = bench_cart_target(config, state);
+            }
+        }
+    }
+
+    delete[] cumulative;
+    delete[] lineStockItems;
+    delete[] lineQuantities;
+    delete[] numOfLines;
+    delete[] targets;
+}
+
+// Helper function: insert the catalog into an empty stock item list
+void bench_setup(const BenchConfig &config, const unsigned int catalog[], StockItem *&stockItemHead)
+{
+    char id[MAX_ID];
+    char title[MAX_TITLE];
+    for (unsigned int i = 0; i < config.numOfStockItems; i++)
+    {
+        bench_stock_item_id(catalog[i], id);
+        snprintf(title, MAX_TITLE, "Item_%u", catalog[i]);
+        ll_insert_stock_item(stockItemHead, id, title, bench_stock_item_price(config, catalog[i]));
+    }
+}
+
+// Helper function: apply an operation of a trace, a checkout adds its total to the checksum
+// return false if the operation failed, which never happens to a generated trace
+bool bench_apply(const BenchConfig &config, const BenchOperation &operation, StockItem *&stockItemHead, ShoppingCartTable &shoppingCartTable, unsigned long long &checksum)
+{
+    char id[MAX_ID];
+    char title[MAX_TITLE];
+    ShoppingCart &shoppingCart = *shopping_cart_table_get(shoppingCartTable, operation.whichCart);
+    switch (operation.type)
+    {
+    case BENCH_INSERT_OR_ADD:
+        bench_stock_item_id(operation.stockItem, id);
+        return ll_insert_or_add_stock_item_quantity(shoppingCart, stockItemHead, id, operation.quantity);
+    case BENCH_DEDUCT:
+        bench_stock_item_id(operation.stockItem, id);
+        return ll_deduct_stock_item_quantity_from_shopping_cart(shoppingCart, id, operation.quantity);
+    case BENCH_CHECKOUT:
+    {
+        unsigned long long totalAmount;
+        if (!ll_checkout_shopping_cart(shoppingCart, totalAmount))
+            return false;
+        checksum = checksum * 31 + totalAmount;
+        return true;
+    }
+    case BENCH_REMOVE_STOCK_ITEM:
+        bench_stock_item_id(operation.stockItem, id);
+        return ll_remove_stock_item(stockItemHead, id);
+    case BENCH_INSERT_STOCK_ITEM:
+        bench_stock_item_id(operation.stockItem, id);
+        snprintf(title, MAX_TITLE, "Item_%u", operation.stockItem);
+        return ll_insert_stock_item(stockItemHead, id, title, bench_stock_item_price(config, operation.stockItem));
+    default:
+        return false;
+    }
+}
+
+// Helper function: the nanoseconds since start
+unsigned long long bench_elapsed(const chrono::steady_clock::time_point start)
+{
+    return chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start).count();
+}
+
+// Helper function: append an operation of a trace as a batch command (see run_batch)
+void bench_append_command(OutputBuffer &output, const BenchConfig &config, const BenchOperation &operation)
+{
+    char id[MAX_ID];
+    bench_stock_item_id(operation.stockItem, id);
+    switch (operation.type)
+    {
+    case BENCH_INSERT_OR_ADD:
+    case BENCH_DEDUCT:
+        output_append(output, (operation.type == BENCH_INSERT_OR_ADD) ? "A " : "D ");
+        output_append_number(output, operation.whichCart);
+        output_append(output, " ");
+        output_append(output, id);
+        output_append(output, " ");
+        output_append_number(output, operation.quantity);
+        break;
+    case BENCH_CHECKOUT:
+        output_append(output, "C ");
+        output_append_number(output, operation.whichCart);
+        break;
+    case BENCH_REMOVE_STOCK_ITEM:
+        output_append(output, "X ");
+        output_append(output, id);
+        break;
+    default:
+        output_append(output, "I ");
+        output_append(output, id);
+        output_append(output, " Item_");
+        output_append_number(output, operation.stockItem);
+        output_append(output, " ");
+        output_append_number(output, bench_stock_item_price(config, operation.stockItem));
+        break;
+    }
+    output_append(output, "\n");
+}
+
+// Write the catalog and the trace as batch commands, so they can be replayed with --batch,
+// e.g., to compare the totals printed by the checkouts
+bool bench_save_trace(const BenchConfig &config, const BenchOperation operations[], const unsigned int catalog[], const char *fileName)
+{
+    ofstream out(fileName);
+    if (!out)
+        return false;
+    OutputBuffer output = {&out, new char[IO_CHUNK_SIZE], 0, nullptr, IO_CHUNK_SIZE};
+    // the first line opens at most MAX_NUM_SHOPPING_CARTS shopping carts, the others are opened with O
+    output_append_number(output, min(config.numOfCarts, static_cast<unsigned int>(MAX_NUM_SHOPPING_CARTS)));
+    output_append(output, "\n");
+    for (unsigned int c = MAX_NUM_SHOPPING_CARTS; c < config.numOfCarts; c++)
+        output_append(output, "O\n");
+    for (unsigned int i = 0; i < config.numOfStockItems; i++)
+        bench_append_command(output, config, {BENCH_INSERT_STOCK_ITEM, 0, catalog[i], 0});
+    for (unsigned int i = 0; i < config.numOfOperations; i++)
+        bench_append_command(output, config, operations[i]);
+    output_flush(output);
+    delete[] output.chars;
+    return out.good();
+}
+
+// Run the trace of a config twice on fresh lists and report to out:
+// the first run is not timed per operation and gives the throughput,
+// the second times every operation and gives the latency percentiles of each type of operation.
+// The ll_* statistics (see stats_print) keep being recorded, as in any other run
+// return 1 if an operation failed, 0 otherwise
+int bench_run(const BenchConfig &config, const char *traceFileName, ostream &out)
+{
+    OutputBuffer output = {&out, new char[IO_CHUNK_SIZE], 0, nullptr, IO_CHUNK_SIZE};
+    char exponent[32];
+    BenchOperation *operations = new BenchOperation[config.numOfOperations];
+    unsigned int *catalog = new unsigned int[config.numOfStockItems];
+    bench_generate(config, operations, catalog);
+    if (traceFileName != nullptr && !bench_save_trace(config, operations, catalog, traceFileName))
+    {
+        output_append(output, "Failed to write the trace to ");
+        output_append(output, traceFileName);
+        output_append(output, "\n");
+    }
+
+    output_append(output, "Benchmark: seed ");
+    output_append_number(output, config.seed);
+    output_append(output, ", ");
+    output_append_number(output, config.numOfStockItems);
+    output_append(output, " stock items, ");
+    output_append_number(output, config.numOfCarts);
+    output_append(output, " shopping carts of ");
+    output_append_number(output, config.cartSize);
+    output_append(output, " lines, ");
+    output_append_number(output, config.numOfOperations);
+    output_append(output, " operations, zipf ");
+    snprintf(exponent, sizeof(exponent), "%g", config.zipfExponent);
+    output_append(output, exponent);
+    output_append(output, ", ");
+    output_append_number(output, config.deductPercent);
+    output_append(output, "% deduct, ");
+    output_append_number(output, config.churnPercent);
+    output_append(output, "% churn\n");
+
+    unsigned long long counts[NUM_BENCH_OPERATION_TYPES][STATS_BUCKETS] = {};
+    unsigned long long checksum = 0;
+    unsigned int numOfFailed = 0;
+    unsigned long long setupNanoseconds = 0;
+    unsigned long long runNanoseconds = 0;
+    for (int pass = 0; pass < 2; pass++)
+    {
+        StockItem *stockItemHead = nullptr;
+        ShoppingCartTable *shoppingCartTable = dynamic_init_shopping_cart_table(config.numOfCarts);
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        bench_setup(config, catalog, stockItemHead);
+        if (pass == 0)
+            setupNanoseconds = bench_elapsed(start);
+
+        checksum = 0;
+        numOfFailed = 0;
+        start = chrono::steady_clock::now();
+        for (unsigned int i = 0; i < config.numOfOperations; i++)
+        {
+            if (pass == 0)
+            {
+                numOfFailed += !bench_apply(config, operations[i], stockItemHead, *shoppingCartTable, checksum);
+                continue;
+            }
+            chrono::steady_clock::time_point operationStart = chrono::steady_clock::now();
+            numOfFailed += !bench_apply(config, operations[i], stockItemHead, *shoppingCartTable, checksum);
+            counts[operations[i].type][stats_bucket(bench_elapsed(operationStart))]++;
+        }
+        if (pass == 0)
+            runNanoseconds = bench_elapsed(start);
+        ll_cleanup(stockItemHead, shoppingCartTable);
+    }
+
+    // the cost of reading the clock, which is part of every latency
+    unsigned long long clockCounts[STATS_BUCKETS] = {};
+    for (int i = 0; i < 1000; i++)
+    {
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        clockCounts[stats_bucket(bench_elapsed(start))]++;
+    }
+
+    output_append(output, "Setup: ");
+    output_append_number(output, config.numOfStockItems);
+    output_append(output, " stock items inserted in ");
+    output_append_number(output, setupNanoseconds / 1000000);
+    output_append(output, " ms\n");
+    output_append(output, "Throughput: ");
+    output_append_number(output, config.numOfOperations);
+    output_append(output, " operations in ");
+    output_append_number(output, runNanoseconds / 1000000);
+    output_append(output, " ms, ");
+    output_append_number(output, (runNanoseconds == 0) ? 0 : config.numOfOperations * 1000000000ULL / runNanoseconds);
+    output_append(output, " operations/s\n");
+    output_append(output, "Checksum: ");
+    output_append_number(output, checksum);
+    output_append(output, ", ");
+    output_append_number(output, numOfFailed);
+    output_append(output, " failed operations\n");
+    output_append(output, "Latency (reading the clock, included in every operation, is the first line):\n");
+    output_append(output, "clock: count 1000");
+    stats_append_percentiles(output, clockCounts, " ns");
+    output_append(output, "\n");
+    for (int type = 0; type < NUM_BENCH_OPERATION_TYPES; type++)
+    {
+        unsigned long long numOfOperations = 0;
+        for (int bucket = 0; bucket < STATS_BUCKETS; bucket++)
+            numOfOperations += counts[type][bucket];
+        if (numOfOperations == 0)
+            continue;
+        output_append(output, benchOperationNames[type]);
+        output_append(output, ": count ");
+        output_append_number(output, numOfOperations);
+        stats_append_percentiles(output, counts[type], " ns");
+        output_append(output, "\n");
+    }
+    output_flush(output);
+    out.flush();
+    delete[] output.chars;
+    delete[] operations;
+    delete[] catalog;
+    return (numOfFailed == 0) ? 0 : 1;
+}
+
+// The counts of a till of the contention benchmark
+struct BenchTill
+{
+    unsigned long long numOfReserved; // The units added to the shopping cart of the till
+    unsigned long long numOfRefused;  // The adds refused because no unit was available
+    unsigned long long numOfSold;     // The units checked out
+};
+
+// Helper function: a till of the contention benchmark, adding one unit of a random hot stock item at a time
+// to its own shopping cart and checking it out every cartSize units, for numOfOperations adds
+void bench_till(const BenchConfig &config, RetailEngine &engine, const unsigned int whichCart, const unsigned int numOfOperations, BenchTill &till)
+{
+    unsigned long long state = ((config.seed + whichCart + 1) * 0x9E3779B97F4A7C15ULL) | 1;
+    unsigned int numOfLines = 0;
+    unsigned long long totalAmount;
+    char id[MAX_ID];
+    for (unsigned int i = 0; i < numOfOperations; i++)
+    {
+        bench_stock_item_id(bench_random_below(state, config.numOfHotSkus), id);
+        if (!engine_insert_or_add_stock_item_quantity(engine, whichCart, id, 1))
+        {
+            till.numOfRefused++;
+            continue;
+        }
+        till.numOfReserved++;
+        if (++numOfLines == config.cartSize)
+        {
+            engine_checkout_shopping_cart(engine, whichCart, totalAmount);
+            till.numOfSold += numOfLines;
+            numOfLines = 0;
+        }
+    }
+    engine_checkout_shopping_cart(engine, whichCart, totalAmount);
+    till.numOfSold += numOfLines;
+}
+
+// Run numOfTills tills on a RetailEngine, all of them adding units of the same numOfHotSkus stock items,
+// with numOfOperations / 2 units on hand in total, so the stock runs out halfway and the refused adds are timed too.
+// The units on hand left are then checked against the units sold: no unit may be sold twice, and none may stay reserved
+// return 1 if a unit was oversold or leaked, 0 otherwise
+int bench_run_contention(const BenchConfig &config, ostream &out)
+{
+    OutputBuffer output = {&out, new char[IO_CHUNK_SIZE], 0, nullptr, IO_CHUNK_SIZE};
+    RetailEngine *engine = engine_init(config.numOfTills);
+    char id[MAX_ID];
+    char title[MAX_TITLE];
+    unsigned long long numOfUnits = 0;
+    for (unsigned int i = 0; i < config.numOfHotSkus; i++)
+    {
+        unsigned int onHand = config.numOfOperations / 2 / config.numOfHotSkus;
+        bench_stock_item_id(i, id);
+        snprintf(title, MAX_TITLE, "Item_%u", i);
+        engine_insert_stock_item(*engine, id, title, bench_stock_item_price(config, i));
+        if (onHand > 0)
+            engine_restock_stock_item(*engine, id, onHand);
+        numOfUnits += onHand;
+    }
+
+    BenchTill *tills = new BenchTill[config.numOfTills]();
+    thread *threads = new thread[config.numOfTills];
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    for (unsigned int t = 0; t < config.numOfTills; t++)
+    {
+        unsigned int numOfOperations = static_cast<unsigned long long>(config.numOfOperations) * (t + 1) / config.numOfTills -
+                                       static_cast<unsigned long long>(config.numOfOperations) * t / config.numOfTills;
+        threads[t] = thread(bench_till, cref(config), ref(*engine), t, numOfOperations, ref(tills[t]));
+    }
+    for (unsigned int t = 0; t < config.numOfTills; t++)
+        threads[t].join();
+    unsigned long long runNanoseconds = bench_elapsed(start);
+
+    unsigned long long numOfReserved = 0, numOfRefused = 0, numOfSold = 0;
+    for (unsigned int t = 0; t < config.numOfTills; t++)
+    {
+        numOfReserved += tills[t].numOfReserved;
+        numOfRefused += tills[t].numOfRefused;
+        numOfSold += tills[t].numOfSold;
+    }
+    unsigned long long numOfLeft = 0, numOfStillReserved = 0;
+    for (unsigned int i = 0; i < config.numOfHotSkus; i++)
+    {
+        unsigned int onHand = 0, reserved = 0;
+        bench_stock_item_id(i, id);
+        StockItem *stockItem = ll_search_stock_item(engine->stockItemHead, id);
+        if (inventory_get(stockItem, onHand, reserved))
+        {
+            numOfLeft += onHand;
+            numOfStillReserved += reserved;
+        }
+    }
+    bool consistent = numOfSold == numOfReserved && numOfSold + numOfLeft == numOfUnits && numOfStillReserved == 0;
+
+    output_append(output, "Contention: ");
+    output_append_number(output, config.numOfTills);
+    output_append(output, " tills, ");
+    output_append_number(output, config.numOfHotSkus);
+    output_append(output, " hot stock items, ");
+    output_append_number(output, numOfUnits);
+    output_append(output, " units on hand, ");
+    output_append_number(output, config.numOfOperations);
+    output_append(output, " adds in ");
+    output_append_number(output, runNanoseconds / 1000000);
+    output_append(output, " ms, ");
+    output_append_number(output, (runNanoseconds == 0) ? 0 : config.numOfOperations * 1000000000ULL / runNanoseconds);
+    output_append(output, " adds/s\n");
+    output_append(output, "Reserved ");
+    output_append_number(output, numOfReserved);
+    output_append(output, ", refused ");
+    output_append_number(output, numOfRefused);
+    output_append(output, ", sold ");
+    output_append_number(output, numOfSold);
+    output_append(output, ", left on hand ");
+    output_append_number(output, numOfLeft);
+    output_append(output, ", still reserved ");
+    output_append_number(output, numOfStillReserved);
+    output_append(output, consistent ? ": consistent\n" : ": INCONSISTENT\n");
+    output_flush(output);
+    out.flush();
+    delete[] output.chars;
+    delete[] tills;
+    delete[] threads;
+    engine_cleanup(engine);
+    return consistent ? 0 : 1;
+}
+
+const unsigned int BENCH_BULK_UPDATES = 8; // The number of price updates of a bulk price update of the engine benchmark
+
+// The counts of a till of the engine benchmark
+struct BenchEngineTill
+{
+    unsigned long long numOfDone;   // The operations that succeeded
+    unsigned long long numOfFailed; // The operations that failed although nothing could make them fail
+};
+
+// Helper function: a till of the engine benchmark, running numOfOperations random operations on its own shopping cart
+// and on the catalog: per 1000 operations, 350 adds, 100 deducts, 50 removes from the shopping cart, 80 checkouts,
+// 20 shopping carts opened and closed, 200 price lookups, 150 price updates, 1 bulk price update of BENCH_BULK_UPDATES
+// stock items, and 49 stock items removed and inserted again.
+// An add, a deduct or a price update may fail as another till removed the stock item meanwhile, the others may not
+void bench_engine_till(const BenchConfig &config, RetailEngine &engine, const unsigned int till, const unsigned int numOfOperations, BenchEngineTill &counts)
+{
+    unsigned long long state = ((config.seed + till + 1) * 0x9E3779B97F4A7C15ULL) | 1;
+    unsigned int whichCart = till;
+    unsigned long long totalAmount;
+    unsigned int priceInCents;
+    char id[MAX_ID];
+    char title[MAX_TITLE];
+    PriceUpdate updates[BENCH_BULK_UPDATES];
+    for (unsigned int i = 0; i < numOfOperations; i++)
+    {
+        unsigned int operation = bench_random_below(state, 1000);
+        unsigned int stockItem = bench_random_below(state, config.numOfStockItems);
+        bench_stock_item_id(stockItem, id);
+        bool done = true;
+        bool mayFail = false;
+        if (operation < 350)
+        {
+            done = engine_insert_or_add_stock_item_quantity(engine, whichCart, id, 1 + bench_random_below(state, 3));
+            mayFail = true;
+        }
+        else if (operation < 450)
+        {
+            done = engine_deduct_stock_item_quantity_from_shopping_cart(engine, whichCart, id, 1);
+            mayFail = true;
+        }
+        else if (operation < 500)
+        {
+            done = engine_remove_stock_item_from_shopping_cart(engine, whichCart, id);
+            mayFail = true;
+        }
+        else if (operation < 580)
+        {
+            done = engine_checkout_shopping_cart(engine, whichCart, totalAmount);
+        }
+        else if (operation < 600)
+        {
+            // opened first, so the till never closes the last open shopping cart
+            unsigned int newCart = engine_open_shopping_cart(engine);
+            done = engine_close_shopping_cart(engine, whichCart);
+            whichCart = newCart;
+        }
+        else if (operation < 800)
+        {
+            done = engine_get_stock_item_price(engine, id, priceInCents);
+            mayFail = true;
+            if (done && priceInCents == 0)
+                counts.numOfFailed++;
+        }
+        else if (operation < 950)
+        {
+            done = engine_update_stock_item_price(engine, id, 99 + bench_random_below(state, 10000));
+            mayFail = true;
+        }
+        else if (operation < 951)
+        {
+            for (unsigned int j = 0; j < BENCH_BULK_UPDATES; j++)
+            {
+                bench_stock_item_id(bench_random_below(state, config.numOfStockItems), updates[j].id);
+                updates[j].key = encode_id_key(updates[j].id);
+                updates[j].priceInCents = 99 + bench_random_below(state, 10000);
+            }
+            engine_update_stock_item_prices(engine, updates, BENCH_BULK_UPDATES);
+        }
+        else if (engine_remove_stock_item(engine, id))
+        {
+            // only the till removing a stock item inserts it again, so the insert cannot fail
+            snprintf(title, MAX_TITLE, "Item_%u", stockItem);
+            done = engine_insert_stock_item(engine, id, title, bench_stock_item_price(config, stockItem));
+        }
+        if (done)
+            counts.numOfDone++;
+        else if (!mayFail)
+            counts.numOfFailed++;
+    }
+}
+
+// Helper function: check the engine once its tills are done
+// Every stock item of the catalog is in the list, every line of an open shopping cart holds a StockItem of the list
+// at its current price and is on the list of lines of that StockItem, the totals of the shopping carts add up,
+// and the lists of lines of the StockItems hold no other line
+bool bench_engine_is_consistent(const BenchConfig &config, RetailEngine &engine)
+{
+    char id[MAX_ID];
+    unsigned long long numOfStockItems = 0, numOfLines = 0, numOfLinesOfStockItems = 0;
+    for (StockItem *stockItem = engine.stockItemHead->next; stockItem != nullptr; stockItem = stockItem->next)
+    {
+        numOfStockItems++;
+        for (ShoppingCartItem *c = stockItem->cartItems; c != nullptr; c = c->nextInStockItem, numOfLinesOfStockItems++)
+        {
+            if (c->item != stockItem || !c->cart->isOpen)
+                return false;
+        }
+    }
+    for (unsigned int i = 0; i < config.numOfStockItems; i++)
+    {
+        bench_stock_item_id(i, id);
+        if (ll_search_stock_item(engine.stockItemHead, id) == nullptr)
+            return false;
+    }
+    ShoppingCartTable &shoppingCartTable = *engine.shoppingCartTable;
+    for (unsigned int i = 0; i < shoppingCartTable.numOfCarts; i++)
+    {
+        if (!shopping_cart_table_is_open(shoppingCartTable, i))
+            continue;
+        ShoppingCart *shoppingCart = shopping_cart_table_get(shoppingCartTable, i);
+        unsigned long long totalAmount = 0;
+        const CartLines &lines = shoppingCart->lines;
+        for (CartLines::Position l = sorted_first(lines); !sorted_is_end(lines, l); l = sorted_next(lines, l), numOfLines++)
+        {
+            const ShoppingCartItem *c = sorted_node(lines, l);
+            bool linked = false;
+            for (const ShoppingCartItem *d = c->item->cartItems; d != nullptr && !linked; d = d->nextInStockItem)
+                linked = (d == c);
+            if (!linked || c->cart != shoppingCart || ll_search_stock_item(engine.stockItemHead, c->item->id) != c->item ||
+                c->priceInCents != c->item->priceInCents)
+                return false;
+            totalAmount += static_cast<unsigned long long>(c->quantity) * c->priceInCents;
+        }
+        if (totalAmount != shoppingCart->totalAmount)
+            return false;
+    }
+    return numOfStockItems == config.numOfStockItems && numOfLines == numOfLinesOfStockItems;
+}
+
+// Run the tills of the engine benchmark with 1, 2, 4, ... threads up to numOfTills (the number of cores by default),
+// each time on a new RetailEngine with numOfStockItems stock items, numOfOperations operations in total.
+// Every operation of the engine runs in the mix (see bench_engine_till), and the engine is checked after each run
+// return 1 if an operation failed that could not fail or the engine is inconsistent, 0 otherwise
+int bench_run_engine(const BenchConfig &config, ostream &out)
+{
+    OutputBuffer output = {&out, new char[IO_CHUNK_SIZE], 0, nullptr, IO_CHUNK_SIZE};
+    unsigned int maxOfTills = (config.numOfTills > 0) ? config.numOfTills : thread::hardware_concurrency();
+    if (maxOfTills == 0)
+        maxOfTills = 1;
+    char id[MAX_ID];
+    char title[MAX_TITLE];
+    bool valid = true;
+
+    output_append(output, "Engine: seed ");
+    output_append_number(output, config.seed);
+    output_append(output, ", ");
+    output_append_number(output, config.numOfStockItems);
+    output_append(output, " stock items, ");
+    output_append_number(output, config.numOfOperations);
+    output_append(output, " mixed operations\n");
+    for (unsigned int numOfTills = 1; numOfTills <= maxOfTills; numOfTills = (numOfTills * 2 > maxOfTills && numOfTills < maxOfTills) ? maxOfTills : numOfTills * 2)
+    {
+        RetailEngine *engine = engine_init(numOfTills);
+        for (unsigned int i = 0; i < config.numOfStockItems; i++)
+        {
+            bench_stock_item_id(i, id);
+            snprintf(title, MAX_TITLE, "Item_%u", i);
+            engine_insert_stock_item(*engine, id, title, bench_stock_item_price(config, i));
+        }
+        BenchEngineTill *tills = new BenchEngineTill[numOfTills]();
+        thread *threads = new thread[numOfTills];
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        for (unsigned int t = 0; t < numOfTills; t++)
+        {
+            unsigned int numOfOperations = static_cast<unsigned long long>(config.numOfOperations) * (t + 1) / numOfTills -
+                                           static_cast<unsigned long long>(config.numOfOperations) * t / numOfTills;
+            threads[t] = thread(bench_engine_till, cref(config), ref(*engine), t, numOfOperations, ref(tills[t]));
+        }
+        for (unsigned int t = 0; t < numOfTills; t++)
+            threads[t].join();
+        unsigned long long runNanoseconds = bench_elapsed(start);
+
+        unsigned long long numOfDone = 0, numOfFailed = 0;
+        for (unsigned int t = 0; t < numOfTills; t++)
+        {
+            numOfDone += tills[t].numOfDone;
+            numOfFailed += tills[t].numOfFailed;
+        }
+        bool consistent = numOfFailed == 0 && bench_engine_is_consistent(config, *engine);
+        valid = valid && consistent;
+        output_append_number(output, numOfTills);
+        output_append(output, (numOfTills == 1) ? " till: " : " tills: ");
+        output_append_number(output, runNanoseconds / 1000000);
+        output_append(output, " ms, ");
+        output_append_number(output, (runNanoseconds == 0) ? 0 : config.numOfOperations * 1000000000ULL / runNanoseconds);
+        output_append(output, " operations/s, ");
+        output_append_number(output, numOfDone);
+        output_append(output, " done, ");
+        output_append_number(output, numOfFailed);
+        output_append(output, consistent ? " failed: consistent\n" : " failed: INCONSISTENT\n");
+        delete[] tills;
+        delete[] threads;
+        engine_cleanup(engine);
+        if (numOfTills == maxOfTills)
+            break;
+    }
+    output_flush(output);
+    out.flush();
+    delete[] output.chars;
+    return valid ? 0 : 1;
+}
+
+// The thread counts of the reader benchmark
+const unsigned int benchReaderThreads[] = {1, 2, 4, 8, 16, 32};
+
+// The counts of a thread of the reader benchmark
+struct BenchReader
+{
+    unsigned long long numOfFound; // The lookups that found their stock item
+    unsigned long long numOfWrong; // The lookups that returned a price the stock item never had
+    long long numOfAdded;          // The stock items inserted less the ones removed
+};
+
+// Helper function: a thread of the reader benchmark, 95 lookups of a random stock item for every 5 writes,
+// each one removing a random stock item or inserting it again. A stock item always has the same price,
+// so a lookup returning another price has read a StockItem released too early (see engine_remove_stock_item)
+void bench_reader(const BenchConfig &config, RetailEngine &engine, const unsigned int reader, const unsigned int numOfOperations, BenchReader &counts)
+{
+    unsigned long long state = ((config.seed + reader + 1) * 0x9E3779B97F4A7C15ULL) | 1;
+    unsigned int priceInCents;
+    char id[MAX_ID];
+    char title[MAX_TITLE];
+    for (unsigned int i = 0; i < numOfOperations; i++)
+    {
+        unsigned int operation = bench_random_below(state, 200);
+        unsigned int stockItem = bench_random_below(state, config.numOfStockItems);
+        bench_stock_item_id(stockItem, id);
+        if (operation < 190)
+        {
+            if (engine_get_stock_item_price(engine, id, priceInCents))
+            {
+                counts.numOfFound++;
+                if (priceInCents != bench_stock_item_price(config, stockItem))
+                    counts.numOfWrong++;
+            }
+        }
+        else if (operation < 195)
+        {
+            if (engine_remove_stock_item(engine, id))
+                counts.numOfAdded--;
+        }
+        else
+        {
+            snprintf(title, MAX_TITLE, "Item_%u", stockItem);
+            if (engine_insert_stock_item(engine, id, title, bench_stock_item_price(config, stockItem)))
+                counts.numOfAdded++;
+        }
+    }
+}
+
+// Run numOfOperations lookups and writes, 95 to 5, on a RetailEngine with numOfStockItems stock items
+// with each thread count of benchReaderThreads. The lookups take no lock while the writers remove StockItems,
+// so a run under ThreadSanitizer checks the epochs the removed StockItems wait for (see epoch_enter).
+// The pools reuse the released StockItems, so a StockItem released too early also shows up as a wrong price:
+// every lookup must have returned the price of its stock item, and the list must hold what was inserted and not removed
+// return 1 if not, 0 otherwise
+int bench_run_readers(const BenchConfig &config, ostream &out)
+{
+    OutputBuffer output = {&out, new char[IO_CHUNK_SIZE], 0, nullptr, IO_CHUNK_SIZE};
+    const unsigned int numOfRuns = sizeof(benchReaderThreads) / sizeof(benchReaderThreads[0]);
+    char id[MAX_ID];
+    char title[MAX_TITLE];
+    bool valid = true;
+
+    output_append(output, "Readers: seed ");
+    output_append_number(output, config.seed);
+    output_append(output, ", ");
+    output_append_number(output, config.numOfStockItems);
+    output_append(output, " stock items, ");
+    output_append_number(output, config.numOfOperations);
+    output_append(output, " operations, 95% lookups and 5% removes and inserts\n");
+    for (unsigned int run = 0; run < numOfRuns; run++)
+    {
+        unsigned int numOfThreads = benchReaderThreads[run];
+        RetailEngine *engine = engine_init(1);
+        for (unsigned int i = 0; i < config.numOfStockItems; i++)
+        {
+            bench_stock_item_id(i, id);
+            snprintf(title, MAX_TITLE, "Item_%u", i);
+            engine_insert_stock_item(*engine, id, title, bench_stock_item_price(config, i));
+        }
+        BenchReader *readers = new BenchReader[numOfThreads]();
+        thread *threads = new thread[numOfThreads];
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        for (unsigned int t = 0; t < numOfThreads; t++)
+        {
+            unsigned int numOfOperations = static_cast<unsigned long long>(config.numOfOperations) * (t + 1) / numOfThreads -
+                                           static_cast<unsigned long long>(config.numOfOperations) * t / numOfThreads;
+            threads[t] = thread(bench_reader, cref(config), ref(*engine), t, numOfOperations, ref(readers[t]));
+        }
+        for (unsigned int t = 0; t < numOfThreads; t++)
+            threads[t].join();
+        unsigned long long runNanoseconds = bench_elapsed(start);
+
+        unsigned long long numOfFound = 0, numOfWrong = 0;
+        long long numOfStockItems = config.numOfStockItems;
+        for (unsigned int t = 0; t < numOfThreads; t++)
+        {
+            numOfFound += readers[t].numOfFound;
+            numOfWrong += readers[t].numOfWrong;
+            numOfStockItems += readers[t].numOfAdded;
+        }
+        long long numOfListed = 0;
+        const StockItem *last = engine->stockItemHead;
+        for (const StockItem *stockItem = last->next; stockItem != nullptr; last = stockItem, stockItem = stockItem->next, numOfListed++)
+        {
+            if (last != engine->stockItemHead && compare_id_key(last->key, last->id, stockItem->key, stockItem->id) >= 0)
+                numOfWrong++;
+        }
+        bool consistent = numOfWrong == 0 && numOfListed == numOfStockItems;
+        valid = valid && consistent;
+        output_append_number(output, numOfThreads);
+        output_append(output, (numOfThreads == 1) ? " thread: " : " threads: ");
+        output_append_number(output, runNanoseconds / 1000000);
+        output_append(output, " ms, ");
+        output_append_number(output, (runNanoseconds == 0) ? 0 : config.numOfOperations * 1000000000ULL / runNanoseconds);
+        output_append(output, " operations/s, ");
+        output_append_number(output, numOfFound);
+        output_append(output, " found, ");
+        output_append_number(output, numOfListed);
+        output_append(output, consistent ? " listed: consistent\n" : " listed: INCONSISTENT\n");
+        delete[] readers;
+        delete[] threads;
+        engine_cleanup(engine);
+    }
+    output_flush(output);
+    out.flush();
+    delete[] output.chars;
+    return valid ? 0 : 1;
+}
+
+// The sizes compared by bench_run_containers, the sizes of shopping carts first and then of catalogs
+const unsigned int benchContainerSizes[] = {4, 8, 16, 32, 64, 1024, 16384, 262144};
+const unsigned int BENCH_LARGEST_CART = 64;          // the larger sizes are filled with StockItems, the others with ShoppingCartItems
+const unsigned int BENCH_CONTAINER_NODES = 1 << 16;  // the number of nodes inserted into a container of each size, over as many rounds as needed
+const unsigned int BENCH_MAX_FLAT_SIZE = 16384;      // a FlatStorage moves half of its entries on every insert and erase
+
+// Helper function: insert the nodes into a sorted container in one random order, find them in another and erase them in a third
+// elapsed gets the nanoseconds of each of the three
+// return false if a node is not where it should be
+template <typename Storage, typename Node>
+bool bench_sorted_container(Node *const nodes[], const unsigned int numOfNodes, unsigned int *const orders[3], const unsigned int numOfRounds, unsigned long long elapsed[3])
+{
+    Storage storage;
+    sorted_init(storage);
+    typename Storage::Position position;
+    unsigned long long numOfCompared = 0;
+    bool valid = true;
+    for (unsigned int round = 0; round < numOfRounds; round++)
+    {
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        for (unsigned int i = 0; i < numOfNodes; i++)
+        {
+            Node *node = nodes[orders[0][i]];
+            if (sorted_find(storage, sorted_key(node), sorted_id(node), position, numOfCompared))
+                valid = false;
+            else
+                sorted_insert(storage, position, node);
+        }
+        elapsed[0] += bench_elapsed(start);
+
+        start = chrono::steady_clock::now();
+        for (unsigned int i = 0; i < numOfNodes; i++)
+        {
+            Node *node = nodes[orders[1][i]];
+            if (!sorted_find(storage, sorted_key(node), sorted_id(node), position, numOfCompared) || sorted_node(storage, position) != node)
+                valid = false;
+        }
+        elapsed[1] += bench_elapsed(start);
+
+        start = chrono::steady_clock::now();
+        for (unsigned int i = 0; i < numOfNodes; i++)
+        {
+            Node *node = nodes[orders[2][i]];
+            if (sorted_find(storage, sorted_key(node), sorted_id(node), position, numOfCompared))
+                sorted_erase(storage, position);
+            else
+                valid = false;
+        }
+        elapsed[2] += bench_elapsed(start);
+        valid = valid && storage.size == 0;
+        sorted_clear(storage);
+    }
+    sorted_release(storage);
+    return valid;
+}
+
+// Helper function: the same for the skip list of the catalog, through the ll_* functions
+bool bench_skip_list(StockItem *const nodes[], const unsigned int numOfNodes, unsigned int *const orders[3], const unsigned int numOfRounds, unsigned long long elapsed[3])
+{
+    StockItem *stockItemHead = nullptr;
+    bool valid = true;
+    for (unsigned int round = 0; round < numOfRounds; round++)
+    {
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        for (unsigned int i = 0; i < numOfNodes; i++)
+            valid = ll_insert_stock_item(stockItemHead, nodes[orders[0][i]]->id, "", 1) && valid;
+        elapsed[0] += bench_elapsed(start);
+
+        start = chrono::steady_clock::now();
+        for (unsigned int i = 0; i < numOfNodes; i++)
+            valid = ll_search_stock_item(stockItemHead, nodes[orders[1][i]]->id) != nullptr && valid;
+        elapsed[1] += bench_elapsed(start);
+
+        start = chrono::steady_clock::now();
+        for (unsigned int i = 0; i < numOfNodes; i++)
+            valid = ll_remove_stock_item(stockItemHead, nodes[orders[2][i]]->id) && valid;
+        elapsed[2] += bench_elapsed(start);
+        valid = valid && stockItemHead == nullptr;
+    }
+    return valid;
+}
+
+// Helper function: append the nanoseconds per insert, find and erase of a container
+void bench_append_container(OutputBuffer &output, const char *name, const unsigned long long elapsed[3], const unsigned long long numOfOperations)
+{
+    output_append(output, name);
+    output_append(output, " ");
+    for (int phase = 0; phase < 3; phase++)
+    {
+        if (phase > 0)
+            output_append(output, "/");
+        output_append_number(output, elapsed[phase] / numOfOperations);
+    }
+    output_append(output, " ns");
+}
+
+// Helper function: run bench_sorted_container and append its nanoseconds per operation
+template <typename Storage, typename Node>
+bool bench_append_sorted_container(OutputBuffer &output, const char *name, Node *const nodes[], const unsigned int numOfNodes, unsigned int *const orders[3], const unsigned int numOfRounds)
+{
+    unsigned long long elapsed[3] = {};
+    bool valid = bench_sorted_container<Storage>(nodes, numOfNodes, orders, numOfRounds, elapsed);
+    bench_append_container(output, name, elapsed, static_cast<unsigned long long>(numOfNodes) * numOfRounds);
+    return valid;
+}
+
+// Helper function: compare the storage policies on containers of one size
+// A shopping cart is filled with ShoppingCartItems, and a catalog with StockItems, also compared with the skip list of the catalog
+bool bench_containers_of_size(ShoppingCartItem *const cartLines[], StockItem *const stockItems[], const unsigned int numOfNodes, unsigned int *const orders[3], OutputBuffer &output)
+{
+    unsigned int numOfRounds = (numOfNodes >= BENCH_CONTAINER_NODES) ? 1 : BENCH_CONTAINER_NODES / numOfNodes;
+    bool valid = true;
+    output_append(output, "size ");
+    output_append_number(output, numOfNodes);
+    if (numOfNodes <= BENCH_LARGEST_CART)
+    {
+        output_append(output, " (shopping cart lines):");
+        valid = bench_append_sorted_container<ListStorage<ShoppingCartItem> >(output, " list", cartLines, numOfNodes, orders, numOfRounds) && valid;
+        valid = bench_append_sorted_container<FlatStorage<ShoppingCartItem> >(output, ", flat", cartLines, numOfNodes, orders, numOfRounds) && valid;
+        valid = bench_append_sorted_container<BTreeStorage<ShoppingCartItem> >(output, ", btree", cartLines, numOfNodes, orders, numOfRounds) && valid;
+        valid = bench_append_sorted_container<InlineStorage<ShoppingCartItem> >(output, ", inline", cartLines, numOfNodes, orders, numOfRounds) && valid;
+    }
+    else
+    {
+        output_append(output, " (stock items):");
+        if (numOfNodes <= BENCH_MAX_FLAT_SIZE)
+            valid = bench_append_sorted_container<FlatStorage<StockItem> >(output, " flat", stockItems, numOfNodes, orders, numOfRounds) && valid;
+        else
+            output_append(output, " flat -");
+        valid = bench_append_sorted_container<BTreeStorage<StockItem> >(output, ", btree", stockItems, numOfNodes, orders, numOfRounds) && valid;
+        unsigned long long elapsed[3] = {};
+        valid = bench_skip_list(stockItems, numOfNodes, orders, numOfRounds, elapsed) && valid;
+        bench_append_container(output, ", skip list", elapsed, static_cast<unsigned long long>(numOfNodes) * numOfRounds);
+    }
+    output_append(output, valid ? "\n" : " FAILED\n");
+    output_flush(output);
+    return valid;
+}
+
+// Compare the storage policies of the sorted containers, on the sizes of shopping carts and of catalogs
+// Every size is filled, searched and emptied in seeded random orders, repeated up to BENCH_CONTAINER_NODES nodes
+int bench_run_containers(const BenchConfig &config, ostream &out)
+{
+    OutputBuffer output = {&out, new char[IO_CHUNK_SIZE], 0, nullptr, IO_CHUNK_SIZE};
+    const unsigned int numOfSizes = sizeof(benchContainerSizes) / sizeof(benchContainerSizes[0]);
+    const unsigned int maxSize = benchContainerSizes[numOfSizes - 1];
+    StockItem *stockItemNodes = new StockItem[maxSize];
+    StockItem **stockItems = new StockItem *[maxSize];
+    ShoppingCartItem *cartLineNodes = new ShoppingCartItem[BENCH_LARGEST_CART];
+    ShoppingCartItem **cartLines = new ShoppingCartItem *[BENCH_LARGEST_CART];
+    for (unsigned int i = 0; i < maxSize; i++)
+    {
+        bench_stock_item_id(i, stockItemNodes[i].id);
+        stockItemNodes[i].key = encode_id_key(stockItemNodes[i].id);
+        stockItems[i] = &stockItemNodes[i];
+    }
+    for (unsigned int i = 0; i < BENCH_LARGEST_CART; i++)
+    {
+        cartLineNodes[i].item = stockItems[i];
+        cartLineNodes[i].key = stockItems[i]->key;
+        cartLines[i] = &cartLineNodes[i];
+    }
+    unsigned int *orders[3];
+    for (int phase = 0; phase < 3; phase++)
+        orders[phase] = new unsigned int[maxSize];
+
+    output_append(output, "Sorted containers: seed ");
+    output_append_number(output, config.seed);
+    output_append(output, ", nanoseconds per insert/find/erase in random order\n");
+    ShoppingCartTable *shoppingCartTable = dynamic_init_shopping_cart_table(1);
+    StockItem *stockItemHead = nullptr;
+    unsigned long long state = (config.seed * 0x9E3779B97F4A7C15ULL) | 1;
+    bool valid = true;
+    for (unsigned int size = 0; size < numOfSizes; size++)
+    {
+        unsigned int numOfNodes = benchContainerSizes[size];
+        for (int phase = 0; phase < 3; phase++)
+        {
+            for (unsigned int i = 0; i < numOfNodes; i++)
+                orders[phase][i] = i;
+            for (unsigned int i = numOfNodes - 1; i > 0; i--)
+                swap(orders[phase][i], orders[phase][bench_random_below(state, i + 1)]);
+        }
+        valid = bench_containers_of_size(cartLines, stockItems, numOfNodes, orders, output) && valid;
+    }
+    ll_cleanup(stockItemHead, shoppingCartTable);
+    output_flush(output);
+    out.flush();
+    delete[] output.chars;
+    for (int phase = 0; phase < 3; phase++)
+        delete[] orders[phase];
+    delete[] cartLines;
+    delete[] cartLineNodes;
+    delete[] stockItems;
+    delete[] stockItemNodes;
+    return valid ? 0 : 1;
+}
+
+// === Comparison benchmarks ===
+// Each one times an operation against the way it was done before, on the same data, and checks that both agree
+
+// Helper function: append the nanoseconds per operation of the old way and of the new way, and the speedup
+void bench_append_speedup(OutputBuffer &output, const char *oldName, const unsigned long long oldNanoseconds, const unsigned long long numOfOldOperations,
+                          const char *newName, const unsigned long long newNanoseconds, const unsigned long long numOfNewOperations)
+{
+    unsigned long long oldPerOperation = oldNanoseconds / max(numOfOldOperations, 1ULL);
+    unsigned long long newPerOperation = newNanoseconds / max(numOfNewOperations, 1ULL);
+    // the speedup in tenths, from the total times so that operations under a nanosecond still count
+    unsigned long long speedup = (newNanoseconds == 0 || numOfOldOperations == 0) ? 0 :
+                                 oldNanoseconds * 10 * numOfNewOperations / numOfOldOperations / newNanoseconds;
+    output_append(output, oldName);
+    output_append(output, " ");
+    output_append_number(output, oldPerOperation);
+    output_append(output, " ns, ");
+    output_append(output, newName);
+    output_append(output, " ");
+    output_append_number(output, newPerOperation);
+    output_append(output, " ns, ");
+    output_append_number(output, speedup / 10);
+    output_append(output, ".");
+    output_append_number(output, speedup % 10);
+    output_append(output, "x");
+}
+
+// The catalog sizes compared by bench_run_skip_list
+const unsigned int benchSkipListSizes[] = {1000, 10000, 100000, 1000000};
+const unsigned int BENCH_SKIP_LIST_LOOKUPS = 100000;    // The lookups in the skip list at each size
+const unsigned long long BENCH_LIST_WALKED = 10000000; // The StockItems walked by the lookups in the list at each size, about
+
+// Helper function: search the stock item list the way it was done before the skip list, walking level 0 with strcmp
+const StockItem *bench_list_search_stock_item(const StockItem *head, const char id[MAX_ID])
+{
+    for (const StockItem *p = head; p != nullptr; p = p->next)
+    {
+        int cmp = strcmp(p->id, id);
+        if (cmp == 0)
+            return p;
+        if (cmp > 0)
+            break;
+    }
+    return nullptr;
+}
+
+// Compare ll_search_stock_item on the skip list with walking the list, at 10^3 to 10^6 stock items inserted in random order
+// return 1 if the two find different StockItems, 0 otherwise
+int bench_run_skip_list(const BenchConfig &config, ostream &out)
+{
+    OutputBuffer output = {&out, new char[IO_CHUNK_SIZE], 0, nullptr, IO_CHUNK_SIZE};
+    const unsigned int numOfSizes = sizeof(benchSkipListSizes) / sizeof(benchSkipListSizes[0]);
+    unsigned int *order = new unsigned int[benchSkipListSizes[numOfSizes - 1]];
+    const StockItem **found = new const StockItem *[BENCH_SKIP_LIST_LOOKUPS];
+    unsigned long long state = (config.seed * 0x9E3779B97F4A7C15ULL) | 1;
+    char id[MAX_ID];
+    bool valid = true;
+
+    output_append(output, "Skip list: seed ");
+    output_append_number(output, config.seed);
+    output_append(output, ", nanoseconds per lookup of a random stock item\n");
+    for (unsigned int size = 0; size < numOfSizes && valid; size++)
+    {
+        unsigned int numOfStockItems = benchSkipListSizes[size];
+        StockItem *stockItemHead = nullptr;
+        ShoppingCartTable *shoppingCartTable = dynamic_init_shopping_cart_table(1);
+        for (unsigned int i = 0; i < numOfStockItems; i++)
+            order[i] = i;
+        for (unsigned int i = numOfStockItems - 1; i > 0; i--)
+            swap(order[i], order[bench_random_below(state, i + 1)]);
+        for (unsigned int i = 0; i < numOfStockItems; i++)
+        {
+            bench_stock_item_id(order[i], id);
+            ll_insert_stock_item(stockItemHead, id, "Item", bench_stock_item_price(config, order[i]));
+        }
+
+        // the same lookups in the same order, the list only does the first ones, and both must find the same StockItems
+        unsigned long long lookupState = state;
+        unsigned int numOfListLookups = min(max(BENCH_LIST_WALKED * 2 / numOfStockItems, 10ULL), static_cast<unsigned long long>(BENCH_SKIP_LIST_LOOKUPS));
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        for (unsigned int i = 0; i < numOfListLookups; i++)
+        {
+            bench_stock_item_id(bench_random_below(lookupState, numOfStockItems), id);
+            found[i] = bench_list_search_stock_item(stockItemHead, id);
+        }
+        unsigned long long listNanoseconds = bench_elapsed(start);
+
+        lookupState = state;
+        start = chrono::steady_clock::now();
+        for (unsigned int i = 0; i < BENCH_SKIP_LIST_LOOKUPS; i++)
+        {
+            bench_stock_item_id(bench_random_below(lookupState, numOfStockItems), id);
+            const StockItem *stockItem = ll_search_stock_item(stockItemHead, id);
+            valid = valid && stockItem != nullptr && (i >= numOfListLookups || stockItem == found[i]);
+        }
+        unsigned long long skipListNanoseconds = bench_elapsed(start);
+        state = lookupState;
+
+        output_append(output, "size ");
+        output_append_number(output, numOfStockItems);
+        output_append(output, ": ");
+        bench_append_speedup(output, "list", listNanoseconds, numOfListLookups, "skip list", skipListNanoseconds, BENCH_SKIP_LIST_LOOKUPS);
+        output_append(output, "\n");
+        ll_cleanup(stockItemHead, shoppingCartTable);
+    }
+    output_append(output, valid ? "The list and the skip list find the same stock items\n" : "FAILED\n");
+    output_flush(output);
+    out.flush();
+    delete[] output.chars;
+    delete[] order;
+    delete[] found;
+    return valid ? 0 : 1;
+}
+
+const unsigned int BENCH_KEY_IDS = 50000;       // The sorted ids searched by bench_run_keys, the even ones of item00000 to item99999
+const unsigned int BENCH_KEY_LOOKUPS = 1000000; // The lookups of each kind of comparison
+
+// Helper function: binary search the sorted ids with strcmp, the way the ids were compared before the keys
+// return the index of id, or numOfIds if it is not there
+unsigned int bench_strcmp_search(const char ids[][MAX_ID], const unsigned int numOfIds, const char id[MAX_ID])
+{
+    unsigned int first = 0, last = numOfIds;
+    while (first < last)
+    {
+        unsigned int middle = first + (last - first) / 2;
+        int cmp = strcmp(ids[middle], id);
+        if (cmp == 0)
+            return middle;
+        if (cmp < 0)
+            first = middle + 1;
+        else
+            last = middle;
+    }
+    return numOfIds;
+}
+
+// Helper function: binary search the sorted ids by their keys (see compare_id_key), the key of id is encoded first
+// return the index of id, or numOfIds if it is not there
+unsigned int bench_key_search(const unsigned long long keys[], const char ids[][MAX_ID], const unsigned int numOfIds, const char id[MAX_ID])
+{
+    unsigned long long key = encode_id_key(id);
+    unsigned int first = 0, last = numOfIds;
+    while (first < last)
+    {
+        unsigned int middle = first + (last - first) / 2;
+        int cmp = compare_id_key(keys[middle], ids[middle], key, id);
+        if (cmp == 0)
+            return middle;
+        if (cmp < 0)
+            first = middle + 1;
+        else
+            last = middle;
+    }
+    return numOfIds;
+}
+
+// Compare looking up itemNNNNN ids by strcmp and by their encoded keys, both binary searching the same sorted ids,
+// half of the lookups for an id that is not there. The keys must also order random ids exactly as strcmp does
+// return 1 if the two disagree, 0 otherwise
+int bench_run_keys(const BenchConfig &config, ostream &out)
+{
+    OutputBuffer output = {&out, new char[IO_CHUNK_SIZE], 0, nullptr, IO_CHUNK_SIZE};
+    char (*ids)[MAX_ID] = new char[BENCH_KEY_IDS][MAX_ID];
+    unsigned long long *keys = new unsigned long long[BENCH_KEY_IDS];
+    char (*lookups)[MAX_ID] = new char[BENCH_KEY_LOOKUPS][MAX_ID];
+    unsigned int *found = new unsigned int[BENCH_KEY_LOOKUPS];
+    unsigned long long state = (config.seed * 0x9E3779B97F4A7C15ULL) | 1;
+    char id[MAX_ID], other[MAX_ID];
+    bool valid = true;
+    for (unsigned int i = 0; i < BENCH_KEY_IDS; i++)
+    {
+        snprintf(ids[i], MAX_ID, "item%05u", (2 * i) % 100000);
+        keys[i] = encode_id_key(ids[i]);
+    }
+
+    for (unsigned int i = 0; i < BENCH_KEY_LOOKUPS; i++)
+        snprintf(lookups[i], MAX_ID, "item%05u", bench_random_below(state, 2 * BENCH_KEY_IDS) % 100000);
+
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    for (unsigned int i = 0; i < BENCH_KEY_LOOKUPS; i++)
+        found[i] = bench_strcmp_search(ids, BENCH_KEY_IDS, lookups[i]);
+    unsigned long long strcmpNanoseconds = bench_elapsed(start);
+
+    start = chrono::steady_clock::now();
+    for (unsigned int i = 0; i < BENCH_KEY_LOOKUPS; i++)
+        valid = bench_key_search(keys, ids, BENCH_KEY_IDS, lookups[i]) == found[i] && valid;
+    unsigned long long keyNanoseconds = bench_elapsed(start);
+
+    // random ids of up to MAX_ID - 1 printable characters, close to each other so that they share prefixes
+    for (unsigned int i = 0; i < BENCH_KEY_LOOKUPS && valid; i++)
+    {
+        unsigned int length = 1 + bench_random_below(state, MAX_ID - 1);
+        for (unsigned int j = 0; j < length; j++)
+            id[j] = other[j] = static_cast<char>('0' + bench_random_below(state, 4));
+        id[length] = other[length] = '\0';
+        other[bench_random_below(state, length)] = (bench_random_below(state, 2) == 0) ? '\0' : static_cast<char>(' ' + bench_random_below(state, 95));
+        int cmp = strcmp(id, other);
+        int keyCmp = compare_id_key(encode_id_key(id), id, encode_id_key(other), other);
+        valid = (cmp > 0) - (cmp < 0) == (keyCmp > 0) - (keyCmp < 0);
+    }
+
+    output_append(output, "Keys: seed ");
+    output_append_number(output, config.seed);
+    output_append(output, ", binary search of ");
+    output_append_number(output, BENCH_KEY_IDS);
+    output_append(output, " itemNNNNN ids, ");
+    output_append_number(output, BENCH_KEY_LOOKUPS);
+    output_append(output, " lookups\n");
+    bench_append_speedup(output, "strcmp", strcmpNanoseconds, BENCH_KEY_LOOKUPS, "encoded keys", keyNanoseconds, BENCH_KEY_LOOKUPS);
+    output_append(output, valid ? "\nThe keys find and order the ids as strcmp does\n" : "\nFAILED\n");
+    output_flush(output);
+    out.flush();
+    delete[] output.chars;
+    delete[] ids;
+    delete[] keys;
+    delete[] lookups;
+    delete[] found;
+    return valid ? 0 : 1;
+}
+
+const unsigned int BENCH_REVERSE_INDEX_CARTS = 10000;      // The shopping carts filled by bench_run_reverse_index
+const unsigned int BENCH_REVERSE_INDEX_STOCK_ITEMS = 2000; // The stock items the shopping carts are filled with
+const unsigned int BENCH_REVERSE_INDEX_CHANGES = 200;      // The stock items repriced, then removed, each way
+
+// Helper function: fill the catalog and BENCH_REVERSE_INDEX_CARTS shopping carts of about cartSize random lines,
+// the same ones for the same seed
+void bench_reverse_index_setup(const BenchConfig &config, StockItem *&stockItemHead, ShoppingCartTable *&shoppingCartTable)
+{
+    unsigned long long state = (config.seed * 0x9E3779B97F4A7C15ULL) | 1;
+    char id[MAX_ID];
+    for (unsigned int i = 0; i < BENCH_REVERSE_INDEX_STOCK_ITEMS; i++)
+    {
+        bench_stock_item_id(i, id);
+        ll_insert_stock_item(stockItemHead, id, "Item", bench_stock_item_price(config, i));
+    }
+    shoppingCartTable = dynamic_init_shopping_cart_table(BENCH_REVERSE_INDEX_CARTS);
+    for (unsigned int whichCart = 0; whichCart < BENCH_REVERSE_INDEX_CARTS; whichCart++)
+    {
+        ShoppingCart *shoppingCart = shopping_cart_table_get(*shoppingCartTable, whichCart);
+        for (unsigned int line = 0; line < config.cartSize; line++)
+        {
+            bench_stock_item_id(bench_random_below(state, BENCH_REVERSE_INDEX_STOCK_ITEMS), id);
+            ll_insert_or_add_stock_item_quantity(*shoppingCart, stockItemHead, id, 1 + bench_random_below(state, 5));
+        }
+    }
+}
+
+// Helper function: change the price of a StockItem the way it was done before the reverse index,
+// searching every shopping cart for it
+bool bench_scan_update_stock_item_price(StockItem *stockItemHead, const ShoppingCartTable &shoppingCartTable, const char id[MAX_ID], const unsigned int newPriceInCents)
+{
+    StockItem *stockItem = ll_search_stock_item(stockItemHead, id);
+    if (stockItem == nullptr)
+        return false;
+    for (unsigned int whichCart = 0; whichCart < shoppingCartTable.numOfCarts; whichCart++)
+    {
+        ShoppingCart *shoppingCart = shopping_cart_table_get(shoppingCartTable, whichCart);
+        ShoppingCartItem *c = shoppingCart->isOpen ? ll_search_shopping_cart_item(*shoppingCart, id) : nullptr;
+        if (c == nullptr)
+            continue;
+        shoppingCart->totalAmount = shoppingCart->totalAmount - static_cast<unsigned long long>(c->quantity) * c->priceInCents +
+                                    static_cast<unsigned long long>(c->quantity) * newPriceInCents;
+        c->priceInCents = newPriceInCents;
+    }
+    stockItem->priceInCents = newPriceInCents;
+    return true;
+}
+
+// Helper function: remove a StockItem the way it was done before the reverse index,
+// removing it from every shopping cart first, so ll_remove_stock_item finds none holding it
+bool bench_scan_remove_stock_item(StockItem *&stockItemHead, const ShoppingCartTable &shoppingCartTable, const char id[MAX_ID])
+{
+    if (ll_search_stock_item(stockItemHead, id) == nullptr)
+        return false;
+    for (unsigned int whichCart = 0; whichCart < shoppingCartTable.numOfCarts; whichCart++)
+    {
+        ShoppingCart *shoppingCart = shopping_cart_table_get(shoppingCartTable, whichCart);
+        if (shoppingCart->isOpen)
+            ll_remove_stock_item_from_shopping_cart(*shoppingCart, id);
+    }
+    return ll_remove_stock_item(stockItemHead, id);
+}
+
+// Compare repricing and removing stock items through the shopping carts holding them (the reverse index)
+// with searching all of the BENCH_REVERSE_INDEX_CARTS shopping carts, on the same shopping carts
+// return 1 if the two leave different shopping carts, 0 otherwise
+int bench_run_reverse_index(const BenchConfig &config, ostream &out)
+{
+    OutputBuffer output = {&out, new char[IO_CHUNK_SIZE], 0, nullptr, IO_CHUNK_SIZE};
+    // the totals and the numbers of lines of every shopping cart after the changes, [0] by the old way and [1] by the new way
+    unsigned long long *totals[2] = {new unsigned long long[2 * BENCH_REVERSE_INDEX_CARTS], new unsigned long long[2 * BENCH_REVERSE_INDEX_CARTS]};
+    unsigned long long elapsed[2][2]; // [way][0] repricing, [way][1] removing
+    unsigned int numOfChanged[2] = {0, 0};
+    char id[MAX_ID];
+
+    for (int way = 0; way < 2; way++)
+    {
+        StockItem *stockItemHead = nullptr;
+        ShoppingCartTable *shoppingCartTable = nullptr;
+        bench_reverse_index_setup(config, stockItemHead, shoppingCartTable);
+
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        for (unsigned int i = 0; i < BENCH_REVERSE_INDEX_CHANGES; i++)
+        {
+            unsigned int stockItem = i * (BENCH_REVERSE_INDEX_STOCK_ITEMS / BENCH_REVERSE_INDEX_CHANGES);
+            unsigned int newPriceInCents = bench_stock_item_price(config, stockItem) + 1;
+            bench_stock_item_id(stockItem, id);
+            if (way == 0 ? bench_scan_update_stock_item_price(stockItemHead, *shoppingCartTable, id, newPriceInCents)
+                         : ll_update_stock_item_price(stockItemHead, id, newPriceInCents))
+                numOfChanged[way]++;
+        }
+        elapsed[way][0] = bench_elapsed(start);
+
+        start = chrono::steady_clock::now();
+        for (unsigned int i = 0; i < BENCH_REVERSE_INDEX_CHANGES; i++)
+        {
+            bench_stock_item_id(i * (BENCH_REVERSE_INDEX_STOCK_ITEMS / BENCH_REVERSE_INDEX_CHANGES) + 1, id);
+            if (way == 0 ? bench_scan_remove_stock_item(stockItemHead, *shoppingCartTable, id) : ll_remove_stock_item(stockItemHead, id))
+                numOfChanged[way]++;
+        }
+        elapsed[way][1] = bench_elapsed(start);
+
+        for (unsigned int whichCart = 0; whichCart < BENCH_REVERSE_INDEX_CARTS; whichCart++)
+        {
+            ShoppingCart *shoppingCart = shopping_cart_table_get(*shoppingCartTable, whichCart);
+            totals[way][2 * whichCart] = shoppingCart->totalAmount;
+            totals[way][2 * whichCart + 1] = shoppingCart->lines.size;
+        }
+        ll_cleanup(stockItemHead, shoppingCartTable);
+    }
+    bool valid = numOfChanged[0] == 2 * BENCH_REVERSE_INDEX_CHANGES && numOfChanged[1] == numOfChanged[0];
+    for (unsigned int i = 0; i < 2 * BENCH_REVERSE_INDEX_CARTS && valid; i++)
+        valid = totals[0][i] == totals[1][i];
+
+    output_append(output, "Reverse index: seed ");
+    output_append_number(output, config.seed);
+    output_append(output, ", ");
+    output_append_number(output, BENCH_REVERSE_INDEX_CARTS);
+    output_append(output, " shopping carts of up to ");
+    output_append_number(output, config.cartSize);
+    output_append(output, " lines of ");
+    output_append_number(output, BENCH_REVERSE_INDEX_STOCK_ITEMS);
+    output_append(output, " stock items, nanoseconds per stock item\nreprice: ");
+    bench_append_speedup(output, "every cart", elapsed[0][0], BENCH_REVERSE_INDEX_CHANGES, "reverse index", elapsed[1][0], BENCH_REVERSE_INDEX_CHANGES);
+    output_append(output, "\nremove: ");
+    bench_append_speedup(output, "every cart", elapsed[0][1], BENCH_REVERSE_INDEX_CHANGES, "reverse index", elapsed[1][1], BENCH_REVERSE_INDEX_CHANGES);
+    output_append(output, valid ? "\nBoth ways leave the same shopping carts\n" : "\nFAILED\n");
+    output_flush(output);
+    out.flush();
+    delete[] output.chars;
+    delete[] totals[0];
+    delete[] totals[1];
+    return valid ? 0 : 1;
+}
+
+const unsigned int BENCH_PRINT_ROUNDS = 5; // The times the lists are displayed each way
+
+// Helper function: display the lists the way ll_print_all did before the buffer, one stream operation per field
+// and endl after every line
+void bench_stream_print_all(const StockItem *stockItemHead, const ShoppingCartTable *shoppingCartTable, ostream &out)
+{
+    const StockItem *p;
+    const ShoppingCartItem *c;
+    int count;
+    unsigned int i;
+    out << "=== StockItem List (id[price]) ===" << endl;
+    count = 0;
+    for (p = stockItemHead; p != nullptr; p = p->next)
+    {
+        out << p->id << "[$" << p->priceInCents / 100;
+        out << "." << setfill('0') << setw(2) << p->priceInCents % 100 << "]";
+        if (p->next != nullptr)
+            out << " -> ";
+        count++;
+    }
+    if (count == 0)
+    {
+        out << "No items in the StockItem list";
+    }
+    out << endl;
+
+    out << "=== StockItem titles ===" << endl;
+    count = 0;
+    for (p = stockItemHead; p != nullptr; p = p->next)
+    {
+        out << p->id << ": " << p->title << endl;
+        count++;
+    }
+    if (count == 0)
+    {
+        out << "No StockItem titles" << endl;
+    }
+
+    out << "=== Shopping carts ===" << endl;
+    if (shoppingCartTable != nullptr)
+    {
+        for (i = 0; i < shoppingCartTable->numOfCarts; i++)
+        {
+            if (!shopping_cart_table_is_open(*shoppingCartTable, i))
+                continue;
+            count = 0;
+            out << "Cart " << i << ": ";
+            const CartLines &lines = shopping_cart_table_get(*shoppingCartTable, i)->lines;
+            for (CartLines::Position l = sorted_first(lines); !sorted_is_end(lines, l); l = sorted_next(lines, l))
+            {
+                c = sorted_node(lines, l);
+                if (count > 0)
+                    out << ", ";
+                out << c->item->id << ": " << c->quantity;
+                count++;
+            }
+            if (count == 0)
+            {
+                out << "No items in the shopping cart" << endl;
+            }
+            else
+            {
+                out << endl;
+            }
+        }
     }
-    return false;
 }
 
-bool ll_insert_or_add_stock_item_quantity(ShoppingCartItem *&shoppingCartHead, StockItem *stockItemHead, const char id[MAX_ID], const unsigned int quantity)
+// Compare ll_print_all with the stream version it replaced, both writing to /dev/null, on a catalog of
+// numOfStockItems stock items and numOfCarts shopping carts of about cartSize lines.
+// The output of both is captured once first and must be the same
+// return 1 if the outputs differ, 0 otherwise
+int bench_run_print(const BenchConfig &config, ostream &out)
 {
-
-    StockItem *currentGoods = ll_search_stock_item(stockItemHead, id);
-    if (currentGoods == nullptr)
+    OutputBuffer output = {&out, new char[IO_CHUNK_SIZE], 0, nullptr, IO_CHUNK_SIZE};
+    StockItem *stockItemHead = nullptr;
+    ShoppingCartTable *shoppingCartTable = dynamic_init_shopping_cart_table(config.numOfCarts);
+    unsigned long long state = (config.seed * 0x9E3779B97F4A7C15ULL) | 1;
+    char id[MAX_ID], title[MAX_TITLE];
+    for (unsigned int i = 0; i < config.numOfStockItems; i++)
     {
-        // cannot find the goods based on the id
-        return false; // cannot insert
+        bench_stock_item_id(i, id);
+        snprintf(title, MAX_TITLE, "Stock item %u", i);
+        ll_insert_stock_item(stockItemHead, id, title, bench_stock_item_price(config, i));
     }
-
-    // currentGoods is not nullptr
-
-    // empty list handling
-    if (shoppingCartHead == nullptr)
+    for (unsigned int whichCart = 0; whichCart < config.numOfCarts; whichCart++)
     {
-        shoppingCartHead = ll_create_shopping_cart_item(currentGoods, quantity);
-        return true;
+        ShoppingCart *shoppingCart = shopping_cart_table_get(*shoppingCartTable, whichCart);
+        for (unsigned int line = 0; line < config.cartSize; line++)
+        {
+            bench_stock_item_id(bench_random_below(state, config.numOfStockItems), id);
+            ll_insert_or_add_stock_item_quantity(*shoppingCart, stockItemHead, id, 1 + bench_random_below(state, 5));
+        }
     }
 
-    ShoppingCartItem *prev, *current;
-    prev = current = nullptr;
-    bool foundShoppingCartItem = ll_search_shopping_cart_item(shoppingCartHead, id, prev, current);
+    // ll_print_all writes to cout, which is redirected while the lists are displayed
+    streambuf *coutBuffer = cout.rdbuf();
+    ostringstream buffered, streamed;
+    cout.rdbuf(buffered.rdbuf());
+    ll_print_all(stockItemHead, shoppingCartTable);
+    cout.rdbuf(coutBuffer);
+    bench_stream_print_all(stockItemHead, shoppingCartTable, streamed);
+    bool valid = buffered.str() == streamed.str();
 
-    if (foundShoppingCartItem)
+    unsigned long long elapsed[2] = {0, 0}; // [0] the stream version, [1] ll_print_all
+    ofstream devNull("/dev/null");
+    cout.rdbuf(devNull.rdbuf());
+    for (unsigned int round = 0; round < BENCH_PRINT_ROUNDS; round++)
     {
-        // found an existing entry
-        // Action: update the quantity
-        current->quantity += quantity;
-        return true;
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        bench_stream_print_all(stockItemHead, shoppingCartTable, cout);
+        elapsed[0] += bench_elapsed(start);
+        start = chrono::steady_clock::now();
+        ll_print_all(stockItemHead, shoppingCartTable);
+        elapsed[1] += bench_elapsed(start);
     }
+    cout.rdbuf(coutBuffer);
+    cout << setfill(' '); // left by the stream version
 
-    // insert - normal case handling
-    ShoppingCartItem *newItem = ll_create_shopping_cart_item(currentGoods, quantity);
-    if (prev == nullptr)
+    output_append(output, "Print: seed ");
+    output_append_number(output, config.seed);
+    output_append(output, ", ");
+    output_append_number(output, config.numOfStockItems);
+    output_append(output, " stock items and ");
+    output_append_number(output, config.numOfCarts);
+    output_append(output, " shopping carts, ");
+    output_append_number(output, buffered.str().size());
+    output_append(output, " characters, nanoseconds per display\n");
+    bench_append_speedup(output, "stream", elapsed[0], BENCH_PRINT_ROUNDS, "buffered", elapsed[1], BENCH_PRINT_ROUNDS);
+    output_append(output, valid ? "\nBoth displays are the same\n" : "\nFAILED\n");
+    output_flush(output);
+    out.flush();
+    delete[] output.chars;
+    ll_cleanup(stockItemHead, shoppingCartTable);
+    return valid ? 0 : 1;
+}
+
+const unsigned int BENCH_BASKETS = 2000;      // The baskets added each way by bench_run_basket
+const unsigned int BENCH_BASKET_ITEMS = 50;   // The basket items of a basket, some of them the same stock item
+const unsigned int BENCH_BASKET_MISSING = 20; // One basket item in BENCH_BASKET_MISSING is not in the catalog
+
+// Helper function: a digest of the lines of a shopping cart, the same for the same lines and total amount
+unsigned long long bench_shopping_cart_digest(const ShoppingCart &shoppingCart)
+{
+    unsigned long long digest = shoppingCart.totalAmount;
+    const CartLines &lines = shoppingCart.lines;
+    for (CartLines::Position l = sorted_first(lines); !sorted_is_end(lines, l); l = sorted_next(lines, l))
     {
-        // insert to the front
-        newItem->next = shoppingCartHead;
-        shoppingCartHead = newItem;
+        const ShoppingCartItem *c = sorted_node(lines, l);
+        digest = (digest ^ c->item->key) * 0x100000001B3ULL + c->quantity;
     }
-    else
+    return digest;
+}
+
+// Helper function: fill a shopping cart with about cartSize random lines before a basket is added to it
+void bench_basket_prefill(const BenchConfig &config, ShoppingCart &shoppingCart, StockItem *stockItemHead, unsigned long long &state)
+{
+    char id[MAX_ID];
+    ll_clear_shopping_cart(shoppingCart);
+    for (unsigned int line = 0; line < config.cartSize; line++)
     {
-        prev->next = newItem;
-        newItem->next = current;
+        bench_stock_item_id(bench_random_below(state, config.numOfStockItems), id);
+        ll_insert_or_add_stock_item_quantity(shoppingCart, stockItemHead, id, 1 + bench_random_below(state, 5));
     }
-    return true;
 }
 
-bool ll_deduct_stock_item_quantity_from_shopping_cart(ShoppingCartItem *&shoppingCartHead, const char id[MAX_ID], const unsigned int deductQuantity)
+// Compare adding BENCH_BASKETS baskets of BENCH_BASKET_ITEMS items by ll_add_basket_to_shopping_cart
+// with one ll_insert_or_add_stock_item_quantity per basket item, each basket added both ways to the same
+// shopping cart of about cartSize lines, in a catalog of numOfStockItems stock items
+// return 1 if the two leave different shopping carts, 0 otherwise
+int bench_run_basket(const BenchConfig &config, ostream &out)
 {
+    OutputBuffer output = {&out, new char[IO_CHUNK_SIZE], 0, nullptr, IO_CHUNK_SIZE};
+    StockItem *stockItemHead = nullptr;
+    ShoppingCartTable *shoppingCartTable = dynamic_init_shopping_cart_table(config.numOfCarts);
+    BasketItem *scanned = new BasketItem[BENCH_BASKET_ITEMS];
+    BasketItem *basket = new BasketItem[BENCH_BASKET_ITEMS];
+    unsigned long long state = (config.seed * 0x9E3779B97F4A7C15ULL) | 1;
+    unsigned long long elapsed[2] = {0, 0}; // [0] per basket item, [1] the whole basket
+    unsigned long long numOfAdded[2] = {0, 0};
+    unsigned int stockItems[BENCH_BASKET_ITEMS];
+    char id[MAX_ID];
+    bool valid = true;
+    for (unsigned int i = 0; i < config.numOfStockItems; i++)
+    {
+        bench_stock_item_id(i, id);
+        ll_insert_stock_item(stockItemHead, id, "Item", bench_stock_item_price(config, i));
+    }
 
-    ShoppingCartItem *prev, *current;
-    prev = current = nullptr;
-    bool foundShoppingCartItem = ll_search_shopping_cart_item(shoppingCartHead, id, prev, current);
-
-    if (foundShoppingCartItem)
+    for (unsigned int b = 0; b < BENCH_BASKETS; b++)
     {
-        // found an existing entry
-        // Action: update the quantity
-        int newQuatity = current->quantity - deductQuantity;
-        if (newQuatity < 0)
+        ShoppingCart *shoppingCart = shopping_cart_table_get(*shoppingCartTable, b % config.numOfCarts);
+        for (unsigned int i = 0; i < BENCH_BASKET_ITEMS; i++)
         {
-            return false; // quantity cannot be negative in the shopping cart
+            // a stock item scanned again, or one missing from the catalog now and then
+            if (i > 0 && bench_random_below(state, 10) == 0)
+                stockItems[i] = stockItems[bench_random_below(state, i)];
+            else if (bench_random_below(state, BENCH_BASKET_MISSING) == 0)
+                stockItems[i] = config.numOfStockItems + bench_random_below(state, config.numOfStockItems);
+            else
+                stockItems[i] = bench_random_below(state, config.numOfStockItems);
+            bench_stock_item_id(stockItems[i], scanned[i].id);
+            scanned[i].key = encode_id_key(scanned[i].id);
+            scanned[i].quantity = 1 + bench_random_below(state, 3);
         }
-        else if (newQuatity == 0)
-        {
-            // need to delete the shopping cart item
-
-            if (prev == nullptr)
-            {
 
-                // delete and update the head
-                shoppingCartHead = current->next;
-                delete current;
-            }
-            else
-            {
-                prev->next = current->next;
-                delete current;
-            }
-            return true;
+        unsigned long long prefillState = state;
+        bench_basket_prefill(config, *shoppingCart, stockItemHead, state);
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        for (unsigned int i = 0; i < BENCH_BASKET_ITEMS; i++)
+        {
+            if (ll_insert_or_add_stock_item_quantity(*shoppingCart, stockItemHead, scanned[i].id, scanned[i].quantity))
+                numOfAdded[0]++;
         }
+        elapsed[0] += bench_elapsed(start);
+        unsigned long long digest = bench_shopping_cart_digest(*shoppingCart);
 
-        // quantity is positive
-        current->quantity = newQuatity;
-        return true;
+        state = prefillState;
+        bench_basket_prefill(config, *shoppingCart, stockItemHead, state);
+        copy(scanned, scanned + BENCH_BASKET_ITEMS, basket);
+        start = chrono::steady_clock::now();
+        numOfAdded[1] += ll_add_basket_to_shopping_cart(*shoppingCart, stockItemHead, basket, BENCH_BASKET_ITEMS);
+        elapsed[1] += bench_elapsed(start);
+        valid = valid && bench_shopping_cart_digest(*shoppingCart) == digest;
     }
+    valid = valid && numOfAdded[0] == numOfAdded[1];
 
-    return false;
+    output_append(output, "Basket: seed ");
+    output_append_number(output, config.seed);
+    output_append(output, ", ");
+    output_append_number(output, BENCH_BASKETS);
+    output_append(output, " baskets of ");
+    output_append_number(output, BENCH_BASKET_ITEMS);
+    output_append(output, " items into shopping carts of about ");
+    output_append_number(output, config.cartSize);
+    output_append(output, " lines, ");
+    output_append_number(output, config.numOfStockItems);
+    output_append(output, " stock items, nanoseconds per basket\n");
+    bench_append_speedup(output, "per item", elapsed[0], BENCH_BASKETS, "basket", elapsed[1], BENCH_BASKETS);
+    output_append(output, valid ? "\nBoth ways leave the same shopping carts\n" : "\nFAILED\n");
+    output_flush(output);
+    out.flush();
+    delete[] output.chars;
+    delete[] scanned;
+    delete[] basket;
+    ll_cleanup(stockItemHead, shoppingCartTable);
+    return valid ? 0 : 1;
 }
 
-bool ll_remove_stock_item_from_shopping_cart(ShoppingCartItem *&shoppingCartHead, const char id[MAX_ID])
-{
-
-    ShoppingCartItem *prev, *current;
-    prev = current = nullptr;
-    bool foundShoppingCartItem = ll_search_shopping_cart_item(shoppingCartHead, id, prev, current);
+const unsigned int BENCH_TOTAL_LINES = 100000; // The lines of the shopping cart totalled by bench_run_totals
+const unsigned int BENCH_TOTAL_ROUNDS = 1000;  // The times it is totalled each way
+const unsigned int BENCH_TOTAL_CHECKS = 10000; // The short shopping carts of huge amounts, overflowing or not, totalled both ways
 
-    if (foundShoppingCartItem)
+// Helper function: total the lines one at a time with an overflow check on each, the way the totals were computed
+// before calculate_total_amount
+// return false if the total amount does not fit in 64 bits
+bool bench_scalar_total_amount(const unsigned int quantities[], const unsigned int pricesInCents[], const unsigned int numOfLines, unsigned long long &totalAmount)
+{
+    unsigned long long total = 0;
+    for (unsigned int i = 0; i < numOfLines; i++)
     {
-        // found an existing entry
-        if (prev == nullptr)
-        {
-
-            // delete and update the head
-            shoppingCartHead = current->next;
-            delete current;
-        }
-        else
-        {
-            prev->next = current->next;
-            delete current;
-        }
-        return true;
+        if (!add_amount(total, quantities[i], pricesInCents[i], total))
+            return false;
     }
-
-    return false;
+    totalAmount = total;
+    return true;
 }
 
-bool ll_remove_stock_item(StockItem *&stockItemHead, ShoppingCartItem **shoppingCartItemArray, const unsigned int numOfShoppingCart, const char id[MAX_ID])
+// Compare totalling a shopping cart of BENCH_TOTAL_LINES lines by calculate_total_amount with the scalar loop,
+// one quantity changed on every round so that no round is skipped.
+// Both must also agree on short shopping carts of amounts close to 2^64, including when they overflow
+// return 1 if the two disagree, 0 otherwise
+int bench_run_totals(const BenchConfig &config, ostream &out)
 {
-
-    // empty list handling
-    if (stockItemHead == nullptr)
+    OutputBuffer output = {&out, new char[IO_CHUNK_SIZE], 0, nullptr, IO_CHUNK_SIZE};
+    unsigned int *quantities = new unsigned int[BENCH_TOTAL_LINES];
+    unsigned int *pricesInCents = new unsigned int[BENCH_TOTAL_LINES];
+    unsigned long long state = (config.seed * 0x9E3779B97F4A7C15ULL) | 1;
+    unsigned long long sums[2] = {0, 0}; // the sum of the totals of the rounds, [0] scalar, [1] vectorized
+    unsigned long long totalAmount = 0, otherTotalAmount = 0;
+    bool valid = true;
+    for (unsigned int i = 0; i < BENCH_TOTAL_LINES; i++)
     {
-        return false; // no need to remove anything from an empty list
+        quantities[i] = 1 + bench_random_below(state, 1000);
+        pricesInCents[i] = bench_stock_item_price(config, i);
     }
 
-    StockItem *prev, *current;
-    prev = current = nullptr;
-    bool foundGoods = ll_search_stock_item(stockItemHead, id, prev, current);
-
-    if (foundGoods == false)
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    for (unsigned int round = 0; round < BENCH_TOTAL_ROUNDS; round++)
     {
-        return false; // cannot remove a goods if it is not found
+        quantities[round % BENCH_TOTAL_LINES]++;
+        valid = bench_scalar_total_amount(quantities, pricesInCents, BENCH_TOTAL_LINES, totalAmount) && valid;
+        sums[0] += totalAmount;
     }
+    unsigned long long scalarNanoseconds = bench_elapsed(start);
 
-    // We need to loop through each shopping cart, and
-    // remove the corresponding shopping cart item on each shopping cart
-    // Each cart should have at most one item
-    for (int i = 0; i < numOfShoppingCart; i++)
-        ll_remove_stock_item_from_shopping_cart(shoppingCartItemArray[i], id);
-
-    // Now, it is safe to remove the goods
-
-    if (prev == nullptr)
-    {
-        // delete and update the head
-        stockItemHead = current->next;
-        delete current;
-    }
-    else
+    for (unsigned int round = 0; round < BENCH_TOTAL_ROUNDS; round++)
+        quantities[round % BENCH_TOTAL_LINES]--;
+    start = chrono::steady_clock::now();
+    for (unsigned int round = 0; round < BENCH_TOTAL_ROUNDS; round++)
     {
-        prev->next = current->next;
-        delete current;
+        quantities[round % BENCH_TOTAL_LINES]++;
+        valid = calculate_total_amount(quantities, pricesInCents, BENCH_TOTAL_LINES, totalAmount) && valid;
+        sums[1] += totalAmount;
     }
-    return true;
-}
+    unsigned long long vectorizedNanoseconds = bench_elapsed(start);
+    valid = valid && sums[0] == sums[1];
 
-unsigned int calculate_total_amount_in_shopping_cart(const ShoppingCartItem *shoppingCartHead)
-{
-    const ShoppingCartItem *c;
-    unsigned int totalAmount = 0;
-    for (c = shoppingCartHead; c != nullptr; c = c->next)
+    // quantities and prices of 0, small, or close to 2^32, so that the totals are around 2^64
+    unsigned int numOfOverflows = 0;
+    for (unsigned int check = 0; check < BENCH_TOTAL_CHECKS && valid; check++)
     {
-        if (c->item != nullptr)
+        unsigned int numOfLines = 1 + bench_random_below(state, 64);
+        for (unsigned int i = 0; i < numOfLines; i++)
         {
-            totalAmount = totalAmount + c->quantity * c->item->priceInCents;
+            unsigned int kind = bench_random_below(state, 4);
+            quantities[i] = (kind == 0) ? 0 : (kind == 3) ? 0xffffffffU - bench_random_below(state, 1000) : bench_random_below(state, 1000);
+            kind = bench_random_below(state, 4);
+            pricesInCents[i] = (kind == 3) ? 0xffffffffU - bench_random_below(state, 1 << 16) : bench_random_below(state, 1000);
+            if (bench_random_below(state, 2) == 0)
+                quantities[i] = quantities[i] >> (1 + bench_random_below(state, 8));
         }
+        bool fits = bench_scalar_total_amount(quantities, pricesInCents, numOfLines, totalAmount);
+        valid = calculate_total_amount(quantities, pricesInCents, numOfLines, otherTotalAmount) == fits && (!fits || otherTotalAmount == totalAmount);
+        if (!fits)
+            numOfOverflows++;
     }
-    return totalAmount;
+
+    output_append(output, "Totals: seed ");
+    output_append_number(output, config.seed);
+    output_append(output, ", a shopping cart of ");
+    output_append_number(output, BENCH_TOTAL_LINES);
+    output_append(output, " lines, nanoseconds per total\n");
+    bench_append_speedup(output, "scalar", scalarNanoseconds, BENCH_TOTAL_ROUNDS, "vectorized", vectorizedNanoseconds, BENCH_TOTAL_ROUNDS);
+    output_append(output, "\n");
+    output_append_number(output, numOfOverflows);
+    output_append(output, " of ");
+    output_append_number(output, BENCH_TOTAL_CHECKS);
+    output_append(output, " short shopping carts overflow\n");
+    output_append(output, valid ? "Both ways compute the same totals and overflows\n" : "FAILED\n");
+    output_flush(output);
+    out.flush();
+    delete[] output.chars;
+    delete[] quantities;
+    delete[] pricesInCents;
+    return valid ? 0 : 1;
 }
 
-void ll_clear_shopping_cart(ShoppingCartItem *&shoppingCartHead)
+// === Recovery benchmark ===
+// A writer process inserts stock items and logs them until it is killed, then the log is replayed and
+// every stock item acknowledged by the writer (committed to the log) must be recovered, with nothing after the torn tail.
+// SIGKILL leaves the page cache intact, so this checks the records and the replay, not the disk flushes.
+// The cost of the flushes is measured by the group commit benchmark that follows it
+const unsigned int BENCH_CRASHES = 12;       // The number of times the writer is killed
+const unsigned int BENCH_LOG_RECORDS = 4096; // The number of records logged with each group commit size
+const unsigned int benchCommitBatchSizes[] = {1, 8, 64};
+
+// Helper function: insert and log stock items until killed, writing the number of stock items committed so far to ackFd
+void bench_recovery_writer(const BenchConfig &config, const char *logFileName, const unsigned int commitBatchSize, const int ackFd)
 {
-    while (shoppingCartHead != nullptr)
+    StockItem *stockItemHead = nullptr;
+    ShoppingCartTable *shoppingCartTable = dynamic_init_shopping_cart_table(1);
+    OperationLog log = {-1, "", nullptr, 0, 0, 0, false};
+    char id[MAX_ID];
+    if (log_open(log, logFileName, commitBatchSize, stockItemHead, shoppingCartTable) != 0)
+        _exit(1);
+    for (unsigned int i = 0; i < config.numOfStockItems; i++)
     {
-        if (shoppingCartHead->item != nullptr)
-        {
-            ll_remove_stock_item_from_shopping_cart(shoppingCartHead, shoppingCartHead->item->id);
-        }
+        bench_stock_item_id(i, id);
+        if (!ll_insert_stock_item(stockItemHead, id, "Item", bench_stock_item_price(config, i)) ||
+            !log_append(log, LOG_INSERT_STOCK_ITEM, 0, bench_stock_item_price(config, i), id, "Item"))
+            _exit(1);
+        unsigned int numOfAcknowledged = i + 1;
+        if (log.numPending == 0 && write(ackFd, &numOfAcknowledged, sizeof(numOfAcknowledged)) != sizeof(numOfAcknowledged))
+            _exit(1);
     }
+    log_close(log);
+    _exit(0);
 }
 
-void ll_cleanup(StockItem *&stockItemHead, ShoppingCartItem **&shoppingCartItemArray, const unsigned int numOfShoppingCart)
+// Helper function: replay the log of a killed writer, return false if an acknowledged stock item is lost or a stock item is wrong
+bool bench_recover(const BenchConfig &config, const char *logFileName, const unsigned int numOfAcknowledged, unsigned int &numOfRecovered)
 {
-    while (stockItemHead != nullptr)
+    StockItem *stockItemHead = nullptr;
+    ShoppingCartTable *shoppingCartTable = dynamic_init_shopping_cart_table(1);
+    OperationLog log = {-1, "", nullptr, 0, 0, 0, false};
+    char id[MAX_ID];
+    long numOfRecords = log_open(log, logFileName, 1, stockItemHead, shoppingCartTable);
+    log_close(log);
+    // the first record of a log is the shopping cart table
+    numOfRecovered = (numOfRecords > 0) ? numOfRecords - 1 : 0;
+    bool valid = numOfRecords >= 0 && numOfRecovered >= numOfAcknowledged;
+    for (unsigned int i = 0; valid && i <= numOfRecovered && i < config.numOfStockItems; i++)
     {
-        ll_remove_stock_item(stockItemHead, shoppingCartItemArray, numOfShoppingCart, stockItemHead->id);
+        bench_stock_item_id(i, id);
+        StockItem *stockItem = ll_search_stock_item(stockItemHead, id);
+        if (i < numOfRecovered)
+            valid = stockItem != nullptr && stockItem->priceInCents == bench_stock_item_price(config, i);
+        else
+            valid = stockItem == nullptr;
     }
-
-    delete[] shoppingCartItemArray; // delete the dynamically allocated 2D array
-    shoppingCartItemArray = nullptr;
+    ll_cleanup(stockItemHead, shoppingCartTable);
+    return valid;
 }
 
-void ll_print_all(const StockItem *stockItemHead, ShoppingCartItem **shoppingCartItemArray, const unsigned int numOfShoppingCart)
+// Kill a logging writer BENCH_CRASHES times at random moments and check its recovery,
+// then report the throughput of logging BENCH_LOG_RECORDS stock items with each group commit size.
+// The log is written to logFileName (bench.log by default) and removed at the end
+int bench_run_recovery(const BenchConfig &config, const char *logFileName, ostream &out)
 {
-    const StockItem *p;
-    const ShoppingCartItem *c;
-    int count, i;
-    cout << "=== StockItem List (id[price]) ===" << endl;
-    count = 0;
-    for (p = stockItemHead; p != nullptr; p = p->next)
-    {
-        cout << p->id << "[$" << p->priceInCents / 100;
-        cout << "." << setfill('0') << setw(2) << p->priceInCents % 100 << "]";
-        if (p->next != nullptr)
-            cout << " -> ";
-        count++;
-    }
-    if (count == 0)
-    {
-        cout << "No items in the StockItem list";
-    }
-    cout << endl;
+    OutputBuffer output = {&out, new char[IO_CHUNK_SIZE], 0, nullptr, IO_CHUNK_SIZE};
+    const unsigned int numOfSizes = sizeof(benchCommitBatchSizes) / sizeof(benchCommitBatchSizes[0]);
+    unsigned long long state = (config.seed * 0x9E3779B97F4A7C15ULL) | 1;
+    bool valid = true;
+    if (logFileName == nullptr)
+        logFileName = "bench.log";
 
-    cout << "=== StockItem titles ===" << endl;
-    count = 0;
-    for (p = stockItemHead; p != nullptr; p = p->next)
-    {
-        cout << p->id << ": " << p->title << endl;
-        count++;
-    }
-    if (count == 0)
+    output_append(output, "Recovery: seed ");
+    output_append_number(output, config.seed);
+    output_append(output, ", the writer is killed ");
+    output_append_number(output, BENCH_CRASHES);
+    output_append(output, " times\n");
+    output_flush(output);
+    out.flush();
+    for (unsigned int crash = 0; crash < BENCH_CRASHES; crash++)
     {
-        cout << "No StockItem titles" << endl;
+        unsigned int commitBatchSize = benchCommitBatchSizes[crash % numOfSizes];
+        int ackPipe[2];
+        remove(logFileName);
+        if (pipe(ackPipe) != 0)
+            return 1;
+        pid_t writer = fork();
+        if (writer < 0)
+            return 1;
+        if (writer == 0)
+        {
+            close(ackPipe[0]);
+            bench_recovery_writer(config, logFileName, commitBatchSize, ackPipe[1]);
+        }
+        close(ackPipe[1]);
+        this_thread::sleep_for(chrono::microseconds(1000 + bench_random_below(state, 50000)));
+        kill(writer, SIGKILL);
+        waitpid(writer, nullptr, 0);
+        unsigned int numOfAcknowledged = 0, acknowledged;
+        while (read(ackPipe[0], &acknowledged, sizeof(acknowledged)) == sizeof(acknowledged))
+            numOfAcknowledged = acknowledged;
+        close(ackPipe[0]);
+
+        unsigned int numOfRecovered = 0;
+        bool recovered = bench_recover(config, logFileName, numOfAcknowledged, numOfRecovered);
+        valid = valid && recovered;
+        output_append(output, "group commit ");
+        output_append_number(output, commitBatchSize);
+        output_append(output, ": ");
+        output_append_number(output, numOfAcknowledged);
+        output_append(output, " acknowledged, ");
+        output_append_number(output, numOfRecovered);
+        output_append(output, recovered ? " recovered\n" : " recovered: LOST\n");
     }
 
-    cout << "=== Shopping carts ===" << endl;
-    if (shoppingCartItemArray != nullptr)
+    output_append(output, "Group commit: nanoseconds per logged stock item of ");
+    output_append_number(output, BENCH_LOG_RECORDS);
+    output_append(output, "\n");
+    char id[MAX_ID];
+    for (unsigned int size = 0; size < numOfSizes && valid; size++)
     {
-        for (i = 0; i < numOfShoppingCart; i++)
+        StockItem *stockItemHead = nullptr;
+        ShoppingCartTable *shoppingCartTable = dynamic_init_shopping_cart_table(1);
+        OperationLog log = {-1, "", nullptr, 0, 0, 0, false};
+        remove(logFileName);
+        if (log_open(log, logFileName, benchCommitBatchSizes[size], stockItemHead, shoppingCartTable) != 0)
         {
-            count = 0;
-            cout << "Cart " << i << ": ";
-            for (c = shoppingCartItemArray[i]; c != nullptr; c = c->next)
-            {
-                if (c->item != nullptr)
-                {
-                    cout << c->item->id << ": " << c->quantity;
-                    if (c->next != nullptr)
-                        cout << ", "; // except the last item, print a comma
-                    count++;
-                }
-            }
-            if (count == 0)
-            {
-                cout << "No items in the shopping cart" << endl;
-            }
-            else
-            {
-                cout << endl;
-            }
+            valid = false;
+            break;
+        }
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        for (unsigned int i = 0; i < BENCH_LOG_RECORDS; i++)
+        {
+            bench_stock_item_id(i, id);
+            ll_insert_stock_item(stockItemHead, id, "Item", bench_stock_item_price(config, i));
+            valid = log_append(log, LOG_INSERT_STOCK_ITEM, 0, bench_stock_item_price(config, i), id, "Item") && valid;
         }
+        valid = log_commit(log) && valid;
+        unsigned long long elapsed = bench_elapsed(start);
+        log_close(log);
+        ll_cleanup(stockItemHead, shoppingCartTable);
+        output_append(output, "group commit ");
+        output_append_number(output, benchCommitBatchSizes[size]);
+        output_append(output, ": ");
+        output_append_number(output, elapsed / BENCH_LOG_RECORDS);
+        output_append(output, " ns, ");
+        output_append_number(output, (elapsed == 0) ? 0 : BENCH_LOG_RECORDS * 1000000000ULL / elapsed);
+        output_append(output, " stock items/s\n");
     }
+    remove(logFileName);
+    output_append(output, valid ? "Every acknowledged stock item is recovered\n" : "FAILED\n");
+    output_flush(output);
+    out.flush();
+    delete[] output.chars;
+    return valid ? 0 : 1;
 }
 
 // === Region: The main function ===
 // The main function implementation is given
-// DO NOT make any changes to the main function
+// Run with --batch to read commands without prompts (see run_batch)
+// Run with --log <file> to log every change and recover the lists from the log on startup,
+// and --group-commit <n> to make the changes durable n at a time (1 by default)
+// Run with --stats <file> to write the operation statistics to a file on exit
+// Run with --bench to run a synthetic workload and report its throughput and latency (see bench_run), with
+// --seed <n>, --catalog <stock items>, --carts <shopping carts>, --cart-size <lines>, --operations <n>,
+// --zipf <exponent>, --deduct-percent <n> and --churn-percent <n> to change it (see BenchConfig),
+// and --bench-trace <file> to write its trace as batch commands.
+// With --tills <n>, --bench runs n threads reserving units of --hot-skus <n> stock items instead (see bench_run_contention)
+// With --containers, --bench compares the storage policies of the sorted containers instead (see bench_run_containers)
+// With --engine, --bench runs every operation of the RetailEngine on 1, 2, 4, ... up to --tills <n> threads and checks it (see bench_run_engine)
+// With --readers, --bench runs 95% lookups and 5% removes and inserts on 1 to 32 threads (see bench_run_readers)
+// With --skip-list, --bench compares the lookups in the skip list with walking the list (see bench_run_skip_list)
+// With --keys, --bench compares comparing ids by strcmp and by their encoded keys (see bench_run_keys)
+// With --reverse-index, --bench compares repricing and removing stock items through the shopping carts holding them
+// with searching every shopping cart (see bench_run_reverse_index)
+// With --print, --bench compares ll_print_all with the stream version it replaced (see bench_run_print)
+// With --basket, --bench compares adding a basket at once with adding its items one by one (see bench_run_basket)
+// With --totals, --bench compares the vectorized shopping cart totals with the scalar loop (see bench_run_totals)
+// With --recovery, --bench kills a logging writer and checks its recovery, and compares group commit sizes (see bench_run_recovery)
 // ============================
-int main()
+int main(int argc, char *argv[])
 {
+    bool batch = false;
+    bool bench = false;
+    BenchMode benchMode = BENCH_MODE_TRACE;
+    const char *logFileName = nullptr;
+    const char *statsFileName = nullptr;
+    const char *traceFileName = nullptr;
+    BenchConfig benchConfig = {1, 100000, 64, 20, 1000000, 0.99, 10, 1, 0, 4};
+    unsigned int commitBatchSize = 1;
+    for (int arg = 1; arg < argc; arg++)
+    {
+        if (strcmp(argv[arg], "--batch") == 0)
+            batch = true;
+        else if (strcmp(argv[arg], "--log") == 0 && arg + 1 < argc)
+            logFileName = argv[++arg];
+        else if (strcmp(argv[arg], "--group-commit") == 0 && arg + 1 < argc)
+            commitBatchSize = strtoul(argv[++arg], nullptr, 10);
+        else if (strcmp(argv[arg], "--stats") == 0 && arg + 1 < argc)
+            statsFileName = argv[++arg];
+        else if (strcmp(argv[arg], "--bench") == 0)
+            bench = true;
+        else if (strcmp(argv[arg], "--containers") == 0)
+            benchMode = BENCH_MODE_CONTAINERS;
+        else if (strcmp(argv[arg], "--recovery") == 0)
+            benchMode = BENCH_MODE_RECOVERY;
+        else if (strcmp(argv[arg], "--engine") == 0)
+            benchMode = BENCH_MODE_ENGINE;
+        else if (strcmp(argv[arg], "--readers") == 0)
+            benchMode = BENCH_MODE_READERS;
+        else if (strcmp(argv[arg], "--skip-list") == 0)
+            benchMode = BENCH_MODE_SKIP_LIST;
+        else if (strcmp(argv[arg], "--keys") == 0)
+            benchMode = BENCH_MODE_KEYS;
+        else if (strcmp(argv[arg], "--reverse-index") == 0)
+            benchMode = BENCH_MODE_REVERSE_INDEX;
+        else if (strcmp(argv[arg], "--print") == 0)
+            benchMode = BENCH_MODE_PRINT;
+        else if (strcmp(argv[arg], "--basket") == 0)
+            benchMode = BENCH_MODE_BASKET;
+        else if (strcmp(argv[arg], "--totals") == 0)
+            benchMode = BENCH_MODE_TOTALS;
+        else if (strcmp(argv[arg], "--bench-trace") == 0 && arg + 1 < argc)
+            traceFileName = argv[++arg];
+        else if (strcmp(argv[arg], "--seed") == 0 && arg + 1 < argc)
+            benchConfig.seed = strtoull(argv[++arg], nullptr, 10);
+        else if (strcmp(argv[arg], "--catalog") == 0 && arg + 1 < argc)
+            benchConfig.numOfStockItems = strtoul(argv[++arg], nullptr, 10);
+        else if (strcmp(argv[arg], "--carts") == 0 && arg + 1 < argc)
+            benchConfig.numOfCarts = strtoul(argv[++arg], nullptr, 10);
+        else if (strcmp(argv[arg], "--cart-size") == 0 && arg + 1 < argc)
+            benchConfig.cartSize = strtoul(argv[++arg], nullptr, 10);
+        else if (strcmp(argv[arg], "--operations") == 0 && arg + 1 < argc)
+            benchConfig.numOfOperations = strtoul(argv[++arg], nullptr, 10);
+        else if (strcmp(argv[arg], "--zipf") == 0 && arg + 1 < argc)
+            benchConfig.zipfExponent = strtod(argv[++arg], nullptr);
+        else if (strcmp(argv[arg], "--deduct-percent") == 0 && arg + 1 < argc)
+            benchConfig.deductPercent = strtoul(argv[++arg], nullptr, 10);
+        else if (strcmp(argv[arg], "--churn-percent") == 0 && arg + 1 < argc)
+            benchConfig.churnPercent = strtoul(argv[++arg], nullptr, 10);
+        else if (strcmp(argv[arg], "--tills") == 0 && arg + 1 < argc)
+            benchConfig.numOfTills = strtoul(argv[++arg], nullptr, 10);
+        else if (strcmp(argv[arg], "--hot-skus") == 0 && arg + 1 < argc)
+            benchConfig.numOfHotSkus = strtoul(argv[++arg], nullptr, 10);
+    }
+    if (bench)
+    {
+        if (benchConfig.numOfStockItems == 0 || benchConfig.numOfStockItems > 100000000 || benchConfig.numOfCarts == 0 || benchConfig.cartSize == 0 ||
+            benchConfig.zipfExponent < 0 || benchConfig.deductPercent + benchConfig.churnPercent > 100 || benchConfig.numOfHotSkus == 0)
+        {
+            cerr << "Invalid benchmark configuration" << endl;
+            return 1;
+        }
+        int status;
+        switch (benchMode)
+        {
+        case BENCH_MODE_CONTAINERS:
+            status = bench_run_containers(benchConfig, cout);
+            break;
+        case BENCH_MODE_RECOVERY:
+            status = bench_run_recovery(benchConfig, logFileName, cout);
+            break;
+        case BENCH_MODE_ENGINE:
+            status = bench_run_engine(benchConfig, cout);
+            break;
+        case BENCH_MODE_READERS:
+            status = bench_run_readers(benchConfig, cout);
+            break;
+        case BENCH_MODE_SKIP_LIST:
+            status = bench_run_skip_list(benchConfig, cout);
+            break;
+        case BENCH_MODE_KEYS:
+            status = bench_run_keys(benchConfig, cout);
+            break;
+        case BENCH_MODE_REVERSE_INDEX:
+            status = bench_run_reverse_index(benchConfig, cout);
+            break;
+        case BENCH_MODE_PRINT:
+            status = bench_run_print(benchConfig, cout);
+            break;
+        case BENCH_MODE_BASKET:
+            status = bench_run_basket(benchConfig, cout);
+            break;
+        case BENCH_MODE_TOTALS:
+            status = bench_run_totals(benchConfig, cout);
+            break;
+        default:
+            if (benchConfig.numOfTills > 0)
+                status = bench_run_contention(benchConfig, cout);
+            else
+                status = bench_run(benchConfig, traceFileName, cout);
+            break;
+        }
+        if (statsFileName != nullptr && !stats_save(statsFileName))
+            cerr << "Failed to write the statistics to " << statsFileName << endl;
+        return status;
+    }
+    if (batch)
+    {
+        ios::sync_with_stdio(false);
+        int status = run_batch(cin, cout, logFileName, commitBatchSize);
+        if (statsFileName != nullptr && !stats_save(statsFileName))
+            cerr << "Failed to write the statistics to " << statsFileName << endl;
+        return status;
+    }
+
     enum MeunOption
     {
         OPTION_DISPLAY_CURRENT_LIST = 0,
@@ -451,6 +7128,18 @@ int main()
         OPTION_REMOVE_STOCK_ITEM_FROM_STOCK_ITEM_LIST,
         OPTION_CHECKOUT_AND_CLEAR_SHOPPING_CART,
         OPTION_EXIT_SYSTEM,
+        OPTION_OPEN_SHOPPING_CART,
+        OPTION_CLOSE_SHOPPING_CART,
+        OPTION_SAVE_SNAPSHOT,
+        OPTION_LOAD_SNAPSHOT,
+        OPTION_IMPORT_STOCK_ITEMS,
+        OPTION_BULK_UPDATE_STOCK_ITEM_PRICES,
+        OPTION_LIST_STOCK_ITEMS,
+        OPTION_SEARCH_STOCK_ITEM_TITLES,
+        OPTION_ADD_SCANNED_BASKET_TO_SHOPPING_CART,
+        OPTION_DISPLAY_STATISTICS,
+        OPTION_END_DAY,
+        OPTION_RESTOCK_STOCK_ITEM,
         MAX_MENU_OPTIONS
     };
     const int MAX_MENU_OPTIONS_LENGTH = 80;
@@ -463,20 +7152,35 @@ int main()
         "Deduct a number of stock items from a shopping cart",
         "Remove an item from the stock item list",
         "Checkout and clear a shopping cart",
-        "Exit the system"};
+        "Exit the system",
+        "Open a new shopping cart",
+        "Close a shopping cart",
+        "Save the lists to a snapshot file",
+        "Load the lists from a snapshot file",
+        "Import stock items from a CSV file",
+        "Update the prices of stock items from a CSV file",
+        "List the stock items in a range page by page",
+        "Search the stock items by title",
+        "Add a scanned basket of stock items to a shopping cart",
+        "Display the operation statistics",
+        "End the day and display the sales of the day",
+        "Restock a stock item"};
 
     StockItem *stockItemHead = nullptr;
-    ShoppingCartItem **shoppingCartItemArray = nullptr;
+    ShoppingCartTable *shoppingCartTable = nullptr;
     unsigned int numOfShoppingCart = 0;
     int i, option;
     unsigned int priceInCents = 0;
     unsigned int quantity = 0;
     unsigned int deductQuantity = 0;
     unsigned int whichCart = 0;
-    unsigned int totalAmount = 0;
+    unsigned long long totalAmount = 0;
     char id[MAX_ID] = "";
     char title[MAX_TITLE] = "";
+    char fileName[MAX_FILE_NAME] = "";
+    StockItemRange range;
     bool ret = false;
+    OperationLog log = {-1, "", nullptr, 0, 0, 0, false};
 
     cout << "=== Initialize the shopping carts ===" << endl;
     while (true)
@@ -488,13 +7192,36 @@ int main()
             cout << "Invalid number of shopping cart" << endl;
             continue;
         }
-        shoppingCartItemArray = dynamic_init_shopping_cart_array(numOfShoppingCart);
+        shoppingCartTable = dynamic_init_shopping_cart_table(numOfShoppingCart);
         break;
     }
 
+    if (logFileName != nullptr)
+    {
+        long numOfRecords = log_open(log, logFileName, commitBatchSize, stockItemHead, shoppingCartTable);
+        if (numOfRecords < 0)
+        {
+            cout << "Failed to recover from " << logFileName << endl;
+            log_close(log);
+            ll_cleanup(stockItemHead, shoppingCartTable);
+            return 1;
+        }
+        cout << numOfRecords << " operations are recovered from " << logFileName << endl;
+    }
+
     cout << "=== Simplified Retail System ===" << endl;
     while (true)
     {
+        // No more operations once the log cannot be written (see log_commit)
+        if (log.failed)
+        {
+            cout << "Failed to write to " << logFileName << ", the operations after the last durable one are lost" << endl;
+            log_close(log);
+            ll_cleanup(stockItemHead, shoppingCartTable);
+            sales_release_all();
+            return 1;
+        }
+
         cout << "=== Menu ===" << endl;
         for (i = 0; i < MAX_MENU_OPTIONS; i++)
             cout << i + 1 << ": " << menuOptions[i] << endl; // shift by +1 when display
@@ -513,14 +7240,16 @@ int main()
         // Exit operations handling
         if (option == OPTION_EXIT_SYSTEM)
         {
-            ll_cleanup(stockItemHead, shoppingCartItemArray, numOfShoppingCart);
+            log_close(log);
+            ll_cleanup(stockItemHead, shoppingCartTable);
+            sales_release_all();
             break; // break the while loop
         }
 
         switch (option)
         {
         case OPTION_DISPLAY_CURRENT_LIST:
-            ll_print_all(stockItemHead, shoppingCartItemArray, numOfShoppingCart);
+            ll_print_all(stockItemHead, shoppingCartTable);
             break;
         case OPTION_INSERT_STOCK_ITEM:
             cout << "Enter a ID: ";
@@ -546,6 +7275,7 @@ int main()
             }
             else
             {
+                log_append(log, LOG_INSERT_STOCK_ITEM, 0, priceInCents, id, title);
                 cout << id << " is successfully inserted" << endl;
             }
             break;
@@ -572,6 +7302,7 @@ int main()
             }
             else
             {
+                log_append(log, LOG_UPDATE_STOCK_ITEM_PRICE, 0, priceInCents, id, "");
                 cout << id << " price is updated" << endl;
             }
             break;
@@ -579,9 +7310,9 @@ int main()
 
             while (true)
             {
-                cout << "Enter a shopping cart ID (valid: 0 to " << numOfShoppingCart - 1 << "): ";
+                cout << "Enter the ID of an open shopping cart (0 to " << shoppingCartTable->numOfCarts - 1 << "): ";
                 cin >> whichCart;
-                if (whichCart >= 0 && whichCart < numOfShoppingCart)
+                if (shopping_cart_table_is_open(*shoppingCartTable, whichCart))
                     break;
                 else
                     cout << "Please enter a valid shopping cart ID" << endl;
@@ -598,13 +7329,14 @@ int main()
                     cout << "Please enter a positive quantity" << endl;
                 }
             }
-            ret = ll_insert_or_add_stock_item_quantity(shoppingCartItemArray[whichCart], stockItemHead, id, quantity);
+            ret = ll_insert_or_add_stock_item_quantity(*shopping_cart_table_get(*shoppingCartTable, whichCart), stockItemHead, id, quantity);
             if (ret == false)
             {
                 cout << "Failed to insert/update " << id << endl;
             }
             else
             {
+                log_append(log, LOG_INSERT_OR_ADD_STOCK_ITEM, whichCart, quantity, id, "");
                 cout << id << " is successfully inserted/updated" << endl;
             }
             break;
@@ -612,9 +7344,9 @@ int main()
 
             while (true)
             {
-                cout << "Enter a shopping cart ID (valid: 0 to " << numOfShoppingCart - 1 << "): ";
+                cout << "Enter the ID of an open shopping cart (0 to " << shoppingCartTable->numOfCarts - 1 << "): ";
                 cin >> whichCart;
-                if (whichCart >= 0 && whichCart < numOfShoppingCart)
+                if (shopping_cart_table_is_open(*shoppingCartTable, whichCart))
                     break;
                 else
                     cout << "Please enter a valid shopping cart ID" << endl;
@@ -631,62 +7363,69 @@ int main()
                     cout << "Please enter a positive quantity" << endl;
                 }
             }
-            ret = ll_deduct_stock_item_quantity_from_shopping_cart(shoppingCartItemArray[whichCart], id, deductQuantity);
+            ret = ll_deduct_stock_item_quantity_from_shopping_cart(*shopping_cart_table_get(*shoppingCartTable, whichCart), id, deductQuantity);
             if (ret == false)
             {
                 cout << "Failed to deduct quantity " << id << endl;
             }
             else
             {
+                log_append(log, LOG_DEDUCT_STOCK_ITEM, whichCart, deductQuantity, id, "");
                 cout << "Quantity of " << id << " is successfully deducted" << endl;
             }
             break;
         case OPTION_REMOVE_STOCK_ITEM_FROM_SHOPPING_CART:
             while (true)
             {
-                cout << "Enter a shopping cart ID (valid: 0 to " << numOfShoppingCart - 1 << "): ";
+                cout << "Enter the ID of an open shopping cart (0 to " << shoppingCartTable->numOfCarts - 1 << "): ";
                 cin >> whichCart;
-                if (whichCart >= 0 && whichCart < numOfShoppingCart)
+                if (shopping_cart_table_is_open(*shoppingCartTable, whichCart))
                     break;
                 else
                     cout << "Please enter a valid shopping cart ID" << endl;
             }
             cout << "Enter a ID: ";
             cin >> id;
-            ret = ll_remove_stock_item_from_shopping_cart(shoppingCartItemArray[whichCart], id);
+            ret = ll_remove_stock_item_from_shopping_cart(*shopping_cart_table_get(*shoppingCartTable, whichCart), id);
             if (ret == false)
             {
                 cout << "Failed to remove goods " << id << endl;
             }
             else
             {
+                log_append(log, LOG_REMOVE_STOCK_ITEM_FROM_CART, whichCart, 0, id, "");
                 cout << id << " is successfully removed" << endl;
             }
             break;
         case OPTION_REMOVE_STOCK_ITEM_FROM_STOCK_ITEM_LIST:
             cout << "Enter a ID: ";
             cin >> id;
-            ret = ll_remove_stock_item(stockItemHead, shoppingCartItemArray, numOfShoppingCart, id);
+            ret = ll_remove_stock_item(stockItemHead, id);
             if (ret == false)
             {
                 cout << "Failed to remove " << id << " from the goods list" << endl;
             }
             else
             {
+                log_append(log, LOG_REMOVE_STOCK_ITEM, 0, 0, id, "");
                 cout << id << " is removed from the goods list" << endl;
             }
             break;
         case OPTION_CHECKOUT_AND_CLEAR_SHOPPING_CART:
             while (true)
             {
-                cout << "Enter a shopping cart ID (valid: 0 to " << numOfShoppingCart - 1 << "): ";
+                cout << "Enter the ID of an open shopping cart (0 to " << shoppingCartTable->numOfCarts - 1 << "): ";
                 cin >> whichCart;
-                if (whichCart >= 0 && whichCart < numOfShoppingCart)
+                if (shopping_cart_table_is_open(*shoppingCartTable, whichCart))
                     break;
                 else
                     cout << "Please enter a valid shopping cart ID" << endl;
             }
-            totalAmount = calculate_total_amount_in_shopping_cart(shoppingCartItemArray[whichCart]);
+            if (!ll_checkout_shopping_cart(*shopping_cart_table_get(*shoppingCartTable, whichCart), totalAmount))
+            {
+                cout << "The sale records are full, the shopping cart " << whichCart << " is not checked out" << endl;
+                break;
+            }
             if (totalAmount > 0)
             {
 
@@ -697,14 +7436,239 @@ int main()
             {
                 cout << "You don't need to pay!" << endl;
             }
-            ll_clear_shopping_cart(shoppingCartItemArray[whichCart]);
+            log_append(log, LOG_CLEAR_SHOPPING_CART, whichCart, 0, "", "");
             cout << "The shopping cart " << whichCart << " is cleared" << endl;
             break;
+        case OPTION_OPEN_SHOPPING_CART:
+            whichCart = shopping_cart_table_open(*shoppingCartTable);
+            log_append(log, LOG_OPEN_SHOPPING_CART, whichCart, 0, "", "");
+            cout << "The shopping cart " << whichCart << " is opened" << endl;
+            break;
+        case OPTION_CLOSE_SHOPPING_CART:
+            if (shoppingCartTable->numOfOpenCarts == 1)
+            {
+                cout << "The last open shopping cart cannot be closed" << endl;
+                break;
+            }
+            while (true)
+            {
+                cout << "Enter the ID of an open shopping cart (0 to " << shoppingCartTable->numOfCarts - 1 << "): ";
+                cin >> whichCart;
+                if (shopping_cart_table_is_open(*shoppingCartTable, whichCart))
+                    break;
+                else
+                    cout << "Please enter a valid shopping cart ID" << endl;
+            }
+            shopping_cart_table_close(*shoppingCartTable, whichCart);
+            log_append(log, LOG_CLOSE_SHOPPING_CART, whichCart, 0, "", "");
+            cout << "The shopping cart " << whichCart << " is closed" << endl;
+            break;
+        case OPTION_SAVE_SNAPSHOT:
+            cout << "Enter a file name: ";
+            cin >> setw(MAX_FILE_NAME) >> fileName;
+            ret = snapshot_save(fileName, stockItemHead, shoppingCartTable) && log_checkpoint(log, fileName);
+            if (ret == false)
+            {
+                cout << "Failed to save " << fileName << endl;
+            }
+            else
+            {
+                cout << "The lists are saved to " << fileName << endl;
+            }
+            break;
+        case OPTION_LOAD_SNAPSHOT:
+            cout << "Enter a file name: ";
+            cin >> setw(MAX_FILE_NAME) >> fileName;
+            ret = snapshot_load(fileName, stockItemHead, shoppingCartTable);
+            if (ret && !log_checkpoint(log, fileName))
+                log.failed = true; // the log does not hold the loaded lists
+            if (ret == false)
+            {
+                cout << "Failed to load " << fileName << endl;
+            }
+            else
+            {
+                cout << "The lists are loaded from " << fileName << endl;
+            }
+            break;
+        case OPTION_IMPORT_STOCK_ITEMS:
+            cout << "Enter a file name: ";
+            cin >> setw(MAX_FILE_NAME) >> fileName;
+            {
+                ifstream csv(fileName, ios::binary);
+                if (!csv)
+                {
+                    cout << "Failed to open " << fileName << endl;
+                    break;
+                }
+                OutputBuffer output = {&cout, new char[IO_CHUNK_SIZE], 0, &log, IO_CHUNK_SIZE};
+                unsigned int numOfInserted = ll_import_stock_items(stockItemHead, csv, output, log);
+                output_flush(output);
+                delete[] output.chars;
+                cout << numOfInserted << " stock items are imported from " << fileName << endl;
+            }
+            break;
+        case OPTION_BULK_UPDATE_STOCK_ITEM_PRICES:
+            cout << "Enter a file name: ";
+            cin >> setw(MAX_FILE_NAME) >> fileName;
+            {
+                ifstream csv(fileName, ios::binary);
+                if (!csv)
+                {
+                    cout << "Failed to open " << fileName << endl;
+                    break;
+                }
+                OutputBuffer output = {&cout, new char[IO_CHUNK_SIZE], 0, &log, IO_CHUNK_SIZE};
+                unsigned int numOfUpdated = ll_bulk_update_stock_item_prices(stockItemHead, csv, output, log);
+                output_flush(output);
+                delete[] output.chars;
+                cout << numOfUpdated << " prices are updated from " << fileName << endl;
+            }
+            break;
+        case OPTION_LIST_STOCK_ITEMS:
+            cout << "Enter the first ID (- for the first stock item): ";
+            cin >> setw(MAX_ID) >> range.firstId;
+            cout << "Enter the last ID (- for the last stock item): ";
+            cin >> setw(MAX_ID) >> range.lastId;
+            cout << "Enter the beginning of the IDs (- for any ID): ";
+            cin >> setw(MAX_ID) >> range.prefix;
+            stock_item_range_clear_dashes(range);
+
+            quantity = 0;
+            while (quantity == 0 || quantity > MAX_PAGE_SIZE)
+            {
+                cout << "Enter a page size: ";
+                cin >> quantity;
+                if (quantity == 0 || quantity > MAX_PAGE_SIZE)
+                {
+                    cout << "Enter a page size from 1 to " << MAX_PAGE_SIZE << endl;
+                }
+            }
+
+            {
+                const StockItem **page = new const StockItem *[quantity];
+                OutputBuffer output = {&cout, new char[IO_CHUNK_SIZE], 0, nullptr, IO_CHUNK_SIZE};
+                id[0] = '\0';
+                while (true)
+                {
+                    char nextId[MAX_ID];
+                    ll_print_stock_item_page(page, ll_list_stock_items(stockItemHead, range, id, quantity, page, nextId), nextId, output);
+                    output_flush(output);
+                    if (nextId[0] == '\0')
+                        break;
+                    cout << "Enter 1 for the next page, 0 to stop: ";
+                    cin >> option;
+                    if (option != 1)
+                        break;
+                    strcpy(id, nextId);
+                }
+                delete[] output.chars;
+                delete[] page;
+            }
+            break;
+        case OPTION_SEARCH_STOCK_ITEM_TITLES:
+            cout << "Enter a keyword (^ before it for the beginning of the titles): ";
+            cin >> setw(MAX_TITLE) >> title;
+            {
+                OutputBuffer output = {&cout, new char[IO_CHUNK_SIZE], 0, nullptr, IO_CHUNK_SIZE};
+                ll_print_stock_item_title_search(stockItemHead, title, output);
+                output_flush(output);
+                delete[] output.chars;
+            }
+            break;
+        case OPTION_ADD_SCANNED_BASKET_TO_SHOPPING_CART:
+
+            while (true)
+            {
+                cout << "Enter the ID of an open shopping cart (0 to " << shoppingCartTable->numOfCarts - 1 << "): ";
+                cin >> whichCart;
+                if (shopping_cart_table_is_open(*shoppingCartTable, whichCart))
+                    break;
+                else
+                    cout << "Please enter a valid shopping cart ID" << endl;
+            }
+            quantity = 0;
+            while (quantity == 0 || quantity > MAX_BASKET_ITEMS)
+            {
+                cout << "Enter the number of stock items in the basket (1.." << MAX_BASKET_ITEMS << "): ";
+                cin >> quantity;
+                if (quantity == 0 || quantity > MAX_BASKET_ITEMS)
+                {
+                    cout << "Invalid number of stock items" << endl;
+                }
+            }
+            {
+                BasketItem *basket = new BasketItem[quantity];
+                for (unsigned int j = 0; j < quantity; j++)
+                {
+                    cout << "Enter a ID: ";
+                    cin >> setw(MAX_ID) >> basket[j].id;
+                    basket[j].key = encode_id_key(basket[j].id);
+                    basket[j].quantity = 0;
+                    while (basket[j].quantity == 0)
+                    {
+                        cout << "Add a quantity: ";
+                        cin >> basket[j].quantity;
+                        if (basket[j].quantity == 0)
+                        {
+                            cout << "Please enter a positive quantity" << endl;
+                        }
+                    }
+                }
+                OutputBuffer output = {&cout, new char[IO_CHUNK_SIZE], 0, &log, IO_CHUNK_SIZE};
+                ll_add_scanned_basket(*shopping_cart_table_get(*shoppingCartTable, whichCart), whichCart, stockItemHead, basket, quantity, output, log);
+                output_flush(output);
+                delete[] output.chars;
+                delete[] basket;
+            }
+            break;
+        case OPTION_DISPLAY_STATISTICS:
+            {
+                OutputBuffer output = {&cout, new char[IO_CHUNK_SIZE], 0, nullptr, IO_CHUNK_SIZE};
+                stats_print(output);
+                output_flush(output);
+                delete[] output.chars;
+            }
+            break;
+        case OPTION_END_DAY:
+            cout << "Enter the number of top stock items: ";
+            cin >> quantity;
+            cout << "Enter a file name for the totals of every stock item (- for none): ";
+            cin >> setw(MAX_FILE_NAME) >> fileName;
+            {
+                OutputBuffer output = {&cout, new char[IO_CHUNK_SIZE], 0, nullptr, IO_CHUNK_SIZE};
+                sales_end_day(quantity, (strcmp(fileName, "-") == 0) ? nullptr : fileName, output);
+                output_flush(output);
+                delete[] output.chars;
+            }
+            log_append(log, LOG_END_DAY, 0, 0, "", "");
+            break;
+        case OPTION_RESTOCK_STOCK_ITEM:
+            cout << "Enter a ID: ";
+            cin >> id;
+            cout << "Enter the quantity: ";
+            cin >> quantity;
+            if (quantity == 0 || !ll_restock_stock_item(stockItemHead, id, quantity))
+            {
+                cout << "Failed to restock " << id << endl;
+                break;
+            }
+            log_append(log, LOG_RESTOCK_STOCK_ITEM, 0, quantity, id, "");
+            cout << id << " is restocked" << endl;
+            {
+                OutputBuffer output = {&cout, new char[IO_CHUNK_SIZE], 0, nullptr, IO_CHUNK_SIZE};
+                ll_print_stock_item_inventory(ll_search_stock_item(stockItemHead, id), output);
+                output_flush(output);
+                delete[] output.chars;
+            }
+            break;
         default:
             break;
 
         } // end of switch (option)
     }
 
+    if (statsFileName != nullptr && !stats_save(statsFileName))
+        cout << "Failed to write the statistics to " << statsFileName << endl;
     return 0;
 }